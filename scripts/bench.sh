@@ -0,0 +1,42 @@
+#!/bin/sh
+# Renders generated scenes at several resolutions and prints the --stats of
+# every render as one JSON document. `make bench` runs it; the variables
+# below pick what it renders.
+#
+#   BENCH_SCENES   spheres,planes,lights of each scene to generate
+#   BENCH_SIZES    widthxheight of each render
+#   BENCH_THREADS  render threads, 0 for one per core
+#   BENCH_SEED     seed every scene is generated with
+#   BENCH_DIR      where scenes and images are written
+set -e
+
+RAYCAST=${1:-out/raycast}
+BENCH_SCENES=${BENCH_SCENES:-"1000,1,2 10000,1,4 100000,1,8"}
+BENCH_SIZES=${BENCH_SIZES:-"320x240 1280x720"}
+BENCH_THREADS=${BENCH_THREADS:-0}
+BENCH_SEED=${BENCH_SEED:-1}
+BENCH_DIR=${BENCH_DIR:-out/bench}
+
+mkdir -p "$BENCH_DIR"
+
+printf '{"seed":%s,"runs":[' "$BENCH_SEED"
+separator=''
+for counts in $BENCH_SCENES; do
+    scene="$BENCH_DIR/scene-$(echo "$counts" | tr ',' '-').json"
+    "$RAYCAST" --generate "$counts" --seed "$BENCH_SEED" "$scene"
+
+    for size in $BENCH_SIZES; do
+        width=${size%x*}
+        height=${size#*x}
+        stats=$("$RAYCAST" --stats -t "$BENCH_THREADS" "$width" "$height" \
+            "$scene" "$BENCH_DIR/image.ppm")
+
+        # The generator's counts go in front of what raycast measured, which
+        # has the lights already
+        set -- $(echo "$counts" | tr ',' ' ')
+        printf '%s\n{"spheres":%s,"planes":%s,%s' "$separator" "$1" "$2" \
+            "${stats#\{}"
+        separator=','
+    done
+done
+printf '\n]}\n'
@@ -0,0 +1,559 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "anim.h"
+#include "scene.h"
+#include "write.h"
+
+// Keys every keyframe object has besides its properties, which stand in
+// for an ANIM_* property in animKey
+#define ANIM_KEY_FRAME (-1)
+#define ANIM_KEY_INDEX (-2)
+// Largest frame or index a keyframe may give. Far beyond any real animation
+// or scene, and it keeps both well inside size_t.
+#define ANIM_MAX_NUMBER 1e9
+
+// A key a keyframe object may have, and the property it animates
+typedef struct animKey {
+    const char* name;
+    size_t length;
+    // ANIM_* property, ANIM_KEY_FRAME or ANIM_KEY_INDEX
+    int property;
+    int required;
+} animKey;
+
+typedef struct animType {
+    const char* name;
+    size_t length;
+    int target;
+    // Required keys are checked in this order
+    const animKey* keys;
+    size_t keyCount;
+} animType;
+
+#define ANIM_KEY(name, property, required) \
+    { name, sizeof(name) - 1, property, required }
+#define ANIM_TYPE(name, target, keys) \
+    { name, sizeof(name) - 1, target, keys, sizeof(keys) / sizeof(*(keys)) }
+
+const animKey CAMERA_ANIM_KEYS[] = {
+    ANIM_KEY("frame", ANIM_KEY_FRAME, 1),
+    ANIM_KEY("width", ANIM_WIDTH, 0),
+    ANIM_KEY("height", ANIM_HEIGHT, 0)
+};
+
+const animKey LIGHT_ANIM_KEYS[] = {
+    ANIM_KEY("frame", ANIM_KEY_FRAME, 1),
+    ANIM_KEY("index", ANIM_KEY_INDEX, 1),
+    ANIM_KEY("position", ANIM_POSITION, 0),
+    ANIM_KEY("direction", ANIM_DIRECTION, 0),
+    ANIM_KEY("color", ANIM_COLOR, 0)
+};
+
+const animKey OBJECT_ANIM_KEYS[] = {
+    ANIM_KEY("frame", ANIM_KEY_FRAME, 1),
+    ANIM_KEY("index", ANIM_KEY_INDEX, 1),
+    ANIM_KEY("position", ANIM_POSITION, 0),
+    ANIM_KEY("radius", ANIM_RADIUS, 0),
+    ANIM_KEY("normal", ANIM_NORMAL, 0),
+    ANIM_KEY("diffuse_color", ANIM_DIFFUSE, 0),
+    ANIM_KEY("specular_color", ANIM_SPECULAR, 0)
+};
+
+// In ANIM_CAMERA, ANIM_LIGHT, ANIM_OBJECT order, so a target indexes it
+const animType ANIM_TYPES[] = {
+    ANIM_TYPE("camera", ANIM_CAMERA, CAMERA_ANIM_KEYS),
+    ANIM_TYPE("light", ANIM_LIGHT, LIGHT_ANIM_KEYS),
+    ANIM_TYPE("object", ANIM_OBJECT, OBJECT_ANIM_KEYS)
+};
+
+const animType* findAnimType(const char* text, size_t length);
+const animKey* findAnimKey(const animType* type, const char* text,
+    size_t length);
+int parseKeyframe(jsonParser* parser, animation* animation,
+    size_t* keysSize);
+int compareKeys(const void* first, const void* second);
+int sameTrack(const keyframe* first, const keyframe* second);
+int isScalar(int property);
+void setProperty(const keyframe* key, vector3d value, jsonObj* jsonObj);
+
+animation readAnimation(const char* path) {
+    jsonParser parser;
+    animation animation;
+
+    if(json_map(&parser, path) < 0) {
+        perror("Error: Opening keyframes\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int status = parseAnimation(&parser, &animation);
+    json_close(&parser);
+    if(status < 0) {
+        fprintf(stderr, "Error: %s\n", parser.error);
+        exit(EXIT_FAILURE);
+    }
+
+    return animation;
+}
+
+int parseAnimation(jsonParser* parser, animation* animation) {
+    size_t keysSize = 0;
+    int c;
+
+    memset(animation, 0, sizeof(*animation));
+
+    if(skipWhitespace(parser) < 0 || tokenCheck(parser, jsonGetC(parser),
+            '[') < 0 || skipWhitespace(parser) < 0) {
+        goto fail;
+    }
+
+    c = jsonGetC(parser);
+    if(c == ']') {
+        fprintf(stderr, "Warning: Line %zu: Empty array\n", parser->line);
+        return trailSpaceCheck(parser);
+    }
+    if(c < 0 || jsonUngetC(parser, c) < 0) {
+        goto fail;
+    }
+
+    do {
+        if(skipWhitespace(parser) < 0 ||
+                parseKeyframe(parser, animation, &keysSize) < 0 ||
+                skipWhitespace(parser) < 0) {
+            goto fail;
+        }
+    }
+    while((c = jsonGetC(parser)) == ',');
+
+    if(tokenCheck(parser, c, ']') < 0 || trailSpaceCheck(parser) < 0) {
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    anim_free(animation);
+
+    return -1;
+}
+
+// Parses one keyframe object, adding a keyframe per property it sets
+int parseKeyframe(jsonParser* parser, animation* animation,
+        size_t* keysSize) {
+    const char* text;
+    size_t length;
+    int c;
+
+    // Keys and types are matched where they are in the input, as in
+    // parseScene()
+    if(tokenCheck(parser, jsonGetC(parser), '{') < 0 ||
+            skipWhitespace(parser) < 0 ||
+            (text = scanString(parser, &length)) == NULL) {
+        return -1;
+    }
+    if(!matchName("type", 4, text, length)) {
+        return jsonError(parser, "First key must be 'type'");
+    }
+
+    if(skipWhitespace(parser) < 0 || tokenCheck(parser, jsonGetC(parser),
+            ':') < 0 || skipWhitespace(parser) < 0 ||
+            (text = scanString(parser, &length)) == NULL) {
+        return -1;
+    }
+    const animType* type = findAnimType(text, length);
+    if(type == NULL) {
+        return jsonError(parser, "Unknown keyframe type %.*s", (int)length,
+            text);
+    }
+
+    // Properties come before or after "frame" and "index", so those are
+    // filled in once the whole object is read
+    size_t first = animation->count;
+    size_t frame = 0, index = 0;
+    int keyFlag = 0;
+
+    if(skipWhitespace(parser) < 0) {
+        return -1;
+    }
+    while((c = jsonGetC(parser)) == ',') {
+        if(skipWhitespace(parser) < 0 ||
+                (text = scanString(parser, &length)) == NULL ||
+                skipWhitespace(parser) < 0 ||
+                tokenCheck(parser, jsonGetC(parser), ':') < 0 ||
+                skipWhitespace(parser) < 0) {
+            return -1;
+        }
+
+        const animKey* key = findAnimKey(type, text, length);
+        if(key == NULL) {
+            return jsonError(parser, "Key '%.*s' not supported under '%s' "
+                "keyframes", (int)length, text, type->name);
+        }
+        if(parseFlag(parser, &keyFlag, 1 << (key - type->keys),
+                key->name) < 0) {
+            return -1;
+        }
+
+        double value;
+        if(key->property == ANIM_KEY_FRAME ||
+                key->property == ANIM_KEY_INDEX) {
+            if(nextNumber(parser, &value) < 0) {
+                return -1;
+            }
+            if(!(value >= 0 && value <= ANIM_MAX_NUMBER) ||
+                    value != floor(value)) {
+                return jsonError(parser, "'%s' must be a whole number from 0 "
+                    "to %.0f", key->name, ANIM_MAX_NUMBER);
+            }
+            if(key->property == ANIM_KEY_FRAME) {
+                frame = value;
+            }
+            else {
+                index = value;
+            }
+        }
+        else {
+            if(animation->count == *keysSize) {
+                *keysSize = *keysSize > 0 ? *keysSize * 2 : 16;
+                keyframe* keys = realloc(animation->keys, *keysSize *
+                    sizeof(*(animation->keys)));
+                if(keys == NULL) {
+                    return jsonError(parser, "Memory reallocation error");
+                }
+                animation->keys = keys;
+            }
+
+            keyframe* keyframe = &(animation->keys[animation->count++]);
+            memset(keyframe, 0, sizeof(*keyframe));
+            keyframe->target = type->target;
+            keyframe->property = key->property;
+            if(isScalar(key->property)) {
+                if(nextNumber(parser, &value) < 0) {
+                    return -1;
+                }
+                keyframe->value.x = value;
+                if(keyframe->value.x < 0) {
+                    return jsonError(parser, "'%s' cannot be negative",
+                        key->name);
+                }
+            }
+            else if(key->property == ANIM_COLOR ||
+                    key->property == ANIM_DIFFUSE ||
+                    key->property == ANIM_SPECULAR) {
+                if(nextColor(parser, &(keyframe->value)) < 0) {
+                    return -1;
+                }
+            }
+            else if(nextVector3d(parser, &(keyframe->value)) < 0) {
+                return -1;
+            }
+        }
+
+        if(skipWhitespace(parser) < 0) {
+            return -1;
+        }
+    }
+
+    if(tokenCheck(parser, c, '}') < 0) {
+        return -1;
+    }
+    for(size_t i = 0; i < type->keyCount; i++) {
+        if(type->keys[i].required && !(keyFlag & 1 << i)) {
+            return jsonError(parser, "'%s' keyframe missing '%s'", type->name,
+                type->keys[i].name);
+        }
+    }
+    for(size_t i = first; i < animation->count; i++) {
+        animation->keys[i].frame = frame;
+        animation->keys[i].index = index;
+    }
+
+    return 0;
+}
+
+void anim_free(animation* animation) {
+    free(animation->keys);
+    memset(animation, 0, sizeof(*animation));
+}
+
+int anim_check(animation* animation, const jsonObj* jsonObj) {
+    size_t objCount = 0, lightCount = 0;
+
+    for(; jsonObj->objs[objCount] != NULL; objCount++);
+    for(; jsonObj->lights[lightCount] != NULL; lightCount++);
+
+    qsort(animation->keys, animation->count, sizeof(*(animation->keys)),
+        compareKeys);
+
+    for(size_t i = 0; i < animation->count; i++) {
+        const keyframe* key = &(animation->keys[i]);
+
+        if(i > 0 && sameTrack(key, key - 1) && key->frame == key[-1].frame) {
+            fprintf(stderr, "Error: Frame %zu has two keyframes for the same "
+                "%s property\n", key->frame, ANIM_TYPES[key->target].name);
+            return -1;
+        }
+        if((key->target == ANIM_LIGHT && key->index >= lightCount) ||
+                (key->target == ANIM_OBJECT && key->index >= objCount)) {
+            fprintf(stderr, "Error: Keyframe for %s %zu, but the scene has "
+                "only %zu\n", ANIM_TYPES[key->target].name, key->index,
+                key->target == ANIM_LIGHT ? lightCount : objCount);
+            return -1;
+        }
+        if(key->target == ANIM_OBJECT) {
+            int type = jsonObj->objs[key->index]->type;
+            if((key->property == ANIM_RADIUS && type != TYPE_SPHERE) ||
+                    (key->property == ANIM_NORMAL && type != TYPE_PLANE)) {
+                fprintf(stderr, "Error: Object %zu has no %s to animate\n",
+                    key->index, key->property == ANIM_RADIUS ? "radius" :
+                    "normal");
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int anim_frameCount(const char* value, size_t* frames) {
+    char* endptr;
+    size_t count = strtoul(value, &endptr, 10);
+    // strtoul() would wrap a negative count around to a huge one
+    if(!(*value != '\0' && *endptr == '\0') || count < 1 ||
+            strchr(value, '-') != NULL) {
+        fprintf(stderr, "Error: Frame count must be at least 1\n");
+        return -1;
+    }
+
+    *frames = count;
+
+    return 0;
+}
+
+size_t anim_frames(const animation* animation) {
+    size_t frames = 1;
+
+    for(size_t i = 0; i < animation->count; i++) {
+        if(animation->keys[i].frame >= frames) {
+            frames = animation->keys[i].frame + 1;
+        }
+    }
+
+    return frames;
+}
+
+void anim_apply(const animation* animation, size_t frame, jsonObj* jsonObj) {
+    const keyframe* keys = animation->keys;
+
+    for(size_t start = 0; start < animation->count;) {
+        size_t end = start + 1;
+        for(; end < animation->count && sameTrack(&(keys[end]),
+            &(keys[start])); end++);
+
+        // The last keyframe at or before frame, or the first one if none is
+        size_t before = start;
+        for(size_t i = start; i < end && keys[i].frame <= frame; i++) {
+            before = i;
+        }
+
+        vector3d value = keys[before].value;
+        if(before + 1 < end && keys[before].frame <= frame) {
+            const keyframe* next = &(keys[before + 1]);
+            real s = (real)(frame - keys[before].frame) /
+                (next->frame - keys[before].frame);
+
+            value = vector3d_add(value, vector3d_scale(vector3d_sub(
+                next->value, value), s));
+        }
+        setProperty(&(keys[start]), value, jsonObj);
+
+        start = end;
+    }
+}
+
+int anim_run(const animation* animation, size_t frames,
+        const char* outputPath, jsonObj* jsonObj, pixel* pixels, size_t width,
+        size_t height, const renderOpts* opts) {
+    pnmHeader header = { 6, width, height, 255 };
+    struct timespec start, end;
+    scene scene;
+
+    FILE* outputFd = strcmp(outputPath, "-") == 0 ? stdout :
+        fopen(outputPath, "w");
+    if(outputFd == NULL) {
+        perror("Error: Cannot open output file\n");
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // The parsed scene and the pixels are reused for every frame. The
+    // compiled scene is rebuilt, since object positions may change, but its
+    // meshes are only loaded for the first frame.
+    int status = 0;
+    int compiled = 0;
+    for(size_t frame = 0; frame < frames && status == 0; frame++) {
+        anim_apply(animation, frame, jsonObj);
+
+        if(compiled) {
+            status = scene_recompile(&scene, jsonObj->camera, jsonObj->objs,
+                jsonObj->lights);
+        }
+        else {
+            status = scene_compile(&scene, jsonObj->camera, jsonObj->objs,
+                jsonObj->lights, NULL);
+        }
+        // Either way a failed compile leaves nothing to free
+        compiled = status == 0;
+        if(status < 0) {
+            break;
+        }
+        status = raycast(pixels, width, height, &scene, opts, NULL);
+
+        if(status == 0 && (writeHeader(header, outputFd) < 0 ||
+                writeBody(header, pixels, outputFd, opts->threads) < 0)) {
+            status = -1;
+        }
+        // Hand every frame over as soon as it is done, so an encoder on the
+        // other end of a pipe can keep up
+        if(status == 0 && fflush(outputFd) != 0) {
+            perror("Error: Cannot write output file\n");
+            status = -1;
+        }
+    }
+    if(compiled) {
+        scene_free(&scene);
+    }
+
+    // Closed on failure too, so a file is never left open
+    if(outputFd != stdout && fclose(outputFd) != 0 && status == 0) {
+        perror("Error: Cannot write output file\n");
+        status = -1;
+    }
+    if(status < 0) {
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    // Timing stays double in the single-precision build
+    double seconds = (end.tv_sec - start.tv_sec) +
+        (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "Rendered %zu frames in %.3fs (%.2f frames per second)\n",
+        frames, seconds, frames / seconds);
+
+    return 0;
+}
+
+// Orders keyframes by target, index, property and then frame
+int compareKeys(const void* first, const void* second) {
+    const keyframe* a = first;
+    const keyframe* b = second;
+
+    if(a->target != b->target) {
+        return a->target < b->target ? -1 : 1;
+    }
+    if(a->index != b->index) {
+        return a->index < b->index ? -1 : 1;
+    }
+    if(a->property != b->property) {
+        return a->property < b->property ? -1 : 1;
+    }
+    if(a->frame != b->frame) {
+        return a->frame < b->frame ? -1 : 1;
+    }
+
+    return 0;
+}
+
+// Whether both keyframes animate the same property of the same thing
+int sameTrack(const keyframe* first, const keyframe* second) {
+    return first->target == second->target && first->index == second->index &&
+        first->property == second->property;
+}
+
+int isScalar(int property) {
+    return property == ANIM_WIDTH || property == ANIM_HEIGHT ||
+        property == ANIM_RADIUS;
+}
+
+void setProperty(const keyframe* key, vector3d value, jsonObj* jsonObj) {
+    if(key->target == ANIM_CAMERA) {
+        if(key->property == ANIM_WIDTH) {
+            jsonObj->camera.width = value.x;
+        }
+        else {
+            jsonObj->camera.height = value.x;
+        }
+        return;
+    }
+
+    if(key->target == ANIM_LIGHT) {
+        sceneLight* light = jsonObj->lights[key->index];
+        switch(key->property) {
+            case(ANIM_POSITION):
+                light->pos = value;
+                break;
+            case(ANIM_DIRECTION):
+                light->dir = value;
+                break;
+            case(ANIM_COLOR):
+                light->color = value;
+                break;
+        }
+        return;
+    }
+
+    sceneObj* obj = jsonObj->objs[key->index];
+    switch(key->property) {
+        case(ANIM_POSITION):
+            if(obj->type == TYPE_SPHERE) {
+                obj->sphere.pos = value;
+            }
+            else if(obj->type == TYPE_PLANE) {
+                obj->plane.pos = value;
+            }
+            else {
+                obj->mesh.pos = value;
+            }
+            break;
+        case(ANIM_RADIUS):
+            obj->sphere.radius = value.x;
+            break;
+        case(ANIM_NORMAL):
+            obj->plane.normal = value;
+            break;
+        case(ANIM_DIFFUSE):
+            obj->diffuse = value;
+            break;
+        case(ANIM_SPECULAR):
+            obj->specular = value;
+            break;
+    }
+}
+
+const animType* findAnimType(const char* text, size_t length) {
+    for(size_t i = 0; i < sizeof(ANIM_TYPES) / sizeof(*ANIM_TYPES); i++) {
+        if(matchName(ANIM_TYPES[i].name, ANIM_TYPES[i].length, text,
+                length)) {
+            return &(ANIM_TYPES[i]);
+        }
+    }
+
+    return NULL;
+}
+
+const animKey* findAnimKey(const animType* type, const char* text,
+        size_t length) {
+    for(size_t i = 0; i < type->keyCount; i++) {
+        if(matchName(type->keys[i].name, type->keys[i].length, text, length)) {
+            return &(type->keys[i]);
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,64 @@
+#ifndef CS430_ANIM_H
+#define CS430_ANIM_H
+
+#include <stddef.h>
+
+#include "json.h"
+#include "pnm.h"
+#include "raycast.h"
+
+// What a keyframe animates
+#define ANIM_CAMERA 0
+#define ANIM_LIGHT 1
+#define ANIM_OBJECT 2
+
+// Animated properties. Width, height and radius are scalars kept in value.x.
+#define ANIM_WIDTH 0
+#define ANIM_HEIGHT 1
+#define ANIM_POSITION 2
+#define ANIM_DIRECTION 3
+#define ANIM_COLOR 4
+#define ANIM_RADIUS 5
+#define ANIM_NORMAL 6
+#define ANIM_DIFFUSE 7
+#define ANIM_SPECULAR 8
+
+typedef struct keyframe {
+    size_t frame;
+    // ANIM_CAMERA, ANIM_LIGHT or ANIM_OBJECT, and for the latter two the
+    // position among the scene file's lights or objects
+    int target;
+    size_t index;
+    int property;
+    vector3d value;
+} keyframe;
+
+// All the keyframes of a file, one per animated property. Once checked they
+// are sorted so every property's keyframes form a run ordered by frame.
+typedef struct animation {
+    keyframe* keys;
+    size_t count;
+} animation;
+
+// parseAnimation() on the file at path, exiting with the error on failure
+animation readAnimation(const char* path);
+// Parses a keyframe file the way parseScene() parses a scene
+int parseAnimation(jsonParser* parser, animation* animation);
+void anim_free(animation* animation);
+// Sorts the keyframes and checks them against the parsed scene
+int anim_check(animation* animation, const jsonObj* jsonObj);
+// Parses the argument of -f
+int anim_frameCount(const char* value, size_t* frames);
+// The frame after the last keyframe, or 1 if there are none
+size_t anim_frames(const animation* animation);
+// Sets every animated property of jsonObj to its value at frame, linearly
+// interpolated between keyframes and held before the first and after the last
+void anim_apply(const animation* animation, size_t frame, jsonObj* jsonObj);
+
+// Renders frames frames of jsonObj, animated by animation, into pixels and
+// writes each one as a P6 image to outputPath ("-" for stdout), back to back
+int anim_run(const animation* animation, size_t frames,
+    const char* outputPath, jsonObj* jsonObj, pixel* pixels, size_t width,
+    size_t height, const renderOpts* opts);
+
+#endif // CS430_ANIM_H
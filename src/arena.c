@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+void* arenaTake(arena* arena, size_t size, size_t align);
+
+void arena_init(arena* arena) {
+    arena->blocks = NULL;
+}
+
+void* arena_alloc(arena* arena, size_t size) {
+    void* memory = arenaTake(arena, size, _Alignof(max_align_t));
+    if(memory != NULL) {
+        memset(memory, 0, size);
+    }
+
+    return memory;
+}
+
+char* arena_string(arena* arena, const char* text, size_t length) {
+    // Strings need no alignment, so they pack end to end
+    char* string = arenaTake(arena, length + 1, 1);
+    if(string != NULL) {
+        memcpy(string, text, length);
+        string[length] = '\0';
+    }
+
+    return string;
+}
+
+void arena_free(arena* arena) {
+    arenaBlock* block = arena->blocks;
+    while(block != NULL) {
+        arenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+}
+
+void arena_merge(arena* dst, arena* src) {
+    if(src->blocks == NULL) {
+        return;
+    }
+    if(dst->blocks == NULL) {
+        dst->blocks = src->blocks;
+        src->blocks = NULL;
+        return;
+    }
+
+    // In behind the newest block of dst, which it keeps allocating from
+    arenaBlock* last = src->blocks;
+    while(last->next != NULL) {
+        last = last->next;
+    }
+    last->next = dst->blocks->next;
+    dst->blocks->next = src->blocks;
+    src->blocks = NULL;
+}
+
+// size bytes at a multiple of align (a power of two) within a block's data,
+// starting a new block when the newest one is full
+void* arenaTake(arena* arena, size_t size, size_t align) {
+    arenaBlock* block = arena->blocks;
+
+    if(block != NULL) {
+        size_t start = (block->used + align - 1) & ~(align - 1);
+        if(start <= block->size && size <= block->size - start) {
+            block->used = start + size;
+            return (unsigned char*)block->data + start;
+        }
+    }
+
+    size_t blockSize = block == NULL ? ARENA_MIN_BLOCK :
+        (block->size < ARENA_MAX_BLOCK ? 2 * block->size : block->size);
+    if(blockSize < size) {
+        blockSize = size;
+    }
+    if(blockSize > (size_t)-1 - sizeof(arenaBlock)) {
+        return NULL;
+    }
+
+    arenaBlock* fresh = malloc(sizeof(arenaBlock) + blockSize);
+    if(fresh == NULL) {
+        return NULL;
+    }
+    fresh->next = block;
+    fresh->size = blockSize;
+    fresh->used = size;
+    arena->blocks = fresh;
+
+    return fresh->data;
+}
@@ -0,0 +1,36 @@
+#ifndef CS430_ARENA_H
+#define CS430_ARENA_H
+
+#include <stddef.h>
+
+// Smallest and largest block an arena asks malloc() for. Blocks double in
+// size from the first up to the largest; bigger requests get a block sized
+// to fit.
+#define ARENA_MIN_BLOCK 4096
+#define ARENA_MAX_BLOCK (1 << 20)
+
+typedef struct arenaBlock {
+    struct arenaBlock* next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+} arenaBlock;
+
+// Memory handed out in pieces and given back all at once. The struct may be
+// copied freely; the blocks it points to are what hold the memory.
+typedef struct arena {
+    // Newest block first
+    arenaBlock* blocks;
+} arena;
+
+void arena_init(arena* arena);
+// size zeroed bytes aligned for any type, or NULL when out of memory
+void* arena_alloc(arena* arena, size_t size);
+// A NUL terminated copy of the length bytes at text
+char* arena_string(arena* arena, const char* text, size_t length);
+void arena_free(arena* arena);
+// Moves every block of src into dst, leaving src empty. What was allocated
+// from either stays where it is and is now freed with dst.
+void arena_merge(arena* dst, arena* src);
+
+#endif // CS430_ARENA_H
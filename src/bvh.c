@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "bvh.h"
+
+typedef struct bvhBuilder {
+    bvh* bvh;
+    const vector3d* mins;
+    const vector3d* maxs;
+    vector3d* centroids;
+} bvhBuilder;
+
+typedef struct bvhBin {
+    vector3d min;
+    vector3d max;
+    size_t count;
+} bvhBin;
+
+void buildNode(bvhBuilder* builder, size_t node, size_t start, size_t end,
+    size_t depth);
+size_t medianSplit(bvhBuilder* builder, size_t start, size_t end, int axis);
+void growBox(vector3d* min, vector3d* max, vector3d pointMin, vector3d pointMax);
+real boxArea(vector3d min, vector3d max);
+real axisOf(vector3d vector, int axis);
+
+int bvh_build(bvh* bvh, const vector3d* mins, const vector3d* maxs,
+        size_t count) {
+    memset(bvh, 0, sizeof(*bvh));
+    if(count == 0) {
+        return 0;
+    }
+
+    bvhBuilder builder = { bvh, mins, maxs, NULL };
+
+    // A binary tree with count leaves at most has 2 * count - 1 nodes
+    bvh->nodes = malloc(sizeof(*(bvh->nodes)) * (2 * count - 1));
+    bvh->indices = malloc(sizeof(*(bvh->indices)) * count);
+    builder.centroids = malloc(sizeof(*(builder.centroids)) * count);
+    if(bvh->nodes == NULL || bvh->indices == NULL || builder.centroids == NULL) {
+        fprintf(stderr, "Error: Memory allocation error\n");
+        free(builder.centroids);
+        bvh_free(bvh);
+        return -1;
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        bvh->indices[i] = i;
+        builder.centroids[i] = vector3d_scale(vector3d_add(mins[i], maxs[i]),
+            0.5);
+    }
+
+    bvh->count = count;
+    bvh->nodeCount = 1;
+    buildNode(&builder, 0, 0, count, 0);
+
+    free(builder.centroids);
+
+    // Leaves hold several primitives, so the tree rarely needs all the nodes
+    // allocated for it
+    bvhNode* nodes = realloc(bvh->nodes, sizeof(*nodes) * bvh->nodeCount);
+    if(nodes != NULL) {
+        bvh->nodes = nodes;
+    }
+
+    return 0;
+}
+
+void bvh_free(bvh* bvh) {
+    free(bvh->nodes);
+    free(bvh->indices);
+    memset(bvh, 0, sizeof(*bvh));
+}
+
+void buildNode(bvhBuilder* builder, size_t node, size_t start, size_t end,
+        size_t depth) {
+    bvh* bvh = builder->bvh;
+    size_t* indices = bvh->indices;
+    size_t count = end - start;
+
+    vector3d min = builder->mins[indices[start]];
+    vector3d max = builder->maxs[indices[start]];
+    vector3d centroidMin = builder->centroids[indices[start]];
+    vector3d centroidMax = centroidMin;
+    for(size_t i = start + 1; i < end; i++) {
+        growBox(&min, &max, builder->mins[indices[i]], builder->maxs[indices[i]]);
+        growBox(&centroidMin, &centroidMax, builder->centroids[indices[i]],
+            builder->centroids[indices[i]]);
+    }
+
+    bvh->nodes[node].min = min;
+    bvh->nodes[node].max = max;
+    bvh->nodes[node].first = start;
+    bvh->nodes[node].count = count;
+
+    if(count <= BVH_LEAF_SIZE) {
+        return;
+    }
+
+    // Split along the axis the centroids are most spread out on
+    vector3d extent = vector3d_sub(centroidMax, centroidMin);
+    int axis = 0;
+    if(extent.y > axisOf(extent, axis)) {
+        axis = 1;
+    }
+    if(extent.z > axisOf(extent, axis)) {
+        axis = 2;
+    }
+
+    real low = axisOf(centroidMin, axis);
+    real width = axisOf(extent, axis);
+    // Every centroid is in the same spot, so no split can separate them
+    if(width <= 0) {
+        return;
+    }
+
+    size_t split;
+    if(depth >= BVH_MAX_SAH_DEPTH) {
+        split = medianSplit(builder, start, end, axis);
+    }
+    else {
+        bvhBin bins[BVH_BINS] = { 0 };
+        real scale = BVH_BINS / width;
+
+        for(size_t i = start; i < end; i++) {
+            size_t bin = (axisOf(builder->centroids[indices[i]], axis) - low) *
+                scale;
+            if(bin >= BVH_BINS) {
+                bin = BVH_BINS - 1;
+            }
+            if(bins[bin].count++ == 0) {
+                bins[bin].min = builder->mins[indices[i]];
+                bins[bin].max = builder->maxs[indices[i]];
+            }
+            else {
+                growBox(&(bins[bin].min), &(bins[bin].max),
+                    builder->mins[indices[i]], builder->maxs[indices[i]]);
+            }
+        }
+
+        // Sweep from the right to get the cost of every right-hand side, then
+        // from the left to pick the cheapest plane (surface area heuristic).
+        real rightArea[BVH_BINS];
+        size_t rightCount[BVH_BINS];
+        vector3d boxMin = { 0 }, boxMax = { 0 };
+        size_t running = 0;
+        for(size_t i = BVH_BINS - 1; i > 0; i--) {
+            if(bins[i].count > 0) {
+                if(running == 0) {
+                    boxMin = bins[i].min;
+                    boxMax = bins[i].max;
+                }
+                else {
+                    growBox(&boxMin, &boxMax, bins[i].min, bins[i].max);
+                }
+                running += bins[i].count;
+            }
+            rightArea[i] = running > 0 ? boxArea(boxMin, boxMax) : 0;
+            rightCount[i] = running;
+        }
+
+        real bestCost = INFINITY;
+        size_t bestBin = 0;
+        running = 0;
+        for(size_t i = 0; i < BVH_BINS - 1; i++) {
+            if(bins[i].count > 0) {
+                if(running == 0) {
+                    boxMin = bins[i].min;
+                    boxMax = bins[i].max;
+                }
+                else {
+                    growBox(&boxMin, &boxMax, bins[i].min, bins[i].max);
+                }
+                running += bins[i].count;
+            }
+            if(running == 0 || rightCount[i + 1] == 0) {
+                continue;
+            }
+            real cost = boxArea(boxMin, boxMax) * running +
+                rightArea[i + 1] * rightCount[i + 1];
+            if(cost < bestCost) {
+                bestCost = cost;
+                bestBin = i;
+            }
+        }
+
+        // Partition indices in place around the chosen bin boundary
+        size_t left = start;
+        size_t right = end;
+        while(left < right) {
+            size_t bin = (axisOf(builder->centroids[indices[left]], axis) -
+                low) * scale;
+            if(bin >= BVH_BINS) {
+                bin = BVH_BINS - 1;
+            }
+            if(bin <= bestBin) {
+                left++;
+            }
+            else {
+                size_t swap = indices[left];
+                indices[left] = indices[--right];
+                indices[right] = swap;
+            }
+        }
+        split = left;
+
+        if(split == start || split == end) {
+            split = medianSplit(builder, start, end, axis);
+        }
+    }
+
+    size_t children = bvh->nodeCount;
+    bvh->nodeCount += 2;
+    bvh->nodes[node].first = children;
+    bvh->nodes[node].count = 0;
+
+    buildNode(builder, children, start, split, depth + 1);
+    buildNode(builder, children + 1, split, end, depth + 1);
+}
+
+// Fallback for degenerate SAH splits: cut the range in half around the median
+// centroid, found by quickselect so this stays linear.
+size_t medianSplit(bvhBuilder* builder, size_t start, size_t end, int axis) {
+    size_t* indices = builder->bvh->indices;
+    size_t median = start + (end - start) / 2;
+    size_t low = start;
+    size_t high = end;
+
+    // Three-way partition of [low, high) until the median lands in the run
+    // of keys equal to the pivot
+    while(high - low > 1) {
+        real pivot = axisOf(builder->centroids[indices[low + (high - low) / 2]],
+            axis);
+        size_t less = low;
+        size_t i = low;
+        size_t greater = high;
+
+        while(i < greater) {
+            real key = axisOf(builder->centroids[indices[i]], axis);
+            size_t swap = indices[i];
+            if(key < pivot) {
+                indices[i++] = indices[less];
+                indices[less++] = swap;
+            }
+            else if(key > pivot) {
+                indices[i] = indices[--greater];
+                indices[greater] = swap;
+            }
+            else {
+                i++;
+            }
+        }
+
+        if(median < less) {
+            high = less;
+        }
+        else if(median >= greater) {
+            low = greater;
+        }
+        else {
+            break;
+        }
+    }
+
+    return median;
+}
+
+// Plain comparisons rather than fmin() and fmax(), which are library calls
+// and dominate building trees over millions of triangles
+void growBox(vector3d* min, vector3d* max, vector3d pointMin, vector3d pointMax) {
+    min->x = pointMin.x < min->x ? pointMin.x : min->x;
+    min->y = pointMin.y < min->y ? pointMin.y : min->y;
+    min->z = pointMin.z < min->z ? pointMin.z : min->z;
+    max->x = pointMax.x > max->x ? pointMax.x : max->x;
+    max->y = pointMax.y > max->y ? pointMax.y : max->y;
+    max->z = pointMax.z > max->z ? pointMax.z : max->z;
+}
+
+real boxArea(vector3d min, vector3d max) {
+    vector3d extent = vector3d_sub(max, min);
+
+    return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+real axisOf(vector3d vector, int axis) {
+    switch(axis) {
+        case(0):
+            return vector.x;
+        case(1):
+            return vector.y;
+        default:
+            return vector.z;
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef CS430_BVH_H
+#define CS430_BVH_H
+
+#include <stddef.h>
+
+#include "vector3d.h"
+
+#define BVH_LEAF_SIZE 4
+#define BVH_BINS 16
+// Past this depth the builder stops trusting SAH and splits at the median,
+// which keeps traversal stacks bounded by BVH_STACK_SIZE.
+#define BVH_MAX_SAH_DEPTH 64
+#define BVH_STACK_SIZE 128
+
+typedef struct bvhNode {
+    vector3d min;
+    vector3d max;
+    // Inner nodes: index of the first child, the second follows it.
+    // Leaves: offset of the first primitive in bvh.indices.
+    size_t first;
+    // 0 for inner nodes
+    size_t count;
+} bvhNode;
+
+typedef struct bvh {
+    bvhNode* nodes;
+    size_t nodeCount;
+    // Primitive indices in leaf order
+    size_t* indices;
+    size_t count;
+} bvh;
+
+int bvh_build(bvh* bvh, const vector3d* mins, const vector3d* maxs,
+    size_t count);
+void bvh_free(bvh* bvh);
+
+// Slab test against a node's box. invDir is 1 / ray.dir per axis, so zero
+// components become infinities. A 0 * infinity NaN fails both comparisons and
+// leaves that slab unconstrained, which only ever errs towards a hit.
+static inline int bvh_hitBox(const bvhNode* node, vector3d origin,
+        vector3d invDir, real tMax, real* tNear) {
+    real near = 0;
+    real far = tMax;
+    real t0, t1, swap;
+
+    t0 = (node->min.x - origin.x) * invDir.x;
+    t1 = (node->max.x - origin.x) * invDir.x;
+    if(t0 > t1) { swap = t0; t0 = t1; t1 = swap; }
+    near = t0 > near ? t0 : near;
+    far = t1 < far ? t1 : far;
+
+    t0 = (node->min.y - origin.y) * invDir.y;
+    t1 = (node->max.y - origin.y) * invDir.y;
+    if(t0 > t1) { swap = t0; t0 = t1; t1 = swap; }
+    near = t0 > near ? t0 : near;
+    far = t1 < far ? t1 : far;
+
+    t0 = (node->min.z - origin.z) * invDir.z;
+    t1 = (node->max.z - origin.z) * invDir.z;
+    if(t0 > t1) { swap = t0; t0 = t1; t1 = swap; }
+    near = t0 > near ? t0 : near;
+    far = t1 < far ? t1 : far;
+
+    *tNear = near;
+
+    return near <= far;
+}
+
+static inline vector3d bvh_invDir(vector3d dir) {
+    vector3d invDir = { 1 / dir.x, 1 / dir.y, 1 / dir.z };
+
+    return invDir;
+}
+
+#endif // CS430_BVH_H
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gbuffer.h"
+
+// Fixed-size header in front of the pixel records
+typedef struct gbufferHeader {
+    char magic[8];
+    uint32_t realSize;
+    uint32_t pixelSize;
+    uint64_t width;
+    uint64_t height;
+    uint64_t sceneHash;
+    uint64_t lightCount;
+    vector3d lights[GBUFFER_MAX_LIGHTS];
+} gbufferHeader;
+
+int gbuffer_init(gbuffer* gbuffer, size_t width, size_t height) {
+    gbuffer->width = width;
+    gbuffer->height = height;
+    gbuffer->sceneHash = 0;
+    gbuffer->lightCount = 0;
+    gbuffer->pixels = calloc(width * height, sizeof(*(gbuffer->pixels)));
+    if(gbuffer->pixels == NULL) {
+        fprintf(stderr, "Error: Memory allocation error\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+void gbuffer_free(gbuffer* gbuffer) {
+    free(gbuffer->pixels);
+    memset(gbuffer, 0, sizeof(*gbuffer));
+}
+
+int gbuffer_write(const gbuffer* gbuffer, const char* path) {
+    gbufferHeader header = { GBUFFER_MAGIC, sizeof(real),
+        sizeof(gbufferPixel), gbuffer->width, gbuffer->height,
+        gbuffer->sceneHash, gbuffer->lightCount, { { 0, 0, 0 } } };
+    size_t count = gbuffer->width * gbuffer->height;
+
+    memcpy(header.lights, gbuffer->lights, sizeof(header.lights));
+
+    FILE* file = fopen(path, "wb");
+    if(file == NULL) {
+        perror("Error: Cannot open G-buffer file");
+        return -1;
+    }
+
+    if(fwrite(&header, sizeof(header), 1, file) != 1 ||
+            fwrite(gbuffer->pixels, sizeof(*(gbuffer->pixels)), count,
+            file) != count) {
+        fprintf(stderr, "Error: Cannot write G-buffer file\n");
+        fclose(file);
+        return -1;
+    }
+
+    if(fclose(file) != 0) {
+        perror("Error: Cannot write G-buffer file");
+        return -1;
+    }
+
+    return 0;
+}
+
+int gbuffer_read(gbuffer* gbuffer, const char* path) {
+    gbufferHeader header;
+
+    FILE* file = fopen(path, "rb");
+    if(file == NULL) {
+        perror("Error: Cannot open G-buffer file");
+        return -1;
+    }
+
+    if(fread(&header, sizeof(header), 1, file) != 1 ||
+            memcmp(header.magic, GBUFFER_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "Error: '%s' is not a G-buffer file\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    if(header.realSize != sizeof(real) ||
+            header.pixelSize != sizeof(gbufferPixel) ||
+            header.lightCount > GBUFFER_MAX_LIGHTS) {
+        fprintf(stderr, "Error: G-buffer '%s' was saved by a build with a "
+            "different precision\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    if(gbuffer_init(gbuffer, header.width, header.height) < 0) {
+        fclose(file);
+        return -1;
+    }
+    gbuffer->sceneHash = header.sceneHash;
+    gbuffer->lightCount = header.lightCount;
+    memcpy(gbuffer->lights, header.lights, sizeof(gbuffer->lights));
+
+    size_t count = gbuffer->width * gbuffer->height;
+    if(fread(gbuffer->pixels, sizeof(*(gbuffer->pixels)), count,
+            file) != count) {
+        fprintf(stderr, "Error: G-buffer '%s' is truncated\n", path);
+        gbuffer_free(gbuffer);
+        fclose(file);
+        return -1;
+    }
+
+    fclose(file);
+
+    return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef CS430_GBUFFER_H
+#define CS430_GBUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vector3d.h"
+
+// Magic number at the start of every G-buffer file
+#define GBUFFER_MAGIC "RCGBUF1"
+// Lights a shadow mask can tell apart (see shadeSurface() in raycast.c)
+#define GBUFFER_MAX_LIGHTS 63
+
+// What the primary ray of one pixel hit
+typedef struct gbufferPixel {
+    real t;
+    // Surface normal at the hit, as shadeColor() uses it
+    vector3d normal;
+    // Bit i is set when light i was blocked
+    uint64_t shadowMask;
+    // Position in the parsed objs array
+    uint32_t obj;
+    uint32_t hit;
+} gbufferPixel;
+
+// Primary hits for a whole frame. sceneHash identifies the camera and
+// geometry they were traced against, so a buffer is never relit against a
+// scene whose objects have since moved.
+typedef struct gbuffer {
+    size_t width;
+    size_t height;
+    uint64_t sceneHash;
+    // Where the lights behind the shadow masks were. A light that is still
+    // in the same place casts the same shadows, whatever else changed.
+    size_t lightCount;
+    vector3d lights[GBUFFER_MAX_LIGHTS];
+    gbufferPixel* pixels;
+} gbuffer;
+
+int gbuffer_init(gbuffer* gbuffer, size_t width, size_t height);
+void gbuffer_free(gbuffer* gbuffer);
+// Files hold the records as they are in memory, so they can only be read
+// back by a build with the same real type
+int gbuffer_write(const gbuffer* gbuffer, const char* path);
+int gbuffer_read(gbuffer* gbuffer, const char* path);
+
+#endif // CS430_GBUFFER_H
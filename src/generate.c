@@ -0,0 +1,203 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "generate.h"
+
+#define PI 3.14159265358979323846
+
+int parseCount(const char** value, size_t* count, char separator);
+uint64_t nextRandom(uint64_t* state);
+double randomRange(uint64_t* state, double low, double high);
+void randomVector(uint64_t* state, double vector[3], double low,
+    double high);
+void randomDirection(uint64_t* state, double direction[3]);
+
+int generate_counts(const char* value, generateOpts* opts) {
+    if(parseCount(&value, &(opts->spheres), ',') < 0 ||
+            parseCount(&value, &(opts->planes), ',') < 0 ||
+            parseCount(&value, &(opts->lights), '\0') < 0) {
+        fprintf(stderr, "Error: --generate takes spheres,planes,lights\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int generate_seed(const char* value, uint64_t* seed) {
+    char* endptr;
+    unsigned long long number = strtoull(value, &endptr, 10);
+    // Same whole-string validation as the width and height arguments
+    if(!(*value != '\0' && *endptr == '\0') || *value == '-') {
+        fprintf(stderr, "Error: Invalid seed '%s'\n", value);
+        return -1;
+    }
+
+    *seed = number;
+
+    return 0;
+}
+
+int generate_scene(const char* path, const generateOpts* opts) {
+    uint64_t state = opts->seed;
+    double color[3];
+    double position[3];
+    double normal[3];
+
+    FILE* outputFd = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if(outputFd == NULL) {
+        perror("Error: Cannot open output file\n");
+        return -1;
+    }
+
+    // Spheres fill the view from near to far, in a volume that grows with
+    // their count so they stay about as dense however many there are
+    double near = 3;
+    double depth = 4 * cbrt(opts->spheres > 0 ? opts->spheres : 1);
+    double far = near + depth;
+
+    fprintf(outputFd, "[\n{\"type\":\"camera\",\"width\":2,\"height\":2}");
+
+    // Every value is drawn in the order written, which the order arguments
+    // are evaluated in would not guarantee
+    for(size_t i = 0; i < opts->spheres; i++) {
+        randomVector(&state, color, 0, 1);
+        position[2] = randomRange(&state, near, far);
+        position[0] = randomRange(&state, -0.8 * position[2],
+            0.8 * position[2]);
+        position[1] = randomRange(&state, -0.8 * position[2],
+            0.8 * position[2]);
+        double radius = randomRange(&state, 0.25, 0.75);
+
+        fprintf(outputFd, ",\n{\"type\":\"sphere\",\"diffuse_color\":"
+            "[%.6f,%.6f,%.6f],\"position\":[%.6f,%.6f,%.6f],"
+            "\"radius\":%.6f}", color[0], color[1], color[2], position[0],
+            position[1], position[2], radius);
+    }
+
+    // A floor below everything, then walls behind the spheres facing the
+    // camera
+    for(size_t i = 0; i < opts->planes; i++) {
+        randomVector(&state, color, 0, 1);
+        normal[0] = 0;
+        normal[1] = 1;
+        normal[2] = 0;
+        position[0] = 0;
+        position[1] = -far;
+        position[2] = 0;
+        if(i > 0) {
+            double direction[3];
+            do {
+                randomDirection(&state, direction);
+            }
+            while(direction[2] < 0.3);
+
+            for(int j = 0; j < 3; j++) {
+                normal[j] = -direction[j];
+                position[j] = 2 * far * direction[j];
+            }
+        }
+
+        fprintf(outputFd, ",\n{\"type\":\"plane\",\"diffuse_color\":"
+            "[%.6f,%.6f,%.6f],\"position\":[%.6f,%.6f,%.6f],"
+            "\"normal\":[%.6f,%.6f,%.6f]}", color[0], color[1], color[2],
+            position[0], position[1], position[2], normal[0], normal[1],
+            normal[2]);
+    }
+
+    // Lights above the camera and in front of the spheres, with no falloff
+    // and shared out so the scene is about as bright however many there are
+    for(size_t i = 0; i < opts->lights; i++) {
+        randomVector(&state, color, 0.5 / opts->lights, 1.0 / opts->lights);
+        position[0] = randomRange(&state, -far, far);
+        position[1] = randomRange(&state, 0, far);
+        position[2] = randomRange(&state, -near, near);
+
+        fprintf(outputFd, ",\n{\"type\":\"light\",\"color\":[%.6f,%.6f,%.6f],"
+            "\"position\":[%.6f,%.6f,%.6f],\"radial-a0\":1,\"radial-a1\":0,"
+            "\"radial-a2\":0", color[0], color[1], color[2], position[0],
+            position[1], position[2]);
+
+        // Spot lights point at the middle of the spheres
+        if(i % 2 == 1) {
+            double direction[3] = {
+                -position[0], -position[1], near + depth / 2 - position[2]
+            };
+            double length = sqrt(direction[0] * direction[0] +
+                direction[1] * direction[1] + direction[2] * direction[2]);
+            if(length == 0) {
+                direction[2] = length = 1;
+            }
+            double theta = randomRange(&state, 20, 45);
+
+            fprintf(outputFd, ",\"direction\":[%.6f,%.6f,%.6f],"
+                "\"theta\":%.6f,\"angular-a0\":2", direction[0] / length,
+                direction[1] / length, direction[2] / length, theta);
+        }
+        fprintf(outputFd, "}");
+    }
+
+    fprintf(outputFd, "\n]\n");
+
+    if(ferror(outputFd) || (outputFd != stdout ? fclose(outputFd) :
+            fflush(outputFd)) != 0) {
+        perror("Error: Cannot write output file\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// One count of generate_counts(), which must end at separator
+int parseCount(const char** value, size_t* count, char separator) {
+    char* endptr;
+    if(**value < '0' || **value > '9') {
+        return -1;
+    }
+
+    *count = strtoul(*value, &endptr, 10);
+    if(*endptr != separator) {
+        return -1;
+    }
+    *value = separator != '\0' ? endptr + 1 : endptr;
+
+    return 0;
+}
+
+// splitmix64, so a seed gives the same scene whatever the C library
+uint64_t nextRandom(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15u);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9u;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBu;
+
+    return z ^ (z >> 31);
+}
+
+// Uniform in [low, high)
+double randomRange(uint64_t* state, double low, double high) {
+    double unit = (nextRandom(state) >> 11) * (1.0 / ((uint64_t)1 << 53));
+
+    return low + (high - low) * unit;
+}
+
+// Each component uniform in [low, high), drawn x first
+void randomVector(uint64_t* state, double vector[3], double low,
+        double high) {
+    for(int i = 0; i < 3; i++) {
+        vector[i] = randomRange(state, low, high);
+    }
+}
+
+// A random unit vector, uniform over the sphere
+void randomDirection(uint64_t* state, double direction[3]) {
+    double z = randomRange(state, -1, 1);
+    double angle = randomRange(state, 0, 2 * PI);
+    double radius = sqrt(1 - z * z);
+
+    direction[0] = radius * cos(angle);
+    direction[1] = radius * sin(angle);
+    direction[2] = z;
+}
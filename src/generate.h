@@ -0,0 +1,26 @@
+#ifndef CS430_GENERATE_H
+#define CS430_GENERATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Seed --generate uses without --seed
+#define GENERATE_DEFAULT_SEED 1
+
+typedef struct generateOpts {
+    size_t spheres;
+    size_t planes;
+    // Point and spot lights in turn, starting with a point light
+    size_t lights;
+    uint64_t seed;
+} generateOpts;
+
+// Reads the --generate counts, "spheres,planes,lights"
+int generate_counts(const char* value, generateOpts* opts);
+// Reads the --seed value
+int generate_seed(const char* value, uint64_t* seed);
+// Writes a scene of random spheres, planes and lights to path ("-" for
+// stdout). The same options give the same file on every machine.
+int generate_scene(const char* path, const generateOpts* opts);
+
+#endif // CS430_GENERATE_H
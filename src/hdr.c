@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "hdr.h"
+#include "write.h"
+
+// PFM rows are the pixel array row for row
+_Static_assert(sizeof(hdrPixel) == 3 * sizeof(float),
+    "hdrPixel must be packed RGB");
+
+int hostIsLittleEndian(void);
+void swapFloats(hdrPixel* pixels, size_t count);
+real toneMap(real value, real scale, const toneOpts* opts);
+
+int hdr_init(hdrImage* image, size_t width, size_t height) {
+    image->width = width;
+    image->height = height;
+    image->pixels = calloc(width * height > 0 ? width * height : 1,
+        sizeof(*(image->pixels)));
+    if(image->pixels == NULL) {
+        fprintf(stderr, "Error: Memory allocation error\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+void hdr_free(hdrImage* image) {
+    free(image->pixels);
+    memset(image, 0, sizeof(*image));
+}
+
+int hdr_write(const hdrImage* image, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if(file == NULL) {
+        perror("Error: Cannot open PFM file");
+        return -1;
+    }
+
+    // A negative scale marks little endian floats
+    fprintf(file, "PF\n%zu %zu\n%s\n", image->width, image->height,
+        hostIsLittleEndian() ? "-1.0" : "1.0");
+    for(size_t y = image->height; y > 0; y--) {
+        fwrite(&(image->pixels[(y - 1) * image->width]),
+            sizeof(*(image->pixels)), image->width, file);
+    }
+
+    if(ferror(file)) {
+        fprintf(stderr, "Error: Cannot write PFM file\n");
+        fclose(file);
+        return -1;
+    }
+    if(fclose(file) != 0) {
+        perror("Error: Cannot write PFM file");
+        return -1;
+    }
+
+    return 0;
+}
+
+int hdr_read(hdrImage* image, const char* path) {
+    size_t width, height;
+    double scale;
+
+    FILE* file = fopen(path, "rb");
+    if(file == NULL) {
+        perror("Error: Cannot open PFM file");
+        return -1;
+    }
+
+    // The header is text, and a single whitespace character separates it
+    // from the floats
+    int separator = 0;
+    if(fscanf(file, "PF %zu %zu %lf", &width, &height, &scale) != 3 ||
+            scale == 0 || (separator = fgetc(file)) == EOF ||
+            (separator != ' ' && separator != '\n' && separator != '\r' &&
+            separator != '\t')) {
+        fprintf(stderr, "Error: '%s' is not a color PFM file\n", path);
+        fclose(file);
+        return -1;
+    }
+    if(width > 0 && height > SIZE_MAX / sizeof(hdrPixel) / width) {
+        fprintf(stderr, "Error: PFM '%s' is too large\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    if(hdr_init(image, width, height) < 0) {
+        fclose(file);
+        return -1;
+    }
+
+    for(size_t y = height; y > 0; y--) {
+        if(fread(&(image->pixels[(y - 1) * width]), sizeof(*(image->pixels)),
+                width, file) != width) {
+            fprintf(stderr, "Error: PFM '%s' is truncated\n", path);
+            hdr_free(image);
+            fclose(file);
+            return -1;
+        }
+    }
+
+    fclose(file);
+
+    if((scale < 0) != hostIsLittleEndian()) {
+        swapFloats(image->pixels, width * height);
+    }
+
+    return 0;
+}
+
+void toneOpts_init(toneOpts* opts) {
+    opts->exposure = 0;
+    opts->curve = TONE_CLAMP;
+    opts->gamma = 1;
+}
+
+int toneOpts_exposure(const char* value, real* exposure) {
+    char* endptr;
+    double stops = strtod(value, &endptr);
+    if(!(*value != '\0' && *endptr == '\0') || !isfinite(stops)) {
+        fprintf(stderr, "Error: Exposure must be a number of stops\n");
+        return -1;
+    }
+
+    *exposure = stops;
+
+    return 0;
+}
+
+int toneOpts_curve(const char* value, int* curve) {
+    if(strcmp(value, "clamp") == 0) {
+        *curve = TONE_CLAMP;
+    }
+    else if(strcmp(value, "reinhard") == 0) {
+        *curve = TONE_REINHARD;
+    }
+    else if(strcmp(value, "aces") == 0) {
+        *curve = TONE_ACES;
+    }
+    else {
+        fprintf(stderr, "Error: Unknown tone curve '%s'\n", value);
+        return -1;
+    }
+
+    return 0;
+}
+
+int toneOpts_gamma(const char* value, real* gamma) {
+    char* endptr;
+    double exponent = strtod(value, &endptr);
+    if(!(*value != '\0' && *endptr == '\0') || !(exponent > 0) ||
+            !isfinite(exponent)) {
+        fprintf(stderr, "Error: Gamma must be a number > 0\n");
+        return -1;
+    }
+
+    *gamma = exponent;
+
+    return 0;
+}
+
+int toneOpts_depth(const char* value, size_t* maxColorSize) {
+    if(strcmp(value, "8") == 0) {
+        *maxColorSize = CS430_PNM_MAX_SUPPORTED;
+    }
+    else if(strcmp(value, "16") == 0) {
+        *maxColorSize = CS430_PNM_FULL_MAX;
+    }
+    else {
+        fprintf(stderr, "Error: Bit depth must be 8 or 16\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int hdr_export(const char* path, const hdrImage* image, const toneOpts* opts,
+        int mode, size_t maxColorSize, size_t threads) {
+    pnmHeader header = { mode, image->width, image->height, maxColorSize };
+    size_t count = image->width * image->height;
+    real scale = real_pow(2, opts->exposure);
+
+    // Up to 8 bits goes through the usual writer
+    if(maxColorSize <= CS430_PNM_MAX_SUPPORTED) {
+        pixel* pixels = malloc(sizeof(*pixels) * (count > 0 ? count : 1));
+        if(pixels == NULL) {
+            fprintf(stderr, "Error: Memory allocation error\n");
+            return -1;
+        }
+
+        for(size_t i = 0; i < count; i++) {
+            pixels[i].red = toneMap(image->pixels[i].red, scale, opts) *
+                maxColorSize;
+            pixels[i].green = toneMap(image->pixels[i].green, scale, opts) *
+                maxColorSize;
+            pixels[i].blue = toneMap(image->pixels[i].blue, scale, opts) *
+                maxColorSize;
+        }
+
+        int status = writeImage(path, header, pixels, threads);
+        free(pixels);
+
+        return status;
+    }
+
+    if(mode != 6) {
+        fprintf(stderr, "Error: Only P6 supports 16-bit channels\n");
+        return -1;
+    }
+
+    unsigned char* row = malloc(6 * (image->width > 0 ? image->width : 1));
+    if(row == NULL) {
+        fprintf(stderr, "Error: Memory allocation error\n");
+        return -1;
+    }
+
+    FILE* outputFd = fopen(path, "w");
+    if(outputFd == NULL) {
+        perror("Error: Cannot open output file\n");
+        free(row);
+        return -1;
+    }
+    if(writeHeader(header, outputFd) < 0) {
+        fclose(outputFd);
+        free(row);
+        return -1;
+    }
+
+    for(size_t y = 0; y < image->height; y++) {
+        const hdrPixel* pixels = &(image->pixels[y * image->width]);
+
+        for(size_t x = 0; x < image->width; x++) {
+            float channels[3] = { pixels[x].red, pixels[x].green,
+                pixels[x].blue };
+
+            for(size_t i = 0; i < 3; i++) {
+                unsigned level = toneMap(channels[i], scale, opts) *
+                    maxColorSize;
+                row[6 * x + 2 * i] = level >> 8;
+                row[6 * x + 2 * i + 1] = level & 0xFF;
+            }
+        }
+        if(fwrite(row, 6, image->width, outputFd) != image->width) {
+            break;
+        }
+    }
+    free(row);
+
+    if(ferror(outputFd)) {
+        fprintf(stderr, "Error: Cannot write output file\n");
+        fclose(outputFd);
+        return -1;
+    }
+    if(fclose(outputFd) != 0) {
+        perror("Error: Cannot write output file\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int hostIsLittleEndian(void) {
+    uint16_t probe = 1;
+
+    return *(unsigned char*)&probe == 1;
+}
+
+void swapFloats(hdrPixel* pixels, size_t count) {
+    unsigned char* bytes = (unsigned char*)pixels;
+
+    for(size_t i = 0; i < 3 * count; i++) {
+        unsigned char* value = &(bytes[i * sizeof(float)]);
+        unsigned char swap = value[0];
+        value[0] = value[3];
+        value[3] = swap;
+        swap = value[1];
+        value[1] = value[2];
+        value[2] = swap;
+    }
+}
+
+// One channel through exposure, the tone curve and gamma, ending in [0, 1].
+// Negative and NaN inputs come out black.
+real toneMap(real value, real scale, const toneOpts* opts) {
+    value *= scale;
+    if(!(value > 0)) {
+        return 0;
+    }
+
+    switch(opts->curve) {
+        case(TONE_REINHARD):
+            value = value / (1 + value);
+            break;
+        case(TONE_ACES):
+            // Narkowicz's fit of the ACES filmic curve
+            value = value * (2.51 * value + 0.03) /
+                (value * (2.43 * value + 0.59) + 0.14);
+            break;
+    }
+
+    value = clamp(value, 0, 1);
+    if(opts->gamma != 1) {
+        value = real_pow(value, 1 / opts->gamma);
+    }
+
+    return value;
+}
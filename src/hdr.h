@@ -0,0 +1,57 @@
+#ifndef CS430_HDR_H
+#define CS430_HDR_H
+
+#include <stddef.h>
+
+#include "pnm.h"
+#include "vector3d.h"
+
+// Tone curves, applied after exposure and before gamma
+#define TONE_CLAMP 0
+#define TONE_REINHARD 1
+#define TONE_ACES 2
+
+typedef struct hdrPixel {
+    float red;
+    float green;
+    float blue;
+} hdrPixel;
+
+// Linear color of every pixel of a frame, before it is clamped to [0, 1],
+// top row first
+typedef struct hdrImage {
+    size_t width;
+    size_t height;
+    hdrPixel* pixels;
+} hdrImage;
+
+typedef struct toneOpts {
+    // In stops: colors are scaled by 2^exposure
+    real exposure;
+    // TONE_*
+    int curve;
+    // Channels are raised to 1 / gamma once they are in [0, 1]
+    real gamma;
+} toneOpts;
+
+int hdr_init(hdrImage* image, size_t width, size_t height);
+void hdr_free(hdrImage* image);
+// PFM files, which hold 32-bit floats with the bottom row first
+int hdr_write(const hdrImage* image, const char* path);
+int hdr_read(hdrImage* image, const char* path);
+
+// With the defaults, export gives the same levels as an 8-bit render, up to
+// the rounding of the colors to float
+void toneOpts_init(toneOpts* opts);
+int toneOpts_exposure(const char* value, real* exposure);
+int toneOpts_curve(const char* value, int* curve);
+int toneOpts_gamma(const char* value, real* gamma);
+int toneOpts_depth(const char* value, size_t* maxColorSize);
+
+// Tone maps image and writes it to path as P<mode> with maxColorSize levels.
+// Sizes above 255 are written as 16-bit P6, most significant byte first.
+// P3 is formatted on up to threads threads.
+int hdr_export(const char* path, const hdrImage* image, const toneOpts* opts,
+    int mode, size_t maxColorSize, size_t threads);
+
+#endif // CS430_HDR_H
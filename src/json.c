@@ -1,680 +1,1204 @@
 #define __USE_MINGW_ANSI_STDIO 1
+#define _POSIX_C_SOURCE 200809L
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
-#include <ctype.h>
 #include <math.h>
+#include <float.h>
 #include <errno.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "vector3d.h"
+#include "scheduler.h"
 #include "json.h"
 
-#define CAMERA_WIDTH_FLAG 0x1
-#define CAMERA_HEIGHT_FLAG 0x2
-
-#define DIFFUSE_FLAG 0x1
-#define SPECULAR_FLAG 0x2
-#define NS_FLAG 0x4
-
-#define SPHERE_POS_FLAG 0x8
-#define SPHERE_RAD_FLAG 0x10
-
-#define PLANE_POS_FLAG 0x8
-#define PLANE_NORMAL_FLAG 0x10
-
-#define LIGHT_POS_FLAG 0x1
-#define LIGHT_DIR_FLAG 0x2
-#define LIGHT_COLOR_FLAG 0x4
-#define LIGHT_THETA_FLAG 0x8
-#define LIGHT_RAD_A0_FLAG 0x10
-#define LIGHT_RAD_A1_FLAG 0x20
-#define LIGHT_RAD_A2_FLAG 0x40
-#define LIGHT_ANG_A0_FLAG 0x80
-
-void errorCheck(int c, FILE* json, size_t line);
-void tokenCheck(int c, char token, size_t line);
-int jsonGetC(FILE* json, size_t* line);
-void skipWhitespace(FILE* json, size_t* line);
-void trailSpaceCheck(FILE* json, size_t* line);
-char* nextString(FILE* json, size_t* line);
-double nextNumber(FILE* json, size_t* line);
-vector3d nextVector3d(FILE* json, size_t* line);
-vector3d nextColor(FILE* json, size_t* line);
-
-jsonObj readScene(const char* path) {
-    FILE* json = fopen(path, "r");
-    if(json == NULL) {
+// How a key's value is parsed and stored
+#define KEY_REAL 0
+#define KEY_FLOAT 1
+#define KEY_VECTOR 2
+#define KEY_COLOR 3
+// A string kept in the scene's arena
+#define KEY_PATH 4
+
+// What the keys of an object are stored in
+#define TARGET_CAMERA 0
+#define TARGET_OBJECT 1
+#define TARGET_LIGHT 2
+
+// A key an object may have, and where its value goes
+typedef struct sceneKey {
+    const char* name;
+    size_t length;
+    int kind;
+    // From the start of the camera, sceneObj or sceneLight
+    size_t offset;
+    int required;
+    // Error for a negative number. Every number key must be at least 0.
+    const char* negative;
+} sceneKey;
+
+typedef struct sceneType {
+    const char* name;
+    size_t length;
+    int target;
+    // TYPE_* for TARGET_OBJECT
+    int objType;
+    // Required keys are checked in this order
+    const sceneKey* keys;
+    size_t keyCount;
+} sceneType;
+
+#define SCENE_KEY(name, kind, offset, required, negative) \
+    { name, sizeof(name) - 1, kind, offset, required, negative }
+#define SCENE_TYPE(name, target, objType, keys) \
+    { name, sizeof(name) - 1, target, objType, keys, \
+        sizeof(keys) / sizeof(*(keys)) }
+
+const sceneKey CAMERA_KEYS[] = {
+    SCENE_KEY("width", KEY_FLOAT, offsetof(camera, width), 1,
+        "Width cannot be negative"),
+    SCENE_KEY("height", KEY_FLOAT, offsetof(camera, height), 1,
+        "Height cannot be negative")
+};
+
+const sceneKey SPHERE_KEYS[] = {
+    SCENE_KEY("radius", KEY_REAL, offsetof(sceneObj, sphere.radius), 1,
+        "Radius cannot be negative"),
+    SCENE_KEY("position", KEY_VECTOR, offsetof(sceneObj, sphere.pos), 1, NULL),
+    SCENE_KEY("diffuse_color", KEY_COLOR, offsetof(sceneObj, diffuse), 1, NULL),
+    SCENE_KEY("specular_color", KEY_COLOR, offsetof(sceneObj, specular), 0,
+        NULL)
+};
+
+const sceneKey PLANE_KEYS[] = {
+    SCENE_KEY("position", KEY_VECTOR, offsetof(sceneObj, plane.pos), 1, NULL),
+    SCENE_KEY("normal", KEY_VECTOR, offsetof(sceneObj, plane.normal), 1, NULL),
+    SCENE_KEY("diffuse_color", KEY_COLOR, offsetof(sceneObj, diffuse), 1, NULL),
+    SCENE_KEY("specular_color", KEY_COLOR, offsetof(sceneObj, specular), 0,
+        NULL)
+};
+
+const sceneKey MESH_KEYS[] = {
+    SCENE_KEY("file", KEY_PATH, offsetof(sceneObj, mesh.path), 1, NULL),
+    SCENE_KEY("diffuse_color", KEY_COLOR, offsetof(sceneObj, diffuse), 1, NULL),
+    SCENE_KEY("position", KEY_VECTOR, offsetof(sceneObj, mesh.pos), 0, NULL),
+    SCENE_KEY("specular_color", KEY_COLOR, offsetof(sceneObj, specular), 0,
+        NULL)
+};
+
+const sceneKey LIGHT_KEYS[] = {
+    SCENE_KEY("position", KEY_VECTOR, offsetof(sceneLight, pos), 1, NULL),
+    SCENE_KEY("color", KEY_COLOR, offsetof(sceneLight, color), 1, NULL),
+    SCENE_KEY("direction", KEY_VECTOR, offsetof(sceneLight, dir), 0, NULL),
+    SCENE_KEY("theta", KEY_REAL, offsetof(sceneLight, theta), 0,
+        "'theta' cannot be negative"),
+    SCENE_KEY("radial-a0", KEY_REAL, offsetof(sceneLight, radialAtten[0]), 0,
+        "'radial-a0' cannot be negative"),
+    SCENE_KEY("radial-a1", KEY_REAL, offsetof(sceneLight, radialAtten[1]), 0,
+        "'radial-a1' cannot be negative"),
+    SCENE_KEY("radial-a2", KEY_REAL, offsetof(sceneLight, radialAtten[2]), 0,
+        "'radial-a2' cannot be negative"),
+    SCENE_KEY("angular-a0", KEY_REAL, offsetof(sceneLight, angularAtten), 0,
+        "'angular-a0' cannot be negative")
+};
+
+const sceneType SCENE_TYPES[] = {
+    SCENE_TYPE("camera", TARGET_CAMERA, 0, CAMERA_KEYS),
+    SCENE_TYPE("sphere", TARGET_OBJECT, TYPE_SPHERE, SPHERE_KEYS),
+    SCENE_TYPE("plane", TARGET_OBJECT, TYPE_PLANE, PLANE_KEYS),
+    SCENE_TYPE("mesh", TARGET_OBJECT, TYPE_MESH, MESH_KEYS),
+    SCENE_TYPE("light", TARGET_LIGHT, 0, LIGHT_KEYS)
+};
+
+// keyFlag holds a bit per key, so no type can have more keys than an int
+// has bits
+_Static_assert(sizeof(LIGHT_KEYS) / sizeof(*LIGHT_KEYS) <= 8 * sizeof(int),
+    "Too many keys for keyFlag");
+
+// Largest chunk json_read() asks read() for at once
+#define JSON_READ_SIZE (1 << 16)
+// Significant digits that fit in a uint64_t mantissa
+#define JSON_MANTISSA_DIGITS 19
+// Doubles hold every integer up to 2^53 and power of ten up to 1e22 exactly
+#define JSON_EXACT_MANTISSA ((uint64_t)1 << 53)
+#define JSON_EXACT_POWER 22
+// Inputs at least this big are parsed on every core
+#define JSON_PARALLEL_SIZE (1 << 20)
+// Chunks of objects each thread gets to parse, about, and the fewest bytes
+// worth handing to a thread
+#define JSON_CHUNKS 4
+#define JSON_CHUNK_SIZE (1 << 16)
+
+// The lists parseObject() adds to and how much room they have
+typedef struct sceneBuilder {
+    jsonObj* jsonObj;
+    size_t objsSize;
+    size_t objsCapacity;
+    size_t lightsSize;
+    size_t lightsCapacity;
+    // Whether a camera object has been parsed into jsonObj
+    int camera;
+} sceneBuilder;
+
+// A run of whole objects parseParallel() hands to one thread, and what it
+// parsed them into
+typedef struct jsonChunk {
+    // From the '{' of the first object to past the '}' of the last
+    const char* start;
+    const char* end;
+    // Line start is on
+    size_t line;
+    jsonObj jsonObj;
+    sceneBuilder builder;
+    int failed;
+} jsonChunk;
+
+int readInput(jsonParser* parser, int fd);
+int startScene(jsonParser* parser, jsonObj* jsonObj, sceneBuilder* builder);
+int parseObject(jsonParser* parser, sceneBuilder* builder);
+int parseParallel(jsonParser* parser, jsonObj* jsonObj, size_t threads);
+void parseChunk(tile tile, size_t threadId, void* data);
+size_t findChunks(const jsonParser* input, size_t chunkSize,
+    jsonChunk** chunks, size_t* lines);
+int skipObject(jsonParser* parser);
+void* growList(void* list, size_t count, size_t* capacity, size_t size);
+void skipSpaces(jsonParser* parser);
+void countLines(jsonParser* parser, const char* start, const char* end);
+int isSpace(int c);
+int isDigit(int c);
+const sceneType* findType(const char* text, size_t length);
+const sceneKey* findKey(const sceneType* type, const char* text,
+    size_t length);
+int parseValue(jsonParser* parser, const sceneKey* key, void* target,
+    arena* arena);
+
+jsonObj readScene(const char* path, size_t threads) {
+    jsonParser parser;
+    jsonObj jsonObj;
+
+    if(json_map(&parser, path) < 0) {
         perror("Error: Opening input\n");
         exit(EXIT_FAILURE);
     }
 
-    sceneObj* obj;
-    size_t objsSize = 0;
-    sceneLight* light;
-    size_t lightsSize = 0;
+    int status = parseScene(&parser, &jsonObj, threads);
+    json_close(&parser);
+    if(status < 0) {
+        fprintf(stderr, "Error: %s\n", parser.error);
+        exit(EXIT_FAILURE);
+    }
+    if(resolveMeshPaths(&jsonObj, path) < 0) {
+        fprintf(stderr, "Error: Memory allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return jsonObj;
+}
+
+int resolveMeshPaths(jsonObj* jsonObj, const char* scenePath) {
+    const char* slash = strrchr(scenePath, '/');
+    if(slash == NULL) {
+        // The scene is in the working directory already
+        return 0;
+    }
+    size_t dirLength = slash - scenePath + 1;
 
-    jsonObj jsonObj = { 0 };
+    for(size_t i = 0; jsonObj->objs[i] != NULL; i++) {
+        sceneObj* obj = jsonObj->objs[i];
+        if(obj->type != TYPE_MESH || obj->mesh.path[0] == '/') {
+            continue;
+        }
+
+        size_t length = strlen(obj->mesh.path);
+        char* path = arena_alloc(&(jsonObj->arena), dirLength + length + 1);
+        if(path == NULL) {
+            return -1;
+        }
+        memcpy(path, scenePath, dirLength);
+        memcpy(path + dirLength, obj->mesh.path, length + 1);
+        obj->mesh.path = path;
+    }
 
+    return 0;
+}
+
+int parseScene(jsonParser* parser, jsonObj* jsonObj, size_t threads) {
+    sceneBuilder builder;
     int c;
-    size_t line = 1;
-    char* key, *type;
-    int keyFlag;
+
+    // Big scenes are split between threads. Anything the split parse cannot
+    // handle is parsed again below, which reports it exactly as before.
+    if(threads > 1 && (size_t)(parser->end - parser->cursor) >=
+            JSON_PARALLEL_SIZE &&
+            parseParallel(parser, jsonObj, threads) == 0) {
+        return 0;
+    }
+
+    if(startScene(parser, jsonObj, &builder) < 0) {
+        goto fail;
+    }
 
     // Ignore beginning whitespace
-    skipWhitespace(json, &line);
+    if(skipWhitespace(parser) < 0) {
+        goto fail;
+    }
 
-    c = jsonGetC(json, &line);
-    tokenCheck(c, '[', line);
+    c = jsonGetC(parser);
+    if(tokenCheck(parser, c, '[') < 0 || skipWhitespace(parser) < 0) {
+        goto fail;
+    }
 
-    skipWhitespace(json, &line);
-    c = jsonGetC(json, &line);
+    c = jsonGetC(parser);
     if(c == ']') {
-        fprintf(stderr, "Warning: Line %zu: Empty array\n", line);
+        fprintf(stderr, "Warning: Line %zu: Empty array\n", parser->line);
 
-        trailSpaceCheck(json, &line);
+        if(trailSpaceCheck(parser) < 0) {
+            goto fail;
+        }
 
-        return jsonObj;
+        return 0;
     }
 
-    if(ungetc(c, json) == EOF) {
-        fprintf(stderr, "Error: Line %zu: Read error\n", line);
-        perror("");
-        exit(EXIT_FAILURE);
+    if(c < 0 || jsonUngetC(parser, c) < 0) {
+        goto fail;
     }
 
     do {
-        skipWhitespace(json, &line);
-        c = jsonGetC(json, &line);
-        tokenCheck(c, '{', line);
-
-        skipWhitespace(json, &line);
-        c = jsonGetC(json, &line);
-        // Empty object, skip to next object without allocating for empty one.
-        if(c == '}') {
-            fprintf(stderr, "Warning: Line %zu: Empty object\n", line);
-            skipWhitespace(json, &line);
-            continue;
+        if(skipWhitespace(parser) < 0 || parseObject(parser, &builder) < 0 ||
+                skipWhitespace(parser) < 0) {
+            goto fail;
         }
-        else if(ungetc(c, json) == EOF) {
-            fprintf(stderr, "Error: Line %zu: Read error\n", line);
-            perror("");
-            exit(EXIT_FAILURE);
+    }
+    while((c = jsonGetC(parser)) == ',');
+
+    if(tokenCheck(parser, c, ']') < 0 || trailSpaceCheck(parser) < 0) {
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    freeScene(jsonObj);
+
+    return -1;
+}
+
+void freeScene(jsonObj* jsonObj) {
+    arena_free(&(jsonObj->arena));
+    free(jsonObj->objs);
+    free(jsonObj->lights);
+    memset(jsonObj, 0, sizeof(*jsonObj));
+}
+
+int startScene(jsonParser* parser, jsonObj* jsonObj, sceneBuilder* builder) {
+    memset(builder, 0, sizeof(*builder));
+    builder->jsonObj = jsonObj;
+    builder->objsCapacity = 1;
+    builder->lightsCapacity = 1;
+
+    // Both lists stay NULL terminated throughout, so a failed parse can be
+    // freed like a finished one
+    memset(jsonObj, 0, sizeof(*jsonObj));
+    arena_init(&(jsonObj->arena));
+    jsonObj->objs = calloc(1, sizeof(*(jsonObj->objs)));
+    jsonObj->lights = calloc(1, sizeof(*(jsonObj->lights)));
+    if(jsonObj->objs == NULL || jsonObj->lights == NULL) {
+        return jsonError(parser, "Memory allocation error");
+    }
+
+    return 0;
+}
+
+int parseObject(jsonParser* parser, sceneBuilder* builder) {
+    jsonObj* jsonObj = builder->jsonObj;
+    int c;
+    const char* text;
+    size_t length;
+    int keyFlag;
+
+    c = jsonGetC(parser);
+    if(tokenCheck(parser, c, '{') < 0 || skipWhitespace(parser) < 0) {
+        return -1;
+    }
+
+    c = jsonGetC(parser);
+    // Empty object, skip to next object without allocating for empty one.
+    if(c == '}') {
+        fprintf(stderr, "Warning: Line %zu: Empty object\n", parser->line);
+        return 0;
+    }
+    else if(c < 0 || jsonUngetC(parser, c) < 0) {
+        return -1;
+    }
+
+    // Keys and types are matched where they are in the input, without
+    // copying them out
+    if((text = scanString(parser, &length)) == NULL) {
+        return -1;
+    }
+    if(!matchName("type", 4, text, length)) {
+        return jsonError(parser, "First key must be 'type'");
+    }
+
+    if(skipWhitespace(parser) < 0) {
+        return -1;
+    }
+    c = jsonGetC(parser);
+    if(tokenCheck(parser, c, ':') < 0 || skipWhitespace(parser) < 0 ||
+            (text = scanString(parser, &length)) == NULL) {
+        return -1;
+    }
+
+    const sceneType* type = findType(text, length);
+    if(type == NULL) {
+        return jsonError(parser, "Unknown type %.*s", (int)length, text);
+    }
+
+    // Where the values of the keys go
+    void* target = &(jsonObj->camera);
+    if(type->target == TARGET_CAMERA) {
+        builder->camera = 1;
+    }
+    else if(type->target == TARGET_OBJECT) {
+        sceneObj* obj = arena_alloc(&(jsonObj->arena), sizeof(*obj));
+        if(obj == NULL) {
+            return jsonError(parser, "Memory allocation error");
         }
 
-        key = nextString(json, &line);
+        obj->type = type->objType;
+        obj->ns = DEFAULT_NS;
+        obj->specular.x = 1;
+        obj->specular.z = 1;
+        obj->specular.y = 1;
 
-        if(strcmp(key, "type") != 0) {
-            fprintf(stderr, "Error: First key must be 'type'\n");
-            exit(EXIT_FAILURE);
+        sceneObj** objs = growList(jsonObj->objs, ++(builder->objsSize) + 1,
+            &(builder->objsCapacity), sizeof(*(jsonObj->objs)));
+        if(objs == NULL) {
+            return jsonError(parser, "Memory reallocation error");
+        }
+        jsonObj->objs = objs;
+        jsonObj->objs[builder->objsSize - 1] = obj;
+        jsonObj->objs[builder->objsSize] = NULL;
+        target = obj;
+    }
+    else if(type->target == TARGET_LIGHT) {
+        sceneLight* light = arena_alloc(&(jsonObj->arena), sizeof(*light));
+        if(light == NULL) {
+            return jsonError(parser, "Memory allocation error");
         }
 
-        skipWhitespace(json, &line);
-        c = jsonGetC(json, &line);
-        tokenCheck(c, ':', line);
+        light->radialAtten[2] = 1;
 
-        skipWhitespace(json, &line);
-        type = nextString(json, &line);
+        sceneLight** lights = growList(jsonObj->lights,
+            ++(builder->lightsSize) + 1, &(builder->lightsCapacity),
+            sizeof(*(jsonObj->lights)));
+        if(lights == NULL) {
+            return jsonError(parser, "Memory reallocation error");
+        }
+        jsonObj->lights = lights;
+        jsonObj->lights[builder->lightsSize - 1] = light;
+        jsonObj->lights[builder->lightsSize] = NULL;
+        target = light;
+    }
 
-        if(strcmp(type, "plane") == 0 || strcmp(type, "sphere") == 0) {
-            if((obj = malloc(sizeof(*obj))) == NULL) {
-                fprintf(stderr, "Error: Line %zu: Memory reallocation error\n",
-                    line);
-                perror("");
-                exit(EXIT_FAILURE);
-            }
+    keyFlag = 0;
 
-            memset(obj, 0, sizeof(*obj));
+    if(skipWhitespace(parser) < 0) {
+        return -1;
+    }
+    while((c = jsonGetC(parser)) == ',') {
+        if(skipWhitespace(parser) < 0 ||
+                (text = scanString(parser, &length)) == NULL) {
+            return -1;
+        }
 
-            if(strcmp(type, "plane") == 0) {
-                obj->type = TYPE_PLANE;
-            }
-            else if(strcmp(type, "sphere") == 0) {
-                obj->type = TYPE_SPHERE;
-            }
+        // Get ':' token
+        if(skipWhitespace(parser) < 0) {
+            return -1;
+        }
+        c = jsonGetC(parser);
+        if(tokenCheck(parser, c, ':') < 0 || skipWhitespace(parser) < 0) {
+            return -1;
+        }
 
-            obj->ns = DEFAULT_NS;
-            obj->specular.x = 1;
-            obj->specular.z = 1;
-            obj->specular.y = 1;
-
-            jsonObj.objs = realloc(jsonObj.objs, ++objsSize *
-                sizeof(*(jsonObj.objs)));
-            jsonObj.objs[objsSize - 1] = obj;
-        }
-        else if(strcmp(type, "light") == 0) {
-            if((light = malloc(sizeof(*light))) == NULL) {
-                fprintf(stderr, "Error: Line %zu: Memory reallocation error\n",
-                    line);
-                perror("");
-                exit(EXIT_FAILURE);
-            }
+        const sceneKey* key = findKey(type, text, length);
+        if(key == NULL) {
+            return jsonError(parser, "Key '%.*s' not supported under '%s'",
+                (int)length, text, type->name);
+        }
+        if(parseFlag(parser, &keyFlag, 1 << (key - type->keys),
+                key->name) < 0 || parseValue(parser, key, target,
+                &(jsonObj->arena)) < 0) {
+            return -1;
+        }
 
-            memset(light, 0, sizeof(*light));
-
-            light->radialAtten[2] = 1;
-
-            jsonObj.lights = realloc(jsonObj.lights, ++lightsSize *
-                sizeof(*(jsonObj.lights)));
-            jsonObj.lights[lightsSize - 1] = light;
-        }
-        else if(strcmp(type, "camera") != 0) {
-            fprintf(stderr, "Error: Line %zu: Unknown type %s", line,
-                type);
-            exit(EXIT_FAILURE);
-        }
-
-        keyFlag = 0;
-
-        skipWhitespace(json, &line);
-        while((c = jsonGetC(json, &line)) == ',') {
-            skipWhitespace(json, &line);
-            // Get key
-            key = nextString(json, &line);
-
-            // Get ':' token
-            skipWhitespace(json, &line);
-            c = jsonGetC(json, &line);
-            tokenCheck(c, ':', line);
-
-            skipWhitespace(json, &line);
-            // TODO: Find way to remove redundant code
-            if(strcmp(type, "camera") == 0) {
-                if(strcmp(key, "width") == 0) {
-                    if(keyFlag & CAMERA_WIDTH_FLAG) {
-                        fprintf(stderr, "Error: Line %zu: 'width' already defined\n",
-                            line);
-                        exit(EXIT_FAILURE);
-                    }
-                    keyFlag |= CAMERA_WIDTH_FLAG;
-
-                    jsonObj.camera.width = nextNumber(json, &line);
-                    if(jsonObj.camera.width < 0) {
-                        fprintf(stderr, "Error: Line %zu: Width cannot be negative\n",
-                            line);
-                        exit(EXIT_FAILURE);
-                    }
-                }
-                else if(strcmp(key, "height") == 0) {
-                    if(keyFlag & CAMERA_HEIGHT_FLAG) {
-                        fprintf(stderr, "Error: Line %zu: 'height' already defined\n",
-                            line);
-                        exit(EXIT_FAILURE);
-                    }
-                    keyFlag |= CAMERA_HEIGHT_FLAG;
-
-                    jsonObj.camera.height = nextNumber(json, &line);
-                    if(jsonObj.camera.height < 0) {
-                        fprintf(stderr, "Error: Line %zu: Height cannot be negative\n",
-                            line);
-                        exit(EXIT_FAILURE);
-                    }
-                }
-                else {
-                    fprintf(stderr, "Error: Line %zu: Key '%s' not supported "
-                        "under 'camera'\n", line, key);
-                    exit(EXIT_FAILURE);
-                }
-            }
-            else if(strcmp(type, "sphere") == 0) {
-                if(strcmp(key, "position") == 0) {
-                    if(keyFlag & SPHERE_POS_FLAG) {
-                        fprintf(stderr, "Error: Line %zu: 'position' already defined\n",
-                            line);
-                        exit(EXIT_FAILURE);
-                    }
-                    keyFlag |= SPHERE_POS_FLAG;
-
-                    obj->sphere.pos = nextVector3d(json, &line);
-                }
-                else if(strcmp(key, "radius") == 0) {
-                    if(keyFlag & SPHERE_RAD_FLAG) {
-                        fprintf(stderr, "Error: Line %zu: 'radius' already defined\n",
-                            line);
-                        exit(EXIT_FAILURE);
-                    }
-
-                    obj->sphere.radius = nextNumber(json, &line);
-                    if(obj->sphere.radius < 0) {
-                        fprintf(stderr, "Error: Line %zu: Radius cannot be "
-                            "negative\n", line);
-                        exit(EXIT_FAILURE);
-                    }
-                    keyFlag |= SPHERE_RAD_FLAG;
-                }
-                else if(strcmp(key, "diffuse_color") == 0) {
-                    if(keyFlag & DIFFUSE_FLAG) {
-                        fprintf(stderr, "Error: Line %zu: 'diffuse_color' already defined\n",
-                            line);
-                        exit(EXIT_FAILURE);
-                    }
-                    keyFlag |= DIFFUSE_FLAG;
-
-                    obj->diffuse = nextColor(json, &line);
-                }
-                else if(strcmp(key, "specular_color") == 0) {
-                    if(keyFlag & SPECULAR_FLAG) {
-                        fprintf(stderr, "Error: Line %zu: 'specular_color' already defined\n",
-                            line);
-                        exit(EXIT_FAILURE);
-                    }
-                    keyFlag |= SPECULAR_FLAG;
-
-                    obj->specular = nextColor(json, &line);
-                }
-                else {
-                    fprintf(stderr, "Error: Line %zu: Key '%s' not supported "
-                        "under 'sphere'\n", line, key);
-                    exit(EXIT_FAILURE);
-                }
-            }
-            else if(strcmp(type, "plane") == 0) {
-                if(strcmp(key, "position") == 0) {
-                    if(keyFlag & PLANE_POS_FLAG) {
-                        fprintf(stderr, "Error: Line %zu: 'position' already defined\n",
-                            line);
-                        exit(EXIT_FAILURE);
-                    }
-                    keyFlag |= PLANE_POS_FLAG;
-
-                    obj->plane.pos = nextVector3d(json, &line);
-                }
-                else if(strcmp(key, "normal") == 0) {
-                    if(keyFlag & PLANE_NORMAL_FLAG) {
-                        fprintf(stderr, "Error: Line %zu: 'normal' already defined\n",
-                            line);
-                        exit(EXIT_FAILURE);
-                    }
-                    keyFlag |= PLANE_NORMAL_FLAG;
-
-                    obj->plane.normal = nextVector3d(json, &line);
-                }
-                else if(strcmp(key, "diffuse_color") == 0) {
-                    if(keyFlag & DIFFUSE_FLAG) {
-                        fprintf(stderr, "Error: Line %zu: 'diffuse_color' already defined\n",
-                            line);
-                        exit(EXIT_FAILURE);
-                    }
-                    keyFlag |= DIFFUSE_FLAG;
-
-                    obj->diffuse = nextColor(json, &line);
-                }
-                else if(strcmp(key, "specular_color") == 0) {
-                    if(keyFlag & SPECULAR_FLAG) {
-                        fprintf(stderr, "Error: Line %zu: 'specular_color' already defined\n",
-                            line);
-                        exit(EXIT_FAILURE);
-                    }
-                    keyFlag |= SPECULAR_FLAG;
-
-                    obj->specular = nextColor(json, &line);
-                }
-                else {
-                    fprintf(stderr, "Error: Line %zu: Key '%s' not supported "
-                        "under 'plane'\n", line, key);
-                    exit(EXIT_FAILURE);
-                }
-            }
-            else if(strcmp(type, "light") == 0) {
-                if(strcmp(key, "position") == 0) {
-                    if(keyFlag & LIGHT_POS_FLAG) {
-                        fprintf(stderr, "Error: Line %zu: 'position' already defined\n",
-                            line);
-                        exit(EXIT_FAILURE);
-                    }
-                    keyFlag |= LIGHT_POS_FLAG;
-
-                    light->pos = nextVector3d(json, &line);
-                }
-                else if(strcmp(key, "direction") == 0) {
-                    if(keyFlag & LIGHT_DIR_FLAG) {
-                        fprintf(stderr, "Error: Line %zu: 'direction' already defined\n",
-                            line);
-                        exit(EXIT_FAILURE);
-                    }
-                    keyFlag |= LIGHT_DIR_FLAG;
-
-                    light->dir = nextVector3d(json, &line);
-                }
-                else if(strcmp(key, "color") == 0) {
-                    if(keyFlag & LIGHT_COLOR_FLAG) {
-                        fprintf(stderr, "Error: Line %zu: 'color' already defined\n",
-                            line);
-                        exit(EXIT_FAILURE);
-                    }
-                    keyFlag |= LIGHT_COLOR_FLAG;
-
-                    light->color = nextColor(json, &line);
-                }
-                else if(strcmp(key, "theta") == 0) {
-                    if(keyFlag & LIGHT_THETA_FLAG) {
-                        fprintf(stderr, "Error: Line %zu: 'theta' already defined\n",
-                            line);
-                        exit(EXIT_FAILURE);
-                    }
-                    keyFlag |= LIGHT_THETA_FLAG;
-
-                    light->theta = nextNumber(json, &line);
-                    if(light->theta < 0) {
-                        fprintf(stderr, "Error: Line %zu: 'theta' cannot be negative\n",
-                            line);
-                            exit(EXIT_FAILURE);
-                    }
-                }
-                else if(strcmp(key, "radial-a0") == 0) {
-                    if(keyFlag & LIGHT_RAD_A0_FLAG) {
-                        fprintf(stderr, "Error: Line %zu: 'radial-a0' already defined\n",
-                            line);
-                        exit(EXIT_FAILURE);
-                    }
-                    keyFlag |= LIGHT_RAD_A0_FLAG;
-
-                    light->radialAtten[0] = nextNumber(json, &line);
-                    if(light->radialAtten[0] < 0) {
-                        fprintf(stderr, "Error: Line %zu: 'radial-a0' cannot be negative\n",
-                            line);
-                            exit(EXIT_FAILURE);
-                    }
-                }
-                else if(strcmp(key, "radial-a1") == 0) {
-                    if(keyFlag & LIGHT_RAD_A1_FLAG) {
-                        fprintf(stderr, "Error: Line %zu: 'radial-a1' already defined\n",
-                            line);
-                        exit(EXIT_FAILURE);
-                    }
-                    keyFlag |= LIGHT_RAD_A1_FLAG;
-
-                    light->radialAtten[1] = nextNumber(json, &line);
-                    if(light->radialAtten[1] < 0) {
-                        fprintf(stderr, "Error: Line %zu: 'radial-a1' cannot be negative\n",
-                            line);
-                            exit(EXIT_FAILURE);
-                    }
-                }
-                else if(strcmp(key, "radial-a2") == 0) {
-                    if(keyFlag & LIGHT_RAD_A2_FLAG) {
-                        fprintf(stderr, "Error: Line %zu: 'radial-a2' already defined\n",
-                            line);
-                        exit(EXIT_FAILURE);
-                    }
-                    keyFlag |= LIGHT_RAD_A2_FLAG;
-
-                    light->radialAtten[2] = nextNumber(json, &line);
-                    if(light->radialAtten[2] < 0) {
-                        fprintf(stderr, "Error: Line %zu: 'radial-a2' cannot be negative\n",
-                            line);
-                            exit(EXIT_FAILURE);
-                    }
-                }
-                else if(strcmp(key, "angular-a0") == 0) {
-                    if(keyFlag & LIGHT_ANG_A0_FLAG) {
-                        fprintf(stderr, "Error: Line %zu: 'angular-a0' already defined\n",
-                            line);
-                        exit(EXIT_FAILURE);
-                    }
-                    keyFlag |= LIGHT_ANG_A0_FLAG;
-
-                    light->angularAtten = nextNumber(json, &line);
-                    if(light->angularAtten < 0) {
-                        fprintf(stderr, "Error: Line %zu: 'angular-a0' cannot be negative\n",
-                            line);
-                            exit(EXIT_FAILURE);
-                    }
-                }
-            }
+        if(skipWhitespace(parser) < 0) {
+            return -1;
+        }
+    }
 
-            skipWhitespace(json, &line);
+    for(size_t i = 0; i < type->keyCount; i++) {
+        if(type->keys[i].required && !(keyFlag & 1 << i)) {
+            return jsonError(parser, "'%s' missing '%s' property",
+                type->name, type->keys[i].name);
         }
+    }
 
-        if(strcmp(type, "camera") == 0) {
-            if(!(keyFlag & CAMERA_WIDTH_FLAG)) {
-                fprintf(stderr, "Error: Line %zu: 'camera' missing 'width' "
-                    "property missing\n", line);
-                exit(EXIT_FAILURE);
-            }
-            if(!(keyFlag & CAMERA_HEIGHT_FLAG)) {
-                fprintf(stderr, "Error: Line %zu: 'camera' missing 'height' "
-                    "property missing\n", line);
-                exit(EXIT_FAILURE);
+    return tokenCheck(parser, c, '}');
+}
+
+int parseParallel(jsonParser* parser, jsonObj* jsonObj, size_t threads) {
+    size_t chunkSize = (parser->end - parser->cursor) /
+        (JSON_CHUNKS * threads);
+    if(chunkSize < JSON_CHUNK_SIZE) {
+        chunkSize = JSON_CHUNK_SIZE;
+    }
+
+    jsonChunk* chunks;
+    size_t lines;
+    size_t count = findChunks(parser, chunkSize, &chunks, &lines);
+    if(count < 2) {
+        free(chunks);
+        return -1;
+    }
+
+    tile* tiles = malloc(sizeof(*tiles) * count);
+    if(tiles == NULL) {
+        free(chunks);
+        return -1;
+    }
+    for(size_t i = 0; i < count; i++) {
+        tiles[i].x = 0;
+        tiles[i].y = i;
+        tiles[i].width = 1;
+        tiles[i].height = 1;
+    }
+
+    int status = scheduler_run(tiles, count, threads, parseChunk, chunks);
+    free(tiles);
+
+    // Every chunk's lists go into one, in the order the chunks came in
+    size_t objsSize = 0, lightsSize = 0;
+    for(size_t i = 0; i < count && status == 0; i++) {
+        status = chunks[i].failed ? -1 : 0;
+        objsSize += chunks[i].builder.objsSize;
+        lightsSize += chunks[i].builder.lightsSize;
+    }
+
+    memset(jsonObj, 0, sizeof(*jsonObj));
+    arena_init(&(jsonObj->arena));
+    if(status == 0) {
+        jsonObj->objs = malloc(sizeof(*(jsonObj->objs)) * (objsSize + 1));
+        jsonObj->lights = malloc(sizeof(*(jsonObj->lights)) * (lightsSize + 1));
+        status = jsonObj->objs == NULL || jsonObj->lights == NULL ? -1 : 0;
+    }
+    if(status == 0) {
+        objsSize = 0;
+        lightsSize = 0;
+        for(size_t i = 0; i < count; i++) {
+            struct jsonObj* part = &(chunks[i].jsonObj);
+
+            memcpy(&(jsonObj->objs[objsSize]), part->objs,
+                sizeof(*(part->objs)) * chunks[i].builder.objsSize);
+            objsSize += chunks[i].builder.objsSize;
+            memcpy(&(jsonObj->lights[lightsSize]), part->lights,
+                sizeof(*(part->lights)) * chunks[i].builder.lightsSize);
+            lightsSize += chunks[i].builder.lightsSize;
+
+            // A later camera replaces an earlier one, as it does in order
+            if(chunks[i].builder.camera) {
+                jsonObj->camera = part->camera;
             }
+            arena_merge(&(jsonObj->arena), &(part->arena));
         }
-        else if(strcmp(type, "sphere") == 0) {
-            if(!(keyFlag & SPHERE_RAD_FLAG)) {
-                fprintf(stderr, "Error: Line %zu: 'sphere' missing 'radius' "
-                    "property missing\n", line);
+        jsonObj->objs[objsSize] = NULL;
+        jsonObj->lights[lightsSize] = NULL;
 
-                exit(EXIT_FAILURE);
-            }
-            if(!(keyFlag & SPHERE_POS_FLAG)) {
-                fprintf(stderr, "Error: Line %zu: 'sphere' missing 'position' "
-                    "property missing\n", line);
-                exit(EXIT_FAILURE);
-            }
-            if(!(keyFlag & DIFFUSE_FLAG)) {
-                fprintf(stderr, "Error: Line %zu: 'sphere' missing 'diffuse_color' "
-                    "property missing\n", line);
-                exit(EXIT_FAILURE);
-            }
+        parser->cursor = parser->end;
+        parser->line = lines;
+    }
+    else {
+        free(jsonObj->objs);
+        free(jsonObj->lights);
+        memset(jsonObj, 0, sizeof(*jsonObj));
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        freeScene(&(chunks[i].jsonObj));
+    }
+    free(chunks);
+
+    return status;
+}
+
+void parseChunk(tile tile, size_t threadId, void* data) {
+    jsonChunk* chunk = &(((jsonChunk*)data)[tile.y]);
+    jsonParser parser;
+
+    (void)threadId;
+
+    json_init(&parser, chunk->start, chunk->end - chunk->start);
+    parser.line = chunk->line;
+
+    chunk->failed = startScene(&parser, &(chunk->jsonObj),
+        &(chunk->builder)) < 0;
+    while(!chunk->failed) {
+        if(parseObject(&parser, &(chunk->builder)) < 0) {
+            chunk->failed = 1;
+            break;
         }
-        else if(strcmp(type, "plane") == 0) {
-            if(!(keyFlag & PLANE_POS_FLAG)) {
-                fprintf(stderr, "Error: Line %zu: 'plane' missing 'position' "
-                    "property missing\n", line);
-                exit(EXIT_FAILURE);
-            }
-            if(!(keyFlag & PLANE_NORMAL_FLAG)) {
-                fprintf(stderr, "Error: Line %zu: 'plane' missing 'normal' "
-                    "property missing\n", line);
-                exit(EXIT_FAILURE);
-            }
-            if(!(keyFlag & DIFFUSE_FLAG)) {
-                fprintf(stderr, "Error: Line %zu: 'plane' missing 'diffuse_color' "
-                    "property missing\n", line);
-                exit(EXIT_FAILURE);
-            }
+
+        skipSpaces(&parser);
+        if(parser.cursor == parser.end) {
+            break;
         }
-        else if(strcmp(type, "light") == 0) {
-            if(!(keyFlag & LIGHT_POS_FLAG)) {
-                fprintf(stderr, "Error: Line %zu: 'light' missing 'position' "
-                    "property missing\n", line);
-                exit(EXIT_FAILURE);
+        chunk->failed = jsonGetC(&parser) != ',' ||
+            skipWhitespace(&parser) < 0;
+    }
+}
+
+size_t findChunks(const jsonParser* input, size_t chunkSize,
+        jsonChunk** chunks, size_t* lines) {
+    // A copy, so the scan leaves the real parser where it was
+    jsonParser parser = *input;
+    size_t count = 0, capacity = 1;
+    jsonChunk* chunk = NULL;
+
+    *chunks = malloc(sizeof(**chunks));
+    if(*chunks == NULL) {
+        return 0;
+    }
+
+    skipSpaces(&parser);
+    if(parser.cursor == parser.end || *(parser.cursor++) != '[') {
+        return 0;
+    }
+
+    for(;;) {
+        skipSpaces(&parser);
+        if(parser.cursor == parser.end || *parser.cursor != '{') {
+            return 0;
+        }
+
+        // Objects go in the current chunk until it holds chunkSize bytes
+        if(chunk == NULL || (size_t)(parser.cursor - chunk->start) >=
+                chunkSize) {
+            jsonChunk* grown = growList(*chunks, count + 1, &capacity,
+                sizeof(**chunks));
+            if(grown == NULL) {
+                return 0;
             }
-            if(!(keyFlag & LIGHT_COLOR_FLAG)) {
-                fprintf(stderr, "Error: Line %zu: 'light' missing 'color' "
-                    "property missing\n", line);
-                exit(EXIT_FAILURE);
+            *chunks = grown;
+            chunk = &((*chunks)[count++]);
+            memset(chunk, 0, sizeof(*chunk));
+            chunk->start = parser.cursor;
+            chunk->line = parser.line;
+        }
+
+        if(skipObject(&parser) < 0) {
+            return 0;
+        }
+        chunk->end = parser.cursor;
+
+        skipSpaces(&parser);
+        if(parser.cursor == parser.end) {
+            return 0;
+        }
+        char c = *(parser.cursor++);
+        if(c == ']') {
+            break;
+        }
+        if(c != ',') {
+            return 0;
+        }
+    }
+
+    skipSpaces(&parser);
+    if(parser.cursor != parser.end) {
+        return 0;
+    }
+    *lines = parser.line;
+
+    return count;
+}
+
+int skipObject(jsonParser* parser) {
+    const char* cursor = parser->cursor + 1;
+    const char* end = parser->end;
+    size_t depth = 1;
+
+    // Empty objects are warned about, which only the sequential parse does
+    while(cursor < end && isSpace(*cursor)) {
+        cursor++;
+    }
+    if(cursor < end && *cursor == '}') {
+        return -1;
+    }
+    cursor = parser->cursor + 1;
+
+    while(depth > 0) {
+        if(cursor == end) {
+            return -1;
+        }
+
+        switch(*cursor) {
+            case('"'): {
+                // Strings have no escapes, so they end at the next quote
+                const char* quote = memchr(cursor + 1, '"', end - cursor - 1);
+                if(quote == NULL) {
+                    return -1;
+                }
+                countLines(parser, cursor + 1, quote);
+                cursor = quote + 1;
+                continue;
             }
+            case('{'):
+            case('['):
+                depth++;
+                break;
+            case('}'):
+            case(']'):
+                depth--;
+                break;
+            case('\n'):
+                parser->line += 1;
+                break;
         }
+        cursor++;
+    }
+    parser->cursor = cursor;
+
+    return 0;
+}
 
-        tokenCheck(c, '}', line);
+int json_map(jsonParser* parser, const char* path) {
+    struct stat info;
 
-        skipWhitespace(json, &line);
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return -1;
     }
-    while((c = jsonGetC(json, &line)) == ',');
 
-    tokenCheck(c, ']', line);
+    // Pipes and empty files cannot be mapped, so they are read instead
+    if(fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void* map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map != MAP_FAILED) {
+            close(fd);
+            posix_madvise(map, info.st_size, POSIX_MADV_SEQUENTIAL);
+            json_init(parser, map, info.st_size);
+            parser->data = map;
+            parser->mapSize = info.st_size;
+            return 0;
+        }
+    }
 
-    trailSpaceCheck(json, &line);
+    int status = readInput(parser, fd);
+    int error = errno;
+    close(fd);
+    errno = error;
 
-    jsonObj.objs = realloc(jsonObj.objs, (objsSize + 1) * sizeof(*(jsonObj.objs)));
-    jsonObj.objs[objsSize] = NULL;
-    jsonObj.lights = realloc(jsonObj.lights, (lightsSize + 1) * sizeof(*(jsonObj.lights)));
-    jsonObj.lights[lightsSize] = NULL;
+    return status;
+}
 
-    return jsonObj;
+int json_read(jsonParser* parser, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return -1;
+    }
+
+    int status = readInput(parser, fd);
+    int error = errno;
+    close(fd);
+    errno = error;
+
+    return status;
+}
+
+void json_init(jsonParser* parser, const char* data, size_t size) {
+    memset(parser, 0, sizeof(*parser));
+    parser->cursor = data;
+    parser->end = data + size;
+    parser->line = 1;
+}
+
+void json_close(jsonParser* parser) {
+    if(parser->mapSize > 0) {
+        munmap(parser->data, parser->mapSize);
+    }
+    else {
+        free(parser->data);
+    }
+    parser->data = NULL;
+    parser->mapSize = 0;
+    parser->cursor = parser->end = NULL;
 }
 
-void errorCheck(int c, FILE* fp, size_t line) {
-    if(c == EOF) {
-        if(feof(fp)) {
-            fprintf(stderr, "Error: Line %zu: Premature end-of-file\n", line);
-            exit(EXIT_FAILURE);
+// Reads all of fd into memory for json_map() and json_read()
+int readInput(jsonParser* parser, int fd) {
+    char* data = NULL;
+    size_t size = 0, capacity = 0;
+
+    for(;;) {
+        if(capacity - size < JSON_READ_SIZE) {
+            capacity = capacity > 0 ? 2 * capacity : JSON_READ_SIZE;
+            char* grown = realloc(data, capacity);
+            if(grown == NULL) {
+                free(data);
+                errno = ENOMEM;
+                return -1;
+            }
+            data = grown;
+        }
+
+        ssize_t bytes = read(fd, &(data[size]), capacity - size);
+        if(bytes < 0 && errno == EINTR) {
+            continue;
         }
-        else if(ferror(fp)) {
-            fprintf(stderr, "Error: Line %zu: Read error\n", line);
-            perror("");
-            exit(EXIT_FAILURE);
+        if(bytes < 0) {
+            free(data);
+            return -1;
         }
+        if(bytes == 0) {
+            break;
+        }
+        size += bytes;
+    }
+
+    json_init(parser, data, size);
+    parser->data = data;
+
+    return 0;
+}
+
+int jsonError(jsonParser* parser, const char* format, ...) {
+    // Keep the first error, which is the one that stopped the parse
+    if(parser->error[0] != '\0') {
+        return -1;
     }
+
+    int length = snprintf(parser->error, sizeof(parser->error), "Line %zu: ",
+        parser->line);
+    va_list args;
+    va_start(args, format);
+    vsnprintf(parser->error + length, sizeof(parser->error) - length, format,
+        args);
+    va_end(args);
+
+    return -1;
 }
 
-void tokenCheck(int c, char token, size_t line) {
+int tokenCheck(jsonParser* parser, int c, char token) {
     if(c != token) {
-        fprintf(stderr, "Error: Line %zu: Expected '%c'\n", line, token);
-        exit(EXIT_FAILURE);
+        return jsonError(parser, "Expected '%c'", token);
     }
+
+    return 0;
 }
 
-int jsonGetC(FILE* json, size_t* line) {
-    int c = fgetc(json);
-    errorCheck(c, json, *line);
+int jsonGetC(jsonParser* parser) {
+    if(parser->cursor == parser->end) {
+        return jsonError(parser, "Premature end-of-file");
+    }
 
+    int c = (unsigned char)*(parser->cursor++);
     if(c == '\n') {
-        *line += 1;
+        parser->line += 1;
     }
 
     return c;
 }
 
-void skipWhitespace(FILE* json, size_t* line) {
-    int c;
+int jsonUngetC(jsonParser* parser, int c) {
+    parser->cursor--;
+    if(c == '\n') {
+        parser->line -= 1;
+    }
+
+    return 0;
+}
 
-    c = jsonGetC(json, line);
-    while(isspace(c)) {
-        c = jsonGetC(json, line);
+int skipWhitespace(jsonParser* parser) {
+    skipSpaces(parser);
+
+    if(parser->cursor == parser->end) {
+        return jsonError(parser, "Premature end-of-file");
     }
 
-    if(ungetc(c, json) == EOF) {
-        fprintf(stderr, "Error: Line %zu: Read error\n", *line);
-        perror("");
-        exit(EXIT_FAILURE);
+    return 0;
+}
+
+int trailSpaceCheck(jsonParser* parser) {
+    skipSpaces(parser);
+
+    if(parser->cursor != parser->end) {
+        return jsonError(parser, "Unkown token at end-of-file");
     }
+
+    return 0;
 }
 
-void trailSpaceCheck(FILE* json, size_t* line) {
-    int c;
+// Moves the cursor past any whitespace, counting the lines it ends
+void skipSpaces(jsonParser* parser) {
+    const char* cursor = parser->cursor;
+
+#ifdef __SSE2__
+    // 16 bytes at a time: a byte is a space if it is ' ' or '\t' to '\r',
+    // the same ones isspace() takes
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i controls = _mm_set1_epi8('\r' - '\t');
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i newline = _mm_set1_epi8('\n');
+    while(parser->end - cursor >= 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)cursor);
+        __m128i control = _mm_sub_epi8(bytes, tab);
+        __m128i spaces = _mm_or_si128(_mm_cmpeq_epi8(bytes, space),
+            _mm_cmpeq_epi8(_mm_min_epu8(control, controls), control));
+        unsigned others = ~_mm_movemask_epi8(spaces) & 0xFFFF;
+        unsigned lines = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline));
+
+        if(others != 0) {
+            unsigned skipped = __builtin_ctz(others);
+            parser->line += __builtin_popcount(lines &
+                ((1u << skipped) - 1));
+            parser->cursor = cursor + skipped;
+            return;
+        }
+        parser->line += __builtin_popcount(lines);
+        cursor += 16;
+    }
+#endif
 
-    // Manually get trailing whitespace
-    while((c = fgetc(json)) != EOF && isspace(c)) {
-        if(c == '\n') {
-            *line += 1;
+    while(cursor < parser->end && isSpace(*cursor)) {
+        if(*cursor == '\n') {
+            parser->line += 1;
         }
+        cursor++;
     }
+    parser->cursor = cursor;
+}
 
-    if(c != EOF) {
-        fprintf(stderr, "Error: Line %zu: Unkown token at end-of-file\n", *line);
-        exit(EXIT_FAILURE);
+// Adds the newlines from start up to end to the line count
+void countLines(jsonParser* parser, const char* start, const char* end) {
+    while((start = memchr(start, '\n', end - start)) != NULL) {
+        parser->line += 1;
+        start++;
     }
-    else if(!feof(json) && ferror(json)) {
-        fprintf(stderr, "Error: Line %zu: Read error\n", *line);
-        perror("");
-        exit(EXIT_FAILURE);
+}
+
+int isSpace(int c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+int isDigit(int c) {
+    return c >= '0' && c <= '9';
+}
+
+char* nextArenaString(jsonParser* parser, arena* arena) {
+    size_t length;
+    const char* start = scanString(parser, &length);
+    if(start == NULL) {
+        return NULL;
     }
+
+    char* string = arena_string(arena, start, length);
+    if(string == NULL) {
+        jsonError(parser, "Memory allocation error");
+    }
+
+    return string;
 }
 
-char* nextString(FILE* json, size_t* line) {
-    size_t bufferSize = 64;
-    size_t oldSize = bufferSize;
-    char* buffer = malloc(bufferSize);
-    if(buffer == NULL) {
-        fprintf(stderr, "Error: Line %zu: Memory allocation error\n", *line);
-        perror("");
-        exit(EXIT_FAILURE);
+// Moves past the next string and returns where its text starts in the input
+const char* scanString(jsonParser* parser, size_t* length) {
+    int c = jsonGetC(parser);
+    if(tokenCheck(parser, c, '"') < 0) {
+        return NULL;
     }
-    int c;
-    size_t i;
-
-    c = jsonGetC(json, line);
-    tokenCheck(c, '"', *line);
-
-    i = 0;
-    while(i < bufferSize - 1 && (c = jsonGetC(json, line)) != '"') {
-        if(i == bufferSize - 2) {
-            bufferSize *= 2;
-            // Integer overflow
-            if(oldSize != 0 && bufferSize / oldSize != 2) {
-                fprintf(stderr, "Error: Line %zu: Integer overflow on size\n",
-                    *line);
-                exit(EXIT_FAILURE);
-            }
 
-            oldSize = bufferSize;
-            buffer = realloc(buffer, bufferSize);
-            if(buffer == NULL) {
-                fprintf(stderr, "Error: Line %zu: Memory reallocation error\n",
-                    *line);
-                perror("");
-                exit(EXIT_FAILURE);
+    const char* start = parser->cursor;
+    const char* quote = memchr(start, '"', parser->end - start);
+    if(quote == NULL) {
+        countLines(parser, start, parser->end);
+        parser->cursor = parser->end;
+        jsonError(parser, "Premature end-of-file");
+        return NULL;
+    }
+    countLines(parser, start, quote);
+    parser->cursor = quote + 1;
+    *length = quote - start;
+
+    return start;
+}
+
+int nextNumber(jsonParser* parser, double* value) {
+    static const double POWERS[JSON_EXACT_POWER + 1] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+        1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    if(skipWhitespace(parser) < 0) {
+        return -1;
+    }
+
+    // Scan the number, keeping its first significant digits as an integer
+    // mantissa and the power of ten it is scaled by
+    const char* start = parser->cursor;
+    const char* cursor = start;
+    const char* end = parser->end;
+    uint64_t mantissa = 0;
+    int digits = 0, seen = 0, truncated = 0;
+    long exponent = 0;
+
+    int negative = *cursor == '-';
+    if(*cursor == '-' || *cursor == '+') {
+        cursor++;
+    }
+    for(; cursor < end && isDigit(*cursor); cursor++) {
+        seen = 1;
+        if(digits < JSON_MANTISSA_DIGITS) {
+            mantissa = 10 * mantissa + (*cursor - '0');
+            digits += mantissa != 0;
+        }
+        else {
+            truncated |= *cursor != '0';
+            exponent++;
+        }
+    }
+    if(cursor < end && *cursor == '.') {
+        for(cursor++; cursor < end && isDigit(*cursor); cursor++) {
+            seen = 1;
+            if(digits < JSON_MANTISSA_DIGITS) {
+                mantissa = 10 * mantissa + (*cursor - '0');
+                digits += mantissa != 0;
+                exponent--;
+            }
+            else {
+                truncated |= *cursor != '0';
             }
         }
-        buffer[i++] = c;
     }
-    buffer[i] = '\0';
+    if(!seen) {
+        return jsonError(parser, "Invalid number");
+    }
 
-    return buffer;
-}
+    // An 'e' without digits after it is not part of the number
+    if(cursor < end && (*cursor == 'e' || *cursor == 'E')) {
+        const char* power = cursor + 1;
+        int negativePower = power < end && *power == '-';
+        if(power < end && (*power == '-' || *power == '+')) {
+            power++;
+        }
+        if(power < end && isDigit(*power)) {
+            long explicit = 0;
+            for(; power < end && isDigit(*power); power++) {
+                // Far past the range of a double either way
+                if(explicit < 100000) {
+                    explicit = 10 * explicit + (*power - '0');
+                }
+            }
+            exponent += negativePower ? -explicit : explicit;
+            cursor = power;
+        }
+    }
+    parser->cursor = cursor;
+
+    // When the mantissa and the power of ten are both exact doubles, one
+    // rounded multiply or divide gives the correctly rounded value (Clinger)
+    if(FLT_EVAL_METHOD == 0 && !truncated &&
+            mantissa <= JSON_EXACT_MANTISSA &&
+            exponent >= -JSON_EXACT_POWER && exponent <= JSON_EXACT_POWER) {
+        double number = mantissa;
+        number = exponent < 0 ? number / POWERS[-exponent] :
+            number * POWERS[exponent];
+        *value = negative ? -number : number;
+        return 0;
+    }
 
-double nextNumber(FILE* json, size_t* line) {
-    double value;
-    int status = fscanf(json, "%lf", &value);
-    errorCheck(status, json, *line);
-    if(status < 1) {
-        fprintf(stderr, "Error: Line %zu: Invalid number\n", *line);
-        exit(EXIT_FAILURE);
+    // Anything else goes to strtod(), which needs the number on its own
+    size_t length = cursor - start;
+    char local[64];
+    char* text = length < sizeof(local) ? local : malloc(length + 1);
+    if(text == NULL) {
+        return jsonError(parser, "Memory allocation error");
+    }
+    memcpy(text, start, length);
+    text[length] = '\0';
+
+    errno = 0;
+    *value = strtod(text, NULL);
+    int error = errno;
+    if(text != local) {
+        free(text);
     }
 
-    if(errno == ERANGE) {
-        if(value == 0) {
-            fprintf(stderr, "Error: Line %zu: Number underflow\n", *line);
-            exit(EXIT_FAILURE);
+    if(error == ERANGE) {
+        if(*value == 0) {
+            return jsonError(parser, "Number underflow");
         }
-        if(value == HUGE_VAL || value == -HUGE_VAL) {
-            fprintf(stderr, "Error: Line %zu: Number overflow\n", *line);
-            exit(EXIT_FAILURE);
+        if(*value == HUGE_VAL || *value == -HUGE_VAL) {
+            return jsonError(parser, "Number overflow");
         }
     }
 
-    return value;
+    return 0;
+}
+
+int nextVector3d(jsonParser* parser, vector3d* vector) {
+    double x, y, z;
+
+    int c = jsonGetC(parser);
+    if(tokenCheck(parser, c, '[') < 0 || skipWhitespace(parser) < 0 ||
+            nextNumber(parser, &x) < 0 || skipWhitespace(parser) < 0) {
+        return -1;
+    }
+
+    c = jsonGetC(parser);
+    if(tokenCheck(parser, c, ',') < 0 || skipWhitespace(parser) < 0 ||
+            nextNumber(parser, &y) < 0 || skipWhitespace(parser) < 0) {
+        return -1;
+    }
+
+    c = jsonGetC(parser);
+    if(tokenCheck(parser, c, ',') < 0 || skipWhitespace(parser) < 0 ||
+            nextNumber(parser, &z) < 0 || skipWhitespace(parser) < 0) {
+        return -1;
+    }
+
+    c = jsonGetC(parser);
+    if(tokenCheck(parser, c, ']') < 0) {
+        return -1;
+    }
+
+    vector->x = x;
+    vector->y = y;
+    vector->z = z;
+
+    return 0;
 }
 
-vector3d nextVector3d(FILE* json, size_t* line) {
-    vector3d vector;
+int nextColor(jsonParser* parser, vector3d* color) {
+    if(nextVector3d(parser, color) < 0) {
+        return -1;
+    }
 
-    int c = jsonGetC(json, line);
-    tokenCheck(c, '[', *line);
+    if(color->x < 0 || color->y < 0 || color->z < 0) {
+        return jsonError(parser, "Color must be at least 0.0.");
+    }
 
-    skipWhitespace(json, line);
-    vector.x = nextNumber(json, line);
+    return 0;
+}
 
-    skipWhitespace(json, line);
-    c = jsonGetC(json, line);
-    tokenCheck(c, ',', *line);
+// Types and keys are few enough per table that a linear scan is all it
+// takes: matchName() rejects nearly every other entry on its length and
+// first byte before comparing any bytes.
+const sceneType* findType(const char* text, size_t length) {
+    for(size_t i = 0; i < sizeof(SCENE_TYPES) / sizeof(*SCENE_TYPES); i++) {
+        if(matchName(SCENE_TYPES[i].name, SCENE_TYPES[i].length, text,
+                length)) {
+            return &(SCENE_TYPES[i]);
+        }
+    }
 
-    skipWhitespace(json, line);
-    vector.y = nextNumber(json, line);
+    return NULL;
+}
 
-    skipWhitespace(json, line);
-    c = jsonGetC(json, line);
-    tokenCheck(c, ',', *line);
+const sceneKey* findKey(const sceneType* type, const char* text,
+        size_t length) {
+    for(size_t i = 0; i < type->keyCount; i++) {
+        if(matchName(type->keys[i].name, type->keys[i].length, text, length)) {
+            return &(type->keys[i]);
+        }
+    }
 
-    skipWhitespace(json, line);
-    vector.z = nextNumber(json, line);
+    return NULL;
+}
 
-    skipWhitespace(json, line);
-    c = jsonGetC(json, line);
-    tokenCheck(c, ']', *line);
+// Whether the length bytes at text spell name. The length and first byte
+// rule out nearly every other name before any comparing.
+int matchName(const char* name, size_t nameLength, const char* text,
+        size_t length) {
+    return nameLength == length && length > 0 && name[0] == text[0] &&
+        memcmp(name, text, length) == 0;
+}
+
+// Sets flag in keyFlag, failing if an earlier key already set it
+int parseFlag(jsonParser* parser, int* keyFlag, int flag, const char* key) {
+    if(*keyFlag & flag) {
+        return jsonError(parser, "'%s' already defined", key);
+    }
+    *keyFlag |= flag;
 
-    return vector;
+    return 0;
 }
 
-vector3d nextColor(FILE* json, size_t* line) {
-    vector3d color = nextVector3d(json, line);
+// Parses the value of key into its field of target, which arena holds the
+// strings of
+int parseValue(jsonParser* parser, const sceneKey* key, void* target,
+        arena* arena) {
+    void* field = (char*)target + key->offset;
+    double number;
+
+    switch(key->kind) {
+        case(KEY_REAL):
+            if(nextNumber(parser, &number) < 0) {
+                return -1;
+            }
+            *(real*)field = number;
+            if(*(real*)field < 0) {
+                return jsonError(parser, "%s", key->negative);
+            }
+            break;
+        case(KEY_FLOAT):
+            if(nextNumber(parser, &number) < 0) {
+                return -1;
+            }
+            *(float*)field = number;
+            if(*(float*)field < 0) {
+                return jsonError(parser, "%s", key->negative);
+            }
+            break;
+        case(KEY_VECTOR):
+            return nextVector3d(parser, field);
+        case(KEY_COLOR):
+            return nextColor(parser, field);
+        case(KEY_PATH):
+            if((*(char**)field = nextArenaString(parser, arena)) == NULL) {
+                return -1;
+            }
+            break;
+    }
 
-    if(color.x < 0 || color.y < 0 || color.z < 0) {
-        fprintf(stderr, "Error: Line %zu: Color must be at least 0.0.\n",
-            *line);
-        exit(EXIT_FAILURE);
+    return 0;
+}
+
+// Makes room for count entries of size bytes in list, doubling its capacity
+// as needed. Returns the list, or NULL with the old one untouched.
+void* growList(void* list, size_t count, size_t* capacity, size_t size) {
+    if(count <= *capacity) {
+        return list;
+    }
+
+    size_t grown = *capacity;
+    while(grown < count) {
+        grown *= 2;
+    }
+    if(grown > (size_t)-1 / size) {
+        return NULL;
+    }
+
+    list = realloc(list, grown * size);
+    if(list != NULL) {
+        *capacity = grown;
     }
 
-    return color;
+    return list;
 }
@@ -3,15 +3,83 @@
 
 #include <stddef.h>
 
+#include "arena.h"
 #include "pnm.h"
-#include "raycast.h"
+#include "scene.h"
 
 typedef struct jsonObj {
     camera camera;
     sceneObj** objs;
     sceneLight** lights;
+    // Holds every object and light, and the strings they point to
+    arena arena;
 } jsonObj;
 
-jsonObj readScene(const char* path);
+// Longest error message a parse keeps
+#define JSON_ERROR_SIZE 256
+
+// Where a parse is up to in its input, and the first error it ran into
+typedef struct jsonParser {
+    // The next character and the end of the input
+    const char* cursor;
+    const char* end;
+    size_t line;
+    char error[JSON_ERROR_SIZE];
+    // The input, if json_map() or json_read() loaded it. It is mapped if
+    // mapSize is not 0, and allocated otherwise.
+    void* data;
+    size_t mapSize;
+} jsonParser;
+
+// Gets parser ready to parse the file at path, mapping it into memory when
+// it is a regular file and reading it in otherwise. On failure returns -1
+// with errno set.
+int json_map(jsonParser* parser, const char* path);
+// Like json_map(), but always reads a copy, for files that may be rewritten
+// mid-parse (a truncated mapping faults instead of failing)
+int json_read(jsonParser* parser, const char* path);
+// Gets parser ready to parse the size bytes at data, which the caller keeps
+void json_init(jsonParser* parser, const char* data, size_t size);
+// Releases the input of json_map() or json_read(). The error stays readable.
+void json_close(jsonParser* parser);
+
+// parseScene() on the file at path, exiting with the error on failure
+jsonObj readScene(const char* path, size_t threads);
+// Parses a whole scene from parser's input, on up to threads threads when
+// the input is large. On malformed input, returns -1 with the reason in
+// parser->error and nothing left allocated in jsonObj.
+int parseScene(jsonParser* parser, jsonObj* jsonObj, size_t threads);
+// Makes the relative mesh paths in jsonObj relative to the directory of the
+// scene file at scenePath instead of the working directory. The new paths go
+// in jsonObj's arena. Returns -1 when out of memory.
+int resolveMeshPaths(jsonObj* jsonObj, const char* scenePath);
+// Frees everything parseScene() allocated for jsonObj
+void freeScene(jsonObj* jsonObj);
+
+// The tokenizer parseScene() is built on, for other files in the same style
+// (see anim.c). On malformed input each one records the error in parser and
+// returns -1 (NULL for scanString() and nextArenaString()).
+int jsonError(jsonParser* parser, const char* format, ...);
+int jsonGetC(jsonParser* parser);
+// Steps back over c, the character jsonGetC() just returned
+int jsonUngetC(jsonParser* parser, int c);
+int tokenCheck(jsonParser* parser, int c, char token);
+int skipWhitespace(jsonParser* parser);
+int trailSpaceCheck(jsonParser* parser);
+// The text of the next string, left in the input, and its length in length.
+// It is not NUL terminated and ends at the first '"'.
+const char* scanString(jsonParser* parser, size_t* length);
+// Whether the length bytes at text spell name
+int matchName(const char* name, size_t nameLength, const char* text,
+    size_t length);
+// Sets flag in keyFlag, failing with "already defined" for key if an earlier
+// key already set it
+int parseFlag(jsonParser* parser, int* keyFlag, int flag, const char* key);
+// The next string, copied into arena so it is freed along with everything
+// else there
+char* nextArenaString(jsonParser* parser, arena* arena);
+int nextNumber(jsonParser* parser, double* value);
+int nextVector3d(jsonParser* parser, vector3d* vector);
+int nextColor(jsonParser* parser, vector3d* color);
 
 #endif // CS430_JSON_H
@@ -1,78 +1,593 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
 
+#include "anim.h"
+#include "generate.h"
+#include "hdr.h"
 #include "json.h"
 #include "raycast.h"
+#include "rcs.h"
 #include "pnm.h"
+#include "scene.h"
+#include "scheduler.h"
+#include "serve.h"
+#include "stream.h"
+#include "watch.h"
 #include "write.h"
 
-int main(int argc, char const *argv[]) {
-    if(argc < 5) {
-        fprintf(stderr, "usage: raycast width height /path/to/input.json "
-            "/path/to/output.ppm\n");
+// When each stage of a --stats render finished
+typedef struct renderTimes {
+    struct timespec start;
+    struct timespec parsed;
+    struct timespec compiled;
+    struct timespec rendered;
+    struct timespec written;
+} renderTimes;
+
+void printSampleStats(const renderOpts* opts, const renderStats* stats);
+void printTimes(const char* scenePath, size_t width, size_t height,
+    const renderOpts* opts, const scene* scene, const renderStats* stats,
+    const renderTimes* times);
+double seconds(const struct timespec* start, const struct timespec* end);
+void printJsonString(const char* text);
+int hasExtension(const char* path, const char* extension);
+
+int main(int argc, char* argv[]) {
+    renderOpts opts;
+    const char* threadsEnv = getenv("RAYCAST_THREADS");
+    const char* gbufferPath = NULL;
+    int watch = 0;
+    const char* keyframesPath = NULL;
+    size_t frames = 0;
+    const char* socketPath = NULL;
+    size_t bandRows = 0;
+    int mode = 6;
+    // Without -p, the output file extension picks QOI
+    int modeSet = 0;
+    const char* hdrPath = NULL;
+    const char* exportPath = NULL;
+    const char* compilePath = NULL;
+    generateOpts generate = { 0, 0, 0, GENERATE_DEFAULT_SEED };
+    int generating = 0;
+    int seedSet = 0;
+    // Set by --stats, which prints how long each stage took as JSON
+    int timed = 0;
+    renderTimes times;
+    toneOpts tone;
+    size_t maxColorSize = CS430_PNM_MAX_SUPPORTED;
+    // Set by any option that makes the image come from the HDR buffer
+    int toned = 0;
+    int opt;
+    static const struct option longOpts[] = {
+        { "serve", required_argument, NULL, 'S' },
+        { "hdr", required_argument, NULL, 'H' },
+        { "export", required_argument, NULL, 'X' },
+        { "exposure", required_argument, NULL, 'E' },
+        { "tonemap", required_argument, NULL, 'T' },
+        { "gamma", required_argument, NULL, 'G' },
+        { "depth", required_argument, NULL, 'D' },
+        { "compile", required_argument, NULL, 'C' },
+        { "generate", required_argument, NULL, 'N' },
+        { "seed", required_argument, NULL, 'R' },
+        { "stats", no_argument, NULL, 'J' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    renderOpts_init(&opts);
+    toneOpts_init(&tone);
+
+    // The environment sets the default so that '-t' can still override it
+    if(threadsEnv != NULL && scheduler_threads(threadsEnv, &(opts.threads)) < 0) {
         return 1;
     }
-    jsonObj jsonObj = readScene(argv[3]);
-    if(*(jsonObj.objs) == NULL) {
-        return 0;
-    }
 
-    vector3d zeroVector = { 0 };
-
-    for(size_t i = 0; jsonObj.objs[i] != NULL; i++) {
-        if(jsonObj.objs[i]->type == TYPE_PLANE) {
-            if(vector3d_compare(jsonObj.objs[i]->plane.normal, zeroVector) != 0) {
-                jsonObj.objs[i]->plane.normal = vector3d_normalize(jsonObj.objs[i]->plane.normal);
-            }
+    while((opt = getopt_long(argc, argv, "t:s:a:q:n:m:v:g:r:wf:k:b:p:", longOpts,
+            NULL)) != -1) {
+        switch(opt) {
+            case('t'):
+                if(scheduler_threads(optarg, &(opts.threads)) < 0) {
+                    return 1;
+                }
+                break;
+            case('s'):
+                if(renderOpts_shadowCache(optarg, &(opts.shadowCache)) < 0) {
+                    return 1;
+                }
+                break;
+            case('a'):
+                if(renderOpts_adaptive(optarg, &(opts.adaptive)) < 0) {
+                    return 1;
+                }
+                break;
+            case('q'):
+                if(renderOpts_quality(optarg, &(opts.quality)) < 0) {
+                    return 1;
+                }
+                break;
+            case('n'):
+                if(renderOpts_samples(optarg, &(opts.baseSamples)) < 0) {
+                    return 1;
+                }
+                break;
+            case('m'):
+                if(renderOpts_samples(optarg, &(opts.maxSamples)) < 0) {
+                    return 1;
+                }
+                break;
+            case('v'):
+                if(renderOpts_variance(optarg, &(opts.variance)) < 0) {
+                    return 1;
+                }
+                break;
+            case('g'):
+            case('r'):
+                if(gbufferPath != NULL && opts.relight != (opt == 'r')) {
+                    fprintf(stderr, "Error: -g and -r cannot be combined\n");
+                    return 1;
+                }
+                gbufferPath = optarg;
+                opts.relight = opt == 'r';
+                break;
+            case('w'):
+                watch = 1;
+                break;
+            case('f'):
+                if(anim_frameCount(optarg, &frames) < 0) {
+                    return 1;
+                }
+                break;
+            case('k'):
+                keyframesPath = optarg;
+                break;
+            case('b'):
+                if(stream_bandRows(optarg, &bandRows) < 0) {
+                    return 1;
+                }
+                break;
+            case('p'):
+                if(strcmp(optarg, "qoi") == 0) {
+                    mode = WRITE_MODE_QOI;
+                }
+                else if(strcmp(optarg, "3") == 0 || strcmp(optarg, "6") == 0) {
+                    mode = optarg[0] - '0';
+                }
+                else {
+                    fprintf(stderr, "Error: Output mode must be 3, 6 or "
+                        "qoi\n");
+                    return 1;
+                }
+                modeSet = 1;
+                break;
+            case('S'):
+                socketPath = optarg;
+                break;
+            case('H'):
+                hdrPath = optarg;
+                break;
+            case('X'):
+                exportPath = optarg;
+                break;
+            case('C'):
+                compilePath = optarg;
+                break;
+            case('N'):
+                if(generate_counts(optarg, &generate) < 0) {
+                    return 1;
+                }
+                generating = 1;
+                break;
+            case('R'):
+                if(generate_seed(optarg, &(generate.seed)) < 0) {
+                    return 1;
+                }
+                seedSet = 1;
+                break;
+            case('J'):
+                timed = 1;
+                break;
+            case('E'):
+                if(toneOpts_exposure(optarg, &(tone.exposure)) < 0) {
+                    return 1;
+                }
+                toned = 1;
+                break;
+            case('T'):
+                if(toneOpts_curve(optarg, &(tone.curve)) < 0) {
+                    return 1;
+                }
+                toned = 1;
+                break;
+            case('G'):
+                if(toneOpts_gamma(optarg, &(tone.gamma)) < 0) {
+                    return 1;
+                }
+                toned = 1;
+                break;
+            case('D'):
+                if(toneOpts_depth(optarg, &maxColorSize) < 0) {
+                    return 1;
+                }
+                toned = 1;
+                break;
+            default:
+                return 1;
         }
     }
+    argc -= optind;
+    argv += optind;
 
-    for(size_t i = 0; jsonObj.lights[i] != NULL; i++) {
-        if(vector3d_compare(jsonObj.lights[i]->dir, zeroVector) != 0) {
-            jsonObj.lights[i]->dir = vector3d_normalize(jsonObj.lights[i]->dir);
+    if(socketPath != NULL) {
+        if(argc > 0 || watch || gbufferPath != NULL || frames > 0 ||
+                keyframesPath != NULL || bandRows > 0 || mode != 6 ||
+                hdrPath != NULL || exportPath != NULL || toned ||
+                compilePath != NULL || generating || seedSet || timed) {
+            fprintf(stderr, "Error: --serve takes no files and cannot be "
+                "combined with -w, -g, -r, -f, -k, -b, -p, --stats or HDR "
+                "options\n");
+            return 1;
         }
+        return serve_run(socketPath, &opts) < 0;
+    }
+    if(seedSet && !generating) {
+        fprintf(stderr, "Error: --seed only applies to --generate\n");
+        return 1;
     }
+    // Generating writes a random scene instead of rendering one
+    if(generating) {
+        if(argc != 1 || exportPath != NULL || compilePath != NULL || timed) {
+            fprintf(stderr, "Error: --generate takes just the output file\n");
+            return 1;
+        }
+        return generate_scene(argv[0], &generate) < 0;
+    }
+    if(timed && (exportPath != NULL || compilePath != NULL)) {
+        fprintf(stderr, "Error: --stats only applies to rendering\n");
+        return 1;
+    }
+    // Re-export only tone maps a saved HDR buffer, so it needs no scene
+    if(exportPath != NULL) {
+        hdrImage image;
+        if(argc != 1 || hdrPath != NULL) {
+            fprintf(stderr, "Error: --export takes just the output file\n");
+            return 1;
+        }
+        if(!modeSet && hasExtension(argv[0], ".qoi")) {
+            mode = WRITE_MODE_QOI;
+        }
+        if(hdr_read(&image, exportPath) < 0 ||
+                hdr_export(argv[0], &image, &tone, mode, maxColorSize,
+                opts.threads) < 0) {
+            return 1;
+        }
+        hdr_free(&image);
+        return 0;
+    }
+    // Compiling saves the parsed scene for later renders instead of
+    // rendering it
+    if(compilePath != NULL) {
+        if(argc != 1 || exportPath != NULL) {
+            fprintf(stderr, "Error: --compile takes just the output file\n");
+            return 1;
+        }
+        jsonObj jsonObj = readScene(compilePath, opts.threads);
+        scene scene;
+        if(scene_compile(&scene, jsonObj.camera, jsonObj.objs,
+                jsonObj.lights, NULL) < 0 || rcs_write(argv[0], &scene,
+                jsonObj.objs, compilePath) < 0) {
+            return 1;
+        }
+        scene_free(&scene);
+        freeScene(&jsonObj);
+        return 0;
+    }
+    if(argc < 4) {
+        fprintf(stderr, "usage: raycast [-t threads] [-s off|thread|tile] "
+            "[-a size] [-q levels] [-n samples] [-m samples] [-v variance] "
+            "[-g|-r gbuffer] [-w] [-f frames] [-k keyframes.json] [-b rows] "
+            "[-p 3|6|qoi] [--hdr file.pfm] [--exposure stops] "
+            "[--tonemap clamp|reinhard|aces] [--gamma gamma] [--depth 8|16] "
+            "[--stats] width height /path/to/input.json /path/to/output.ppm\n"
+            "       raycast [-p 3|6|qoi] [--exposure stops] "
+            "[--tonemap clamp|reinhard|aces] [--gamma gamma] [--depth 8|16] "
+            "--export /path/to/input.pfm /path/to/output.ppm\n"
+            "       raycast --compile /path/to/input.json "
+            "/path/to/output.rcs\n"
+            "       raycast --generate spheres,planes,lights [--seed seed] "
+            "/path/to/output.json\n"
+            "       raycast [-t threads] [-s off|thread|tile] [-a size] "
+            "[-q levels] [-n samples] [-m samples] [-v variance] "
+            "--serve /path/to/socket\n");
+        return 1;
+    }
+    if(watch && gbufferPath != NULL) {
+        fprintf(stderr, "Error: -w cannot be combined with -g or -r\n");
+        return 1;
+    }
+    int animated = frames > 0 || keyframesPath != NULL;
+    if(animated && (watch || gbufferPath != NULL)) {
+        fprintf(stderr, "Error: -f and -k cannot be combined with -w, -g or "
+            "-r\n");
+        return 1;
+    }
+    if(!modeSet && hasExtension(argv[3], ".qoi")) {
+        mode = WRITE_MODE_QOI;
+    }
+    // Watch mode and animations always write P6
+    if(mode != 6 && (watch || animated)) {
+        fprintf(stderr, "Error: -p and .qoi outputs cannot be combined with "
+            "-w, -f or -k\n");
+        return 1;
+    }
+    if((hdrPath != NULL || toned) && (watch || animated || bandRows > 0)) {
+        fprintf(stderr, "Error: HDR options cannot be combined with -w, -f, "
+            "-k or -b\n");
+        return 1;
+    }
+    if(maxColorSize > CS430_PNM_MAX_SUPPORTED && mode != 6) {
+        fprintf(stderr, "Error: Only P6 supports 16-bit channels\n");
+        return 1;
+    }
+    // QOI is compressed as the bands render whenever the image allows it
+    if(mode == WRITE_MODE_QOI && bandRows == 0 && gbufferPath == NULL &&
+            hdrPath == NULL && !toned) {
+        bandRows = STREAM_DEFAULT_ROWS;
+    }
+    if(bandRows > 0 && (watch || gbufferPath != NULL || animated)) {
+        fprintf(stderr, "Error: -b cannot be combined with -w, -g, -r, -f or "
+            "-k\n");
+        return 1;
+    }
+    // Watch mode and animations change the parsed scene, which a compiled
+    // one no longer has
+    int compiled = hasExtension(argv[2], ".rcs");
+    if(compiled && (watch || animated)) {
+        fprintf(stderr, "Error: Compiled scenes cannot be combined with -w, "
+            "-f or -k\n");
+        return 1;
+    }
+    if(timed && (watch || animated)) {
+        fprintf(stderr, "Error: --stats cannot be combined with -w, -f or "
+            "-k\n");
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &(times.start));
+    jsonObj jsonObj = { 0 };
+    scene scene;
+    if(compiled) {
+        if(rcs_load(&scene, argv[2], opts.threads) < 0) {
+            return 1;
+        }
+        if(scene.objCount == 0) {
+            return 0;
+        }
+    }
+    else {
+        jsonObj = readScene(argv[2], opts.threads);
+        if(*(jsonObj.objs) == NULL) {
+            return 0;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &(times.parsed));
 
     char* endptr;
-    size_t width = strtoul(argv[1], &endptr, 10);
+    size_t width = strtoul(argv[0], &endptr, 10);
     // If the first character is not empty and the set first invalid
     // character is empty, then the whole string is valid. (see 'man strtol')
     // Otherwise, part of the string is not a number.
-    if(!(*(argv[1]) != '\0' && *endptr == '\0')) {
+    if(!(*(argv[0]) != '\0' && *endptr == '\0')) {
         fprintf(stderr, "Error: Invalid decimal value on channel\n");
         return 1;
     }
-    size_t height = strtoul(argv[2], &endptr, 10);
+    size_t height = strtoul(argv[1], &endptr, 10);
     // If the first character is not empty and the set first invalid
     // character is empty, then the whole string is valid. (see 'man strtol')
     // Otherwise, part of the string is not a number.
-    if(!(*(argv[2]) != '\0' && *endptr == '\0')) {
+    if(!(*(argv[1]) != '\0' && *endptr == '\0')) {
         fprintf(stderr, "Error: Invalid decimal value on channel\n");
         return 1;
     }
 
-    pixel* pixels = malloc(sizeof(*pixels) * width * height);
-    if(pixels == NULL) {
-        fprintf(stderr, "Error: Memory allocation error\n");
+    // Animations compile every frame themselves
+    if(!compiled && !animated && scene_compile(&scene, jsonObj.camera,
+            jsonObj.objs, jsonObj.lights, NULL) < 0) {
         return 1;
     }
+    clock_gettime(CLOCK_MONOTONIC, &(times.compiled));
 
-    raycast(pixels, width, height, jsonObj.camera, jsonObj.objs, jsonObj.lights);
+    pnmHeader header = { mode, width, height, 255 };
+    renderStats stats;
+    if(bandRows > 0) {
+        if(stream_render(argv[3], header, bandRows, &scene, &opts,
+                &stats) < 0) {
+            return 1;
+        }
+        printSampleStats(&opts, &stats);
+        // Bands are written as they render, so writing takes no time of its
+        // own
+        clock_gettime(CLOCK_MONOTONIC, &(times.rendered));
+        times.written = times.rendered;
+        if(timed) {
+            printTimes(argv[2], width, height, &opts, &scene, &stats, &times);
+        }
+        return 0;
+    }
+
+    if(animated) {
+        pixel* pixels = malloc(sizeof(*pixels) * width * height);
+        if(pixels == NULL) {
+            fprintf(stderr, "Error: Memory allocation error\n");
+            return 1;
+        }
+
+        animation animation = { 0 };
+        if(keyframesPath != NULL) {
+            animation = readAnimation(keyframesPath);
+        }
+        int status = anim_check(&animation, &jsonObj) < 0 ||
+            anim_run(&animation, frames > 0 ? frames :
+            anim_frames(&animation), argv[3], &jsonObj, pixels, width,
+            height, &opts) < 0;
+        anim_free(&animation);
+        return status;
+    }
+
+    gbuffer gbuffer;
+    if(gbufferPath != NULL) {
+        if(opts.relight) {
+            if(gbuffer_read(&gbuffer, gbufferPath) < 0) {
+                return 1;
+            }
+        }
+        else if(gbuffer_init(&gbuffer, width, height) < 0) {
+            return 1;
+        }
+        opts.gbuffer = &gbuffer;
+    }
+    // Watch mode keeps the hits of the last frame to find the tiles a change
+    // can reach. With more or less than one sample per pixel it has no
+    // G-buffer and renders every change in full.
+    else if(watch && opts.adaptive == 0 && opts.baseSamples == 1 &&
+            opts.maxSamples == 1) {
+        if(gbuffer_init(&gbuffer, width, height) < 0) {
+            return 1;
+        }
+        opts.gbuffer = &gbuffer;
+    }
 
-    FILE* outputFd;
-    if((outputFd = fopen(argv[4], "w")) == NULL) {
-        perror("Error: Cannot open output file\n");
+    hdrImage hdr;
+    if(hdrPath != NULL || toned) {
+        if(hdr_init(&hdr, width, height) < 0) {
+            return 1;
+        }
+        opts.hdr = &hdr;
+    }
+
+    // A single P6 frame is rendered straight into the mapped output file.
+    // Watch mode rewrites the file for every frame, so it keeps a buffer
+    // instead, as do P3 and outputs that cannot be mapped. A toned image is
+    // written from the HDR buffer instead.
+    mappedImage image = { 0 };
+    if(!watch && mode == 6 && !toned &&
+            mapImage(&image, argv[3], header) < 0) {
+        return 1;
+    }
+    pixel* pixels = image.pixels;
+    if(pixels == NULL) {
+        pixels = malloc(sizeof(*pixels) * width * height);
+        if(pixels == NULL) {
+            fprintf(stderr, "Error: Memory allocation error\n");
+            return 1;
+        }
+    }
+
+    if(raycast(pixels, width, height, &scene, &opts, &stats) < 0) {
+        // Do not leave a blank image behind that looks like a finished one
+        if(image.pixels != NULL) {
+            unmapImage(&image);
+            unlink(argv[3]);
+        }
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &(times.rendered));
+    if(gbufferPath != NULL && !opts.relight &&
+            gbuffer_write(&gbuffer, gbufferPath) < 0) {
         return 1;
     }
+    printSampleStats(&opts, &stats);
 
-    pnmHeader header = { 6, width, height, 255 };
+    if(hdrPath != NULL && hdr_write(&hdr, hdrPath) < 0) {
+        return 1;
+    }
 
-    if(writeHeader(header, outputFd) < 0) {
+    if(image.pixels != NULL) {
+        if(unmapImage(&image) < 0) {
+            return 1;
+        }
+    }
+    else if(toned) {
+        if(hdr_export(argv[3], &hdr, &tone, mode, maxColorSize,
+                opts.threads) < 0) {
+            return 1;
+        }
+    }
+    else if(writeImage(argv[3], header, pixels, opts.threads) < 0) {
         return 1;
     }
-    if(writeBody(header, pixels, outputFd) < 0) {
+    clock_gettime(CLOCK_MONOTONIC, &(times.written));
+    if(timed) {
+        printTimes(argv[2], width, height, &opts, &scene, &stats, &times);
+    }
+
+    if(watch && watch_run(argv[2], argv[3], &jsonObj, &scene, pixels, width,
+            height, &opts) < 0) {
         return 1;
     }
 
     return 0;
 }
+
+void printSampleStats(const renderOpts* opts, const renderStats* stats) {
+    if(opts->baseSamples > 1 || opts->maxSamples > 1) {
+        fprintf(stderr, "Anti-aliasing: %.2f samples per pixel, %zu of %zu "
+            "pixels refined\n", (double)stats->samples / stats->pixels,
+            stats->refined, stats->pixels);
+    }
+}
+
+int hasExtension(const char* path, const char* extension) {
+    size_t length = strlen(path);
+    size_t extensionLength = strlen(extension);
+
+    return length >= extensionLength &&
+        strcmp(&(path[length - extensionLength]), extension) == 0;
+}
+
+// One line of JSON on stdout, for scripts like scripts/bench.sh to collect
+void printTimes(const char* scenePath, size_t width, size_t height,
+        const renderOpts* opts, const scene* scene, const renderStats* stats,
+        const renderTimes* times) {
+    double render = seconds(&(times->compiled), &(times->rendered));
+
+    printf("{\"scene\":");
+    printJsonString(scenePath);
+    printf(",\"width\":%zu,\"height\":%zu,\"threads\":%zu,"
+        "\"objects\":%zu,\"lights\":%zu,\"parse_seconds\":%.6f,"
+        "\"compile_seconds\":%.6f,\"render_seconds\":%.6f,"
+        "\"write_seconds\":%.6f,\"wall_seconds\":%.6f,"
+        "\"primary_rays\":%zu,\"rays_per_second\":%.0f}\n", width, height,
+        opts->threads, scene->objCount, scene->lightCount,
+        seconds(&(times->start), &(times->parsed)),
+        seconds(&(times->parsed), &(times->compiled)), render,
+        seconds(&(times->rendered), &(times->written)),
+        seconds(&(times->start), &(times->written)), stats->rays,
+        render > 0 ? stats->rays / render : 0);
+    fflush(stdout);
+}
+
+double seconds(const struct timespec* start, const struct timespec* end) {
+    return (end->tv_sec - start->tv_sec) +
+        (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// text as a quoted JSON string
+void printJsonString(const char* text) {
+    putchar('"');
+    for(; *text != '\0'; text++) {
+        if(*text == '"' || *text == '\\') {
+            printf("\\%c", *text);
+        }
+        else if((unsigned char)*text < 0x20) {
+            printf("\\u%04x", (unsigned char)*text);
+        }
+        else {
+            putchar(*text);
+        }
+    }
+    putchar('"');
+}
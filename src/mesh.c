@@ -0,0 +1,189 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mesh.h"
+
+// Triangle boxes are padded by this much relative to their coordinates, and
+// the offset the rays are moved by, so rounding in the slab test can never
+// cull a hit the triangle test would report
+#define MESH_BOUNDS_EPSILON REAL_ROUNDING
+
+int mapMesh(mesh* mesh, const char* path, const uint32_t** triangles,
+    char* error);
+int buildMeshTree(mesh* mesh, const uint32_t* triangles, char* error);
+int meshError(char* error, const char* format, ...);
+
+int mesh_load(mesh* mesh, const char* path, vector3d pos, size_t obj,
+        char* error) {
+    const uint32_t* triangles;
+
+    memset(mesh, 0, sizeof(*mesh));
+    mesh->pos = pos;
+    mesh->obj = obj;
+
+    // A file mapped but then rejected is unmapped here
+    if(mapMesh(mesh, path, &triangles, error) < 0) {
+        mesh_free(mesh);
+        return -1;
+    }
+
+    for(size_t i = 0; i < 3 * mesh->faceCount; i++) {
+        if(triangles[i] >= mesh->vertexCount) {
+            meshError(error, "Mesh '%s' uses vertex %u of %zu", path,
+                triangles[i], mesh->vertexCount);
+            mesh_free(mesh);
+            return -1;
+        }
+    }
+
+    if(buildMeshTree(mesh, triangles, error) < 0) {
+        mesh_free(mesh);
+        return -1;
+    }
+
+    return 0;
+}
+
+void mesh_free(mesh* mesh) {
+    if(mesh->map != NULL) {
+        munmap(mesh->map, mesh->mapSize);
+    }
+    free(mesh->faces);
+    bvh_free(&(mesh->bvh));
+    memset(mesh, 0, sizeof(*mesh));
+}
+
+// Maps the file and points mesh->vertices and triangles into it
+int mapMesh(mesh* mesh, const char* path, const uint32_t** triangles,
+        char* error) {
+    meshHeader header;
+    struct stat info;
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return meshError(error, "Cannot open mesh '%s': %s", path,
+            strerror(errno));
+    }
+
+    if(fstat(fd, &info) < 0 || (size_t)info.st_size < sizeof(header)) {
+        close(fd);
+        return meshError(error, "'%s' is not a mesh file", path);
+    }
+
+    mesh->mapSize = info.st_size;
+    mesh->map = mmap(NULL, mesh->mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mesh->map == MAP_FAILED) {
+        mesh->map = NULL;
+        return meshError(error, "Cannot map mesh '%s': %s", path,
+            strerror(errno));
+    }
+
+    memcpy(&header, mesh->map, sizeof(header));
+    if(memcmp(header.magic, MESH_MAGIC, sizeof(header.magic)) != 0) {
+        return meshError(error, "'%s' is not a mesh file", path);
+    }
+
+    // Both counts are 32 bits, so the size cannot overflow
+    size_t expected = sizeof(header) +
+        sizeof(float) * 3 * (size_t)header.vertexCount +
+        sizeof(uint32_t) * 3 * (size_t)header.triangleCount;
+    if(mesh->mapSize != expected) {
+        return meshError(error, "Mesh '%s' should be %zu bytes but is %zu",
+            path, expected, mesh->mapSize);
+    }
+
+    mesh->vertices = (const float*)((char*)mesh->map + sizeof(header));
+    mesh->vertexCount = header.vertexCount;
+    *triangles = (const uint32_t*)(mesh->vertices + 3 * mesh->vertexCount);
+    mesh->faceCount = header.triangleCount;
+
+    return 0;
+}
+
+// Builds the tree over the triangles, then copies their corners into
+// mesh->faces in leaf order
+int buildMeshTree(mesh* mesh, const uint32_t* triangles, char* error) {
+    size_t count = mesh->faceCount;
+    real offset = real_fabs(mesh->pos.x) + real_fabs(mesh->pos.y) +
+        real_fabs(mesh->pos.z);
+
+    // An empty mesh is left with an empty tree, which nothing ever hits
+    if(count == 0) {
+        return 0;
+    }
+
+    vector3d* mins = malloc(sizeof(*mins) * count);
+    vector3d* maxs = malloc(sizeof(*maxs) * count);
+    mesh->faces = malloc(sizeof(*(mesh->faces)) * 3 * count);
+    if(mins == NULL || maxs == NULL || mesh->faces == NULL) {
+        free(mins);
+        free(maxs);
+        return meshError(error, "Memory allocation error");
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        vector3d min = mesh_vertex(mesh, triangles[3 * i]);
+        vector3d max = min;
+
+        for(size_t j = 1; j < 3; j++) {
+            vector3d vertex = mesh_vertex(mesh, triangles[3 * i + j]);
+            min.x = real_fmin(min.x, vertex.x);
+            min.y = real_fmin(min.y, vertex.y);
+            min.z = real_fmin(min.z, vertex.z);
+            max.x = real_fmax(max.x, vertex.x);
+            max.y = real_fmax(max.y, vertex.y);
+            max.z = real_fmax(max.z, vertex.z);
+        }
+
+        real pad = (real_fabs(min.x) + real_fabs(min.y) + real_fabs(min.z) +
+            real_fabs(max.x) + real_fabs(max.y) + real_fabs(max.z) + offset) *
+            MESH_BOUNDS_EPSILON;
+        vector3d extent = { pad, pad, pad };
+        mins[i] = vector3d_sub(min, extent);
+        maxs[i] = vector3d_add(max, extent);
+    }
+
+    int status = bvh_build(&(mesh->bvh), mins, maxs, count);
+    free(mins);
+    free(maxs);
+    if(status < 0) {
+        return -1;
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        memcpy(&(mesh->faces[3 * i]), &(triangles[3 * mesh->bvh.indices[i]]),
+            sizeof(*(mesh->faces)) * 3);
+    }
+    free(mesh->bvh.indices);
+    mesh->bvh.indices = NULL;
+
+    return 0;
+}
+
+// Reports a failure to error, or to stderr if it is NULL, and returns -1
+int meshError(char* error, const char* format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    if(error != NULL) {
+        vsnprintf(error, MESH_ERROR_SIZE, format, args);
+    }
+    else {
+        fprintf(stderr, "Error: ");
+        vfprintf(stderr, format, args);
+        fprintf(stderr, "\n");
+    }
+    va_end(args);
+
+    return -1;
+}
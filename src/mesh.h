@@ -0,0 +1,76 @@
+#ifndef CS430_MESH_H
+#define CS430_MESH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bvh.h"
+#include "vector3d.h"
+
+// Magic number at the start of every mesh file
+#define MESH_MAGIC "RCMESH1"
+
+// A mesh file is this header, then vertexCount vertices of three floats,
+// then triangleCount triangles of three uint32_t vertex indices, all in the
+// byte order of the machine. The vertices are used straight from the mapped
+// file, without being parsed or copied.
+typedef struct meshHeader {
+    char magic[8];
+    uint32_t vertexCount;
+    uint32_t triangleCount;
+} meshHeader;
+
+typedef struct mesh {
+    // Offset added to every vertex
+    vector3d pos;
+    // Position in the parsed objs array
+    size_t obj;
+    const float* vertices;
+    size_t vertexCount;
+    // Vertex indices of the file's triangles in BVH leaf order, so every leaf
+    // covers a contiguous run of faces. Faces are numbered in this order.
+    uint32_t* faces;
+    size_t faceCount;
+    // Built over the triangles as the file has them, before pos is added
+    bvh bvh;
+    void* map;
+    size_t mapSize;
+} mesh;
+
+// Longest error message mesh_load() keeps
+#define MESH_ERROR_SIZE 256
+
+// Maps the mesh file at path and builds its tree. On failure the reason goes
+// to error, which holds MESH_ERROR_SIZE bytes, or to stderr if error is NULL.
+int mesh_load(mesh* mesh, const char* path, vector3d pos, size_t obj,
+    char* error);
+void mesh_free(mesh* mesh);
+
+static inline vector3d mesh_vertex(const mesh* mesh, uint32_t index) {
+    const float* vertex = &(mesh->vertices[3 * (size_t)index]);
+    vector3d result = { vertex[0], vertex[1], vertex[2] };
+
+    return result;
+}
+
+// The corners of face, in mesh coordinates
+static inline void mesh_face(const mesh* mesh, size_t face, vector3d* v0,
+        vector3d* v1, vector3d* v2) {
+    const uint32_t* corners = &(mesh->faces[3 * face]);
+
+    *v0 = mesh_vertex(mesh, corners[0]);
+    *v1 = mesh_vertex(mesh, corners[1]);
+    *v2 = mesh_vertex(mesh, corners[2]);
+}
+
+// Unit normal of face, facing the side its corners wind counterclockwise on
+static inline vector3d mesh_normal(const mesh* mesh, size_t face) {
+    vector3d v0, v1, v2;
+
+    mesh_face(mesh, face, &v0, &v1, &v2);
+
+    return vector3d_normalize(vector3d_cross(vector3d_sub(v1, v0),
+        vector3d_sub(v2, v0)));
+}
+
+#endif // CS430_MESH_H
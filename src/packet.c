@@ -0,0 +1,169 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "packet.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PACKET_X86 1
+#include <immintrin.h>
+#endif
+
+#ifdef PACKET_X86
+
+// Intrinsic names for the scalar type: _pd for double, _ps for float
+#ifdef RAYCAST_FLOAT
+#define PACKET_AVX2_LANES 8
+#define PACKET_AVX512_LANES 16
+#define PACKET_TYPE(name) name##_ps
+#define PACKET_AVX2_REAL __m256
+#define PACKET_AVX512_REAL __m512
+#define PACKET_AVX512_MASK __mmask16
+#define PACKET_AVX2_ANY(m) (_mm256_movemask_ps(m) != 0)
+#define PACKET_AVX512_CMP(a, b, op) _mm512_cmp_ps_mask(a, b, op)
+#else
+#define PACKET_AVX2_LANES 4
+#define PACKET_AVX512_LANES 8
+#define PACKET_TYPE(name) name##_pd
+#define PACKET_AVX2_REAL __m256d
+#define PACKET_AVX512_REAL __m512d
+#define PACKET_AVX512_MASK __mmask8
+#define PACKET_AVX2_ANY(m) (_mm256_movemask_pd(m) != 0)
+#define PACKET_AVX512_CMP(a, b, op) _mm512_cmp_pd_mask(a, b, op)
+#endif
+
+// AVX2: 256-bit registers, comparisons produce all-ones lane masks
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+#define PACKET_LANES PACKET_AVX2_LANES
+#define PACKET_NAME(name) name##Avx2
+#define vreal PACKET_AVX2_REAL
+#define vmask PACKET_AVX2_REAL
+#define v_set1(a) PACKET_TYPE(_mm256_set1)(a)
+#define v_load(p) PACKET_TYPE(_mm256_load)(p)
+#define v_store(p, a) PACKET_TYPE(_mm256_store)(p, a)
+#define v_add(a, b) PACKET_TYPE(_mm256_add)(a, b)
+#define v_sub(a, b) PACKET_TYPE(_mm256_sub)(a, b)
+#define v_mul(a, b) PACKET_TYPE(_mm256_mul)(a, b)
+#define v_div(a, b) PACKET_TYPE(_mm256_div)(a, b)
+#define v_sqrt(a) PACKET_TYPE(_mm256_sqrt)(a)
+#define v_lt(a, b) PACKET_TYPE(_mm256_cmp)(a, b, _CMP_LT_OQ)
+#define v_le(a, b) PACKET_TYPE(_mm256_cmp)(a, b, _CMP_LE_OQ)
+#define v_gt(a, b) PACKET_TYPE(_mm256_cmp)(a, b, _CMP_GT_OQ)
+#define v_eq(a, b) PACKET_TYPE(_mm256_cmp)(a, b, _CMP_EQ_OQ)
+#define v_mand(a, b) PACKET_TYPE(_mm256_and)(a, b)
+#define v_mor(a, b) PACKET_TYPE(_mm256_or)(a, b)
+#define v_mandnot(a, b) PACKET_TYPE(_mm256_andnot)(a, b)
+#define v_any(m) PACKET_AVX2_ANY(m)
+// Lanes set in m take b, the rest keep a
+#define v_select(m, a, b) PACKET_TYPE(_mm256_blendv)(a, b, m)
+
+#include "packet_kernel.h"
+
+#undef PACKET_LANES
+#undef PACKET_NAME
+#undef vreal
+#undef vmask
+#undef v_set1
+#undef v_load
+#undef v_store
+#undef v_add
+#undef v_sub
+#undef v_mul
+#undef v_div
+#undef v_sqrt
+#undef v_lt
+#undef v_le
+#undef v_gt
+#undef v_eq
+#undef v_mand
+#undef v_mor
+#undef v_mandnot
+#undef v_any
+#undef v_select
+
+#pragma GCC pop_options
+
+// AVX-512: 512-bit registers, comparisons produce k-mask bits
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+
+#define PACKET_LANES PACKET_AVX512_LANES
+#define PACKET_NAME(name) name##Avx512
+#define vreal PACKET_AVX512_REAL
+#define vmask PACKET_AVX512_MASK
+#define v_set1(a) PACKET_TYPE(_mm512_set1)(a)
+#define v_load(p) PACKET_TYPE(_mm512_load)(p)
+#define v_store(p, a) PACKET_TYPE(_mm512_store)(p, a)
+#define v_add(a, b) PACKET_TYPE(_mm512_add)(a, b)
+#define v_sub(a, b) PACKET_TYPE(_mm512_sub)(a, b)
+#define v_mul(a, b) PACKET_TYPE(_mm512_mul)(a, b)
+#define v_div(a, b) PACKET_TYPE(_mm512_div)(a, b)
+#define v_sqrt(a) PACKET_TYPE(_mm512_sqrt)(a)
+#define v_lt(a, b) PACKET_AVX512_CMP(a, b, _CMP_LT_OQ)
+#define v_le(a, b) PACKET_AVX512_CMP(a, b, _CMP_LE_OQ)
+#define v_gt(a, b) PACKET_AVX512_CMP(a, b, _CMP_GT_OQ)
+#define v_eq(a, b) PACKET_AVX512_CMP(a, b, _CMP_EQ_OQ)
+#define v_mand(a, b) ((vmask)((a) & (b)))
+#define v_mor(a, b) ((vmask)((a) | (b)))
+#define v_mandnot(a, b) ((vmask)(~(a) & (b)))
+#define v_any(m) ((m) != 0)
+// Lanes set in m take b, the rest keep a
+#define v_select(m, a, b) PACKET_TYPE(_mm512_mask_blend)(m, a, b)
+
+#include "packet_kernel.h"
+
+#pragma GCC pop_options
+
+#endif // PACKET_X86
+
+size_t packet_lanes(void) {
+    static size_t lanes = 0;
+    if(lanes != 0) {
+        return lanes;
+    }
+
+    lanes = 1;
+#ifdef PACKET_X86
+    const char* limit = getenv("RAYCAST_PACKET");
+    int allowAvx512 = limit == NULL || strcmp(limit, "avx512") == 0;
+    int allowAvx2 = allowAvx512 || strcmp(limit, "avx2") == 0;
+
+    if(limit != NULL && !allowAvx2 && strcmp(limit, "off") != 0) {
+        fprintf(stderr, "Warning: Unknown RAYCAST_PACKET '%s', packets "
+            "disabled\n", limit);
+    }
+
+    __builtin_cpu_init();
+    if(allowAvx512 && __builtin_cpu_supports("avx512f")) {
+        lanes = PACKET_AVX512_LANES;
+    }
+    else if(allowAvx2 && __builtin_cpu_supports("avx2")) {
+        lanes = PACKET_AVX2_LANES;
+    }
+#endif
+
+    return lanes;
+}
+
+void packet_shoot(const rayPacket* packet, const scene* scene, shootObj* hits) {
+#ifdef PACKET_X86
+    switch(packet_lanes()) {
+        case(PACKET_AVX512_LANES):
+            packetShootAvx512(packet, scene, hits);
+            return;
+        case(PACKET_AVX2_LANES):
+            packetShootAvx2(packet, scene, hits);
+            return;
+    }
+#endif
+    (void)packet;
+    (void)scene;
+    (void)hits;
+    fprintf(stderr, "Error: Ray packets not supported on this machine\n");
+    exit(EXIT_FAILURE);
+}
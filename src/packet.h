@@ -0,0 +1,45 @@
+#ifndef CS430_PACKET_H
+#define CS430_PACKET_H
+
+#include <stddef.h>
+
+#include "raycast.h"
+#include "scene.h"
+
+// Widest packet any kernel uses (one AVX-512 register of reals)
+#ifdef RAYCAST_FLOAT
+#define PACKET_MAX 16
+#else
+#define PACKET_MAX 8
+#endif
+
+// Kernels carry object and face indices in real lanes, which hold every integer up to
+// this exactly. Larger scenes have to use the scalar path.
+#ifdef RAYCAST_FLOAT
+#define PACKET_MAX_OBJS ((size_t)1 << 24)
+#else
+#define PACKET_MAX_OBJS ((size_t)1 << 53)
+#endif
+
+// A bundle of primary rays, which all share the camera origin at
+// { 0, 0, 0 }. Directions are split per axis so a kernel can load each axis
+// straight into a register.
+typedef struct rayPacket {
+    vector3d origin;
+    _Alignas(64) real dirX[PACKET_MAX];
+    _Alignas(64) real dirY[PACKET_MAX];
+    _Alignas(64) real dirZ[PACKET_MAX];
+} rayPacket;
+
+// Number of rays packet_shoot() traces at once on this machine: 8 with
+// AVX-512, 4 with AVX2 and 1 (use the scalar shoot()) otherwise, or twice
+// that in the float build. The
+// RAYCAST_PACKET environment variable ("avx512", "avx2" or "off") can lower
+// the choice, e.g. to compare the paths.
+size_t packet_lanes(void);
+
+// Closest hit for every lane, identical to calling shoot() once per ray.
+// Only the first packet_lanes() lanes are traced.
+void packet_shoot(const rayPacket* packet, const scene* scene, shootObj* hits);
+
+#endif // CS430_PACKET_H
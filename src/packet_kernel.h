@@ -0,0 +1,302 @@
+// Packet kernels, written once against the v_* macros and included by
+// packet.c for every instruction set it supports. Not a normal header: the
+// includer defines PACKET_LANES, PACKET_NAME() and the v_* operations first.
+//
+// Every kernel performs the same operations in the same order as its scalar
+// counterpart in raycast.c, so results match it bit for bit.
+
+// sphere_intersection() for every lane against one sphere
+static inline vreal PACKET_NAME(sphereKernel)(vector3d origin, vreal dirX,
+        vreal dirY, vreal dirZ, vector3d pos, real radius) {
+    vreal originX = v_set1(origin.x);
+    vreal originY = v_set1(origin.y);
+    vreal originZ = v_set1(origin.z);
+    vreal posX = v_set1(pos.x);
+    vreal posY = v_set1(pos.y);
+    vreal posZ = v_set1(pos.z);
+    vreal rad = v_set1(radius);
+
+    vreal t = v_add(v_add(
+        v_mul(dirX, v_set1(pos.x - origin.x)),
+        v_mul(dirY, v_set1(pos.y - origin.y))),
+        v_mul(dirZ, v_set1(pos.z - origin.z)));
+
+    vreal diffX = v_sub(v_add(originX, v_mul(dirX, t)), posX);
+    vreal diffY = v_sub(v_add(originY, v_mul(dirY, t)), posY);
+    vreal diffZ = v_sub(v_add(originZ, v_mul(dirZ, t)), posZ);
+    vreal magnitude = v_sqrt(v_add(v_add(v_mul(diffX, diffX),
+        v_mul(diffY, diffY)), v_mul(diffZ, diffZ)));
+
+    vreal a = v_sqrt(v_sub(v_mul(rad, rad), v_mul(magnitude, magnitude)));
+
+    vreal result = v_select(v_lt(magnitude, rad), t, v_sub(t, a));
+    return v_select(v_gt(magnitude, rad), result, v_set1(-1));
+}
+
+// plane_primary() for every lane against one plane. The numerator is the
+// baked n . p for rays leaving the camera origin.
+static inline vreal PACKET_NAME(planeKernel)(vreal dirX, vreal dirY,
+        vreal dirZ, vector3d normal, real nDotP) {
+    vreal denominator = v_add(v_add(
+        v_mul(v_set1(normal.x), dirX),
+        v_mul(v_set1(normal.y), dirY)),
+        v_mul(v_set1(normal.z), dirZ));
+
+    vreal t = v_div(v_set1(nDotP), denominator);
+    vmask valid = v_mandnot(v_eq(denominator, v_set1(0)),
+        v_gt(t, v_set1(0)));
+
+    return v_select(valid, v_set1(-1), t);
+}
+
+// The slab test of bvh_hitBox() for every lane. Lanes that hit are set in the
+// returned mask and their entry distance is stored in near.
+static inline vmask PACKET_NAME(boxKernel)(const bvhNode* node,
+        vector3d origin, vreal invX, vreal invY, vreal invZ, vreal tMax,
+        vreal* near) {
+    vreal nearest = v_set1(0);
+    vreal farthest = tMax;
+    vreal t0, t1, low, high;
+
+#define PACKET_SLAB(axis, inv) \
+    t0 = v_mul(v_set1(node->min.axis - origin.axis), inv); \
+    t1 = v_mul(v_set1(node->max.axis - origin.axis), inv); \
+    low = v_select(v_gt(t0, t1), t0, t1); \
+    high = v_select(v_gt(t0, t1), t1, t0); \
+    nearest = v_select(v_gt(low, nearest), nearest, low); \
+    farthest = v_select(v_lt(high, farthest), farthest, high);
+
+    PACKET_SLAB(x, invX)
+    PACKET_SLAB(y, invY)
+    PACKET_SLAB(z, invZ)
+#undef PACKET_SLAB
+
+    *near = nearest;
+
+    return v_le(nearest, farthest);
+}
+
+// triangle_intersection() for every lane against one triangle. Primary rays
+// share their origin, so everything that depends only on it and the
+// triangle is worked out once: s = origin - v0 and q = s x edge1.
+static inline vreal PACKET_NAME(triangleKernel)(vreal dirX, vreal dirY,
+        vreal dirZ, vector3d origin, vector3d v0, vector3d v1, vector3d v2) {
+    vector3d edge1 = vector3d_sub(v1, v0);
+    vector3d edge2 = vector3d_sub(v2, v0);
+    vector3d s = vector3d_sub(origin, v0);
+    vector3d q = vector3d_cross(s, edge1);
+
+    vreal pX = v_sub(v_mul(dirY, v_set1(edge2.z)), v_mul(dirZ, v_set1(edge2.y)));
+    vreal pY = v_sub(v_mul(dirZ, v_set1(edge2.x)), v_mul(dirX, v_set1(edge2.z)));
+    vreal pZ = v_sub(v_mul(dirX, v_set1(edge2.y)), v_mul(dirY, v_set1(edge2.x)));
+    vreal det = v_add(v_add(
+        v_mul(v_set1(edge1.x), pX),
+        v_mul(v_set1(edge1.y), pY)),
+        v_mul(v_set1(edge1.z), pZ));
+    vreal inverse = v_div(v_set1(1), det);
+
+    vreal u = v_mul(v_add(v_add(
+        v_mul(v_set1(s.x), pX),
+        v_mul(v_set1(s.y), pY)),
+        v_mul(v_set1(s.z), pZ)), inverse);
+    vreal v = v_mul(v_add(v_add(
+        v_mul(dirX, v_set1(q.x)),
+        v_mul(dirY, v_set1(q.y))),
+        v_mul(dirZ, v_set1(q.z))), inverse);
+    vreal t = v_mul(v_set1(vector3d_dot(edge2, q)), inverse);
+
+    vreal zero = v_set1(0);
+    vreal one = v_set1(1);
+    vmask valid = v_mandnot(v_eq(det, zero), v_mand(
+        v_mand(v_le(zero, u), v_le(u, one)),
+        v_mand(v_mand(v_le(zero, v), v_le(v_add(u, v), one)),
+        v_gt(t, zero))));
+
+    return v_select(valid, v_set1(-1), t);
+}
+
+// Pushes the children of an inner node that some lane still enters, the one
+// some lane enters earliest on top
+static inline void PACKET_NAME(pushChildren)(const bvhNode* nodes,
+        const bvhNode* node, vector3d origin, vreal invX, vreal invY,
+        vreal invZ, vreal tMax, size_t* stack, size_t* depth) {
+    size_t first = node->first;
+    size_t second = node->first + 1;
+    vreal near, farNear;
+    _Alignas(64) real nearLanes[PACKET_LANES];
+    vmask hitFirst = PACKET_NAME(boxKernel)(&(nodes[first]), origin, invX,
+        invY, invZ, tMax, &near);
+    vmask hitSecond = PACKET_NAME(boxKernel)(&(nodes[second]), origin, invX,
+        invY, invZ, tMax, &farNear);
+
+    if(v_any(hitFirst) && v_any(hitSecond)) {
+        real firstNear = INFINITY, secondNear = INFINITY;
+
+        v_store(nearLanes, v_select(hitFirst, v_set1(INFINITY), near));
+        for(size_t lane = 0; lane < PACKET_LANES; lane++) {
+            firstNear = nearLanes[lane] < firstNear ? nearLanes[lane] :
+                firstNear;
+        }
+        v_store(nearLanes, v_select(hitSecond, v_set1(INFINITY), farNear));
+        for(size_t lane = 0; lane < PACKET_LANES; lane++) {
+            secondNear = nearLanes[lane] < secondNear ? nearLanes[lane] :
+                secondNear;
+        }
+
+        if(secondNear < firstNear) {
+            stack[(*depth)++] = first;
+            stack[(*depth)++] = second;
+        }
+        else {
+            stack[(*depth)++] = second;
+            stack[(*depth)++] = first;
+        }
+    }
+    else if(v_any(hitFirst)) {
+        stack[(*depth)++] = first;
+    }
+    else if(v_any(hitSecond)) {
+        stack[(*depth)++] = second;
+    }
+}
+
+static void PACKET_NAME(packetShoot)(const rayPacket* packet,
+        const scene* scene, shootObj* hits) {
+    const sphereArray* spheres = &(scene->spheres);
+    const planeArray* planes = &(scene->planes);
+    vector3d origin = packet->origin;
+    vreal dirX = v_load(packet->dirX);
+    vreal dirY = v_load(packet->dirY);
+    vreal dirZ = v_load(packet->dirZ);
+    vreal invX = v_div(v_set1(1), dirX);
+    vreal invY = v_div(v_set1(1), dirY);
+    vreal invZ = v_div(v_set1(1), dirZ);
+    vreal zero = v_set1(0);
+    size_t stack[BVH_STACK_SIZE];
+    size_t depth = 0;
+    vreal near;
+
+    // Object, primitive and face indices ride along as reals, which hold
+    // them exactly below PACKET_MAX_OBJS and let the tie-break compare in the
+    // same registers as t
+    vreal closestValue = v_set1(INFINITY);
+    vreal closestObj = v_set1(-1);
+    vreal closestType = v_set1(0);
+    vreal closestPrim = v_set1(0);
+    vreal closestFace = v_set1(0);
+    vreal t, index, face;
+    vmask update;
+
+#define PACKET_UPDATE(objIndex, type, prim) \
+    index = v_set1((real)(objIndex)); \
+    update = v_mand(v_gt(t, zero), v_mor(v_lt(t, closestValue), \
+        v_mand(v_eq(t, closestValue), v_lt(index, closestObj)))); \
+    closestValue = v_select(update, closestValue, t); \
+    closestObj = v_select(update, closestObj, index); \
+    closestType = v_select(update, closestType, v_set1(type)); \
+    closestPrim = v_select(update, closestPrim, v_set1((real)(prim))); \
+    closestFace = v_select(update, closestFace, zero);
+
+    for(size_t i = 0; i < planes->count; i++) {
+        vector3d normal = { planes->normalX[i], planes->normalY[i],
+            planes->normalZ[i] };
+
+        t = PACKET_NAME(planeKernel)(dirX, dirY, dirZ, normal, planes->nDotP[i]);
+        PACKET_UPDATE(planes->obj[i], HIT_PLANE, i)
+    }
+
+    // Same walk as the spheres below, in mesh coordinates and with ties on
+    // the same mesh going to the lowest face
+    for(size_t m = 0; m < scene->meshCount; m++) {
+        const mesh* mesh = &(scene->meshes[m]);
+        const bvhNode* nodes = mesh->bvh.nodes;
+        vector3d meshOrigin = vector3d_sub(origin, mesh->pos);
+
+        if(mesh->bvh.count == 0 || !v_any(PACKET_NAME(boxKernel)(&(nodes[0]),
+                meshOrigin, invX, invY, invZ, closestValue, &near))) {
+            continue;
+        }
+        stack[depth++] = 0;
+
+        while(depth > 0) {
+            const bvhNode* node = &(nodes[stack[--depth]]);
+
+            if(node->count == 0) {
+                PACKET_NAME(pushChildren)(nodes, node, meshOrigin, invX, invY,
+                    invZ, closestValue, stack, &depth);
+                continue;
+            }
+
+            for(size_t i = node->first; i < node->first + node->count; i++) {
+                vector3d v0, v1, v2;
+
+                mesh_face(mesh, i, &v0, &v1, &v2);
+                t = PACKET_NAME(triangleKernel)(dirX, dirY, dirZ, meshOrigin,
+                    v0, v1, v2);
+                index = v_set1((real)mesh->obj);
+                face = v_set1((real)i);
+                update = v_mand(v_gt(t, zero), v_mor(v_lt(t, closestValue),
+                    v_mand(v_eq(t, closestValue), v_mor(v_lt(index, closestObj),
+                    v_mand(v_eq(index, closestObj), v_lt(face, closestFace))))));
+                closestValue = v_select(update, closestValue, t);
+                closestObj = v_select(update, closestObj, index);
+                closestType = v_select(update, closestType, v_set1(HIT_MESH));
+                closestPrim = v_select(update, closestPrim, v_set1((real)m));
+                closestFace = v_select(update, closestFace, face);
+            }
+        }
+    }
+
+    if(scene->bvh.count > 0) {
+        const bvhNode* nodes = scene->bvh.nodes;
+
+        if(v_any(PACKET_NAME(boxKernel)(&(nodes[0]), origin, invX, invY, invZ,
+                closestValue, &near))) {
+            stack[depth++] = 0;
+        }
+
+        while(depth > 0) {
+            const bvhNode* node = &(nodes[stack[--depth]]);
+
+            if(node->count > 0) {
+                for(size_t i = node->first; i < node->first + node->count; i++) {
+                    vector3d pos = { spheres->x[i], spheres->y[i],
+                        spheres->z[i] };
+
+                    t = PACKET_NAME(sphereKernel)(origin, dirX, dirY, dirZ,
+                        pos, spheres->radius[i]);
+                    PACKET_UPDATE(spheres->obj[i], HIT_SPHERE, i)
+                }
+                continue;
+            }
+
+            PACKET_NAME(pushChildren)(nodes, node, origin, invX, invY, invZ,
+                closestValue, stack, &depth);
+        }
+    }
+#undef PACKET_UPDATE
+
+    _Alignas(64) real values[PACKET_LANES];
+    _Alignas(64) real objs[PACKET_LANES];
+    _Alignas(64) real types[PACKET_LANES];
+    _Alignas(64) real prims[PACKET_LANES];
+    _Alignas(64) real faces[PACKET_LANES];
+    v_store(values, closestValue);
+    v_store(objs, closestObj);
+    v_store(types, closestType);
+    v_store(prims, closestPrim);
+    v_store(faces, closestFace);
+
+    for(size_t lane = 0; lane < PACKET_LANES; lane++) {
+        shootObj hit = { 0 };
+        if(objs[lane] >= 0) {
+            hit.t = values[lane];
+            hit.obj = (size_t)objs[lane];
+            hit.type = (int)types[lane];
+            hit.prim = (size_t)prims[lane];
+            hit.face = (size_t)faces[lane];
+            hit.hit = 1;
+        }
+        hits[lane] = hit;
+    }
+}
@@ -27,7 +27,7 @@ typedef struct pixel {
     unsigned char blue;
 } pixel;
 
-static inline double clamp(double value, double min, double max) {
+static inline real clamp(real value, real min, real max) {
     if(value < min) {
         return min;
     }
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "qoi.h"
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xC0
+#define QOI_OP_RGB 0xFE
+// Longest run one QOI_OP_RUN can hold
+#define QOI_MAX_RUN 62
+// Most bytes a pixel can take, as QOI_OP_RGB
+#define QOI_PIXEL_MAX 4
+
+int ensureBuffer(qoiEncoder* encoder, size_t size);
+unsigned char* flushRun(qoiEncoder* encoder, unsigned char* cursor);
+size_t qoiHash(pixel pixel);
+void putUint32(unsigned char* bytes, size_t value);
+
+int qoi_begin(qoiEncoder* encoder, FILE* output, size_t width,
+        size_t height) {
+    unsigned char header[14];
+
+    memset(encoder, 0, sizeof(*encoder));
+    encoder->output = output;
+
+    if(width > QOI_MAX_SIZE || height > QOI_MAX_SIZE) {
+        fprintf(stderr, "Error: QOI images can be at most %u pixels wide "
+            "and high\n", QOI_MAX_SIZE);
+        return -1;
+    }
+
+    memcpy(header, QOI_MAGIC, 4);
+    putUint32(&(header[4]), width);
+    putUint32(&(header[8]), height);
+    // RGB, in the sRGB color space
+    header[12] = 3;
+    header[13] = 0;
+    if(fwrite(header, sizeof(header), 1, output) != 1) {
+        perror("Error: Cannot write output file\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int qoi_encode(qoiEncoder* encoder, const pixel* pixels, size_t count) {
+    if(ensureBuffer(encoder, QOI_PIXEL_MAX * count + 1) < 0) {
+        return -1;
+    }
+
+    unsigned char* cursor = encoder->buffer;
+    for(size_t i = 0; i < count; i++) {
+        pixel current = pixels[i];
+        pixel previous = encoder->previous;
+
+        if(memcmp(&current, &previous, sizeof(current)) == 0) {
+            if(++(encoder->run) == QOI_MAX_RUN) {
+                cursor = flushRun(encoder, cursor);
+            }
+            continue;
+        }
+        cursor = flushRun(encoder, cursor);
+
+        size_t hash = qoiHash(current);
+        if(encoder->indexed[hash] && memcmp(&(encoder->index[hash]), &current,
+                sizeof(current)) == 0) {
+            *(cursor++) = QOI_OP_INDEX | hash;
+        }
+        else {
+            signed char dr = (signed char)(current.red - previous.red);
+            signed char dg = (signed char)(current.green - previous.green);
+            signed char db = (signed char)(current.blue - previous.blue);
+            signed char drg = dr - dg;
+            signed char dbg = db - dg;
+
+            encoder->index[hash] = current;
+            encoder->indexed[hash] = 1;
+            if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 &&
+                    db <= 1) {
+                *(cursor++) = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 |
+                    (db + 2);
+            }
+            else if(dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 &&
+                    dbg >= -8 && dbg <= 7) {
+                *(cursor++) = QOI_OP_LUMA | (dg + 32);
+                *(cursor++) = (drg + 8) << 4 | (dbg + 8);
+            }
+            else {
+                *(cursor++) = QOI_OP_RGB;
+                *(cursor++) = current.red;
+                *(cursor++) = current.green;
+                *(cursor++) = current.blue;
+            }
+        }
+        encoder->previous = current;
+    }
+
+    size_t size = cursor - encoder->buffer;
+    if(fwrite(encoder->buffer, 1, size, encoder->output) != size) {
+        perror("Error: Cannot write output file\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int qoi_end(qoiEncoder* encoder) {
+    static const unsigned char end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    int status = 0;
+
+    if(ensureBuffer(encoder, 1) < 0) {
+        status = -1;
+    }
+    else {
+        size_t size = flushRun(encoder, encoder->buffer) - encoder->buffer;
+        if(fwrite(encoder->buffer, 1, size, encoder->output) != size ||
+                fwrite(end, sizeof(end), 1, encoder->output) != 1) {
+            perror("Error: Cannot write output file\n");
+            status = -1;
+        }
+    }
+
+    free(encoder->buffer);
+    encoder->buffer = NULL;
+    encoder->bufferSize = 0;
+
+    return status;
+}
+
+int qoi_writeImage(const char* path, size_t width, size_t height,
+        const pixel* pixels) {
+    qoiEncoder encoder;
+    FILE* outputFd;
+
+    if((outputFd = fopen(path, "wb")) == NULL) {
+        perror("Error: Cannot open output file\n");
+        return -1;
+    }
+
+    if(qoi_begin(&encoder, outputFd, width, height) < 0 ||
+            qoi_encode(&encoder, pixels, width * height) < 0 ||
+            qoi_end(&encoder) < 0) {
+        free(encoder.buffer);
+        fclose(outputFd);
+        return -1;
+    }
+
+    if(fclose(outputFd) != 0) {
+        perror("Error: Cannot write output file\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int ensureBuffer(qoiEncoder* encoder, size_t size) {
+    if(size <= encoder->bufferSize) {
+        return 0;
+    }
+
+    unsigned char* buffer = realloc(encoder->buffer, size);
+    if(buffer == NULL) {
+        fprintf(stderr, "Error: Memory allocation error\n");
+        return -1;
+    }
+    encoder->buffer = buffer;
+    encoder->bufferSize = size;
+
+    return 0;
+}
+
+// Writes the pending run, if any, at cursor and returns the new end
+unsigned char* flushRun(qoiEncoder* encoder, unsigned char* cursor) {
+    if(encoder->run > 0) {
+        *(cursor++) = QOI_OP_RUN | (encoder->run - 1);
+        encoder->run = 0;
+    }
+
+    return cursor;
+}
+
+// Position of a color in the index. Every pixel is opaque, so alpha is 255.
+size_t qoiHash(pixel pixel) {
+    return (pixel.red * 3 + pixel.green * 5 + pixel.blue * 7 + 255 * 11) % 64;
+}
+
+// Most significant byte first
+void putUint32(unsigned char* bytes, size_t value) {
+    bytes[0] = value >> 24 & 0xFF;
+    bytes[1] = value >> 16 & 0xFF;
+    bytes[2] = value >> 8 & 0xFF;
+    bytes[3] = value & 0xFF;
+}
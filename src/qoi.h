@@ -0,0 +1,45 @@
+#ifndef CS430_QOI_H
+#define CS430_QOI_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "pnm.h"
+
+// Magic number at the start of every QOI file
+#define QOI_MAGIC "qoif"
+// QOI stores sizes as 32-bit integers
+#define QOI_MAX_SIZE 0xFFFFFFFFu
+
+// State of a QOI stream being written. Pixels can be fed in any number of
+// calls, like the rows of a frame as they are rendered, and each call
+// continues where the last one stopped.
+typedef struct qoiEncoder {
+    FILE* output;
+    // Recently seen colors, by QOI's hash of them. The decoder starts with
+    // transparent black in every slot, which no opaque pixel matches, so
+    // slots only count once indexed is set.
+    pixel index[64];
+    unsigned char indexed[64];
+    // The decoder starts from opaque black, as a zeroed pixel is
+    pixel previous;
+    // Repeats of previous not written yet
+    size_t run;
+    // Encoded bytes of the current call
+    unsigned char* buffer;
+    size_t bufferSize;
+} qoiEncoder;
+
+// Writes the QOI header for an RGB image to output
+int qoi_begin(qoiEncoder* encoder, FILE* output, size_t width,
+    size_t height);
+// Encodes the next count pixels, in row-major order, and writes them out
+int qoi_encode(qoiEncoder* encoder, const pixel* pixels, size_t count);
+// Writes the final run and the end marker. Does not close output.
+int qoi_end(qoiEncoder* encoder);
+
+// Writes a whole image to path
+int qoi_writeImage(const char* path, size_t width, size_t height,
+    const pixel* pixels);
+
+#endif // CS430_QOI_H
@@ -1,42 +1,446 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <math.h>
 #include <string.h>
 
-#define PI 3.14159265358979323846
-
 #include "vector3d.h"
 #include "raycast.h"
+#include "packet.h"
+#include "scheduler.h"
+
+// The object that last blocked a light. Neighbouring pixels are usually
+// shadowed by the same object, so it is worth testing before the rest.
+typedef struct shadowCache {
+    // HIT_SPHERE, HIT_PLANE or HIT_MESH, or SHADOW_CACHE_EMPTY
+    int type;
+    size_t prim;
+    // The face that blocked the light, for meshes
+    size_t face;
+} shadowCache;
+
+#define SHADOW_CACHE_EMPTY -1
+
+typedef struct renderCtx {
+    // Rows of the frame from firstRow on
+    pixel* pixels;
+    size_t width;
+    size_t height;
+    size_t firstRow;
+    const scene* scene;
+    const renderOpts* opts;
+    // Rays per packet_shoot() call, or 1 for the scalar path
+    size_t lanes;
+    // lightCount entries per thread, or NULL when the cache is off
+    shadowCache* caches;
+    // DEFAULT_TILE_SIZE^2 entries per thread, or NULL unless adaptive
+    struct adaptiveSample* samples;
+    // SUPERSAMPLE_STRIDE^2 entries per thread, or NULL unless anti-aliasing
+    struct pixelSamples* pixelSamples;
+    // Per-thread totals, summed into the caller's stats at the end
+    renderStats* threadStats;
+    // When relighting, the lights whose saved shadows are still valid
+    uint64_t knownLights;
+} renderCtx;
+
+// A pixel traced by the adaptive pass, in tile-relative coordinates
+typedef struct adaptiveSample {
+    // Clamped color before conversion to a pixel
+    vector3d color;
+    // The color before clamping, for opts->hdr
+    vector3d radiance;
+    size_t obj;
+    // Bit i is set when light i is blocked. Lights past the 63rd share the
+    // last bit, which the center probe of refineBlock() still backs up.
+    uint64_t shadowMask;
+    int hit;
+    int traced;
+} adaptiveSample;
+
+typedef struct adaptiveTile {
+    renderCtx* ctx;
+    tile tile;
+    adaptiveSample* samples;
+    shadowCache* cache;
+    // Counts the pixels actually traced
+    renderStats* stats;
+} adaptiveTile;
+
+// Running sums over the samples taken for one pixel
+typedef struct pixelSamples {
+    vector3d color;
+    // Of the colors before clamping, for opts->hdr
+    vector3d radiance;
+    real luminance;
+    real luminanceSquared;
+    size_t count;
+    // Mean luminance of the base samples, which neighbours contrast against
+    real baseMean;
+} pixelSamples;
+
+// A tile plus a one pixel ring, so pixels on the tile edge have neighbours
+#define SUPERSAMPLE_STRIDE (DEFAULT_TILE_SIZE + 2)
+
+// R2 sequence constants, 1 / g and 1 / g^2 for the plastic number g
+#define R2_X 0.75487766624669276
+#define R2_Y 0.56984029099805327
+
+real sphere_intersection(ray ray, vector3d pos, real radius);
+real sphere_primary(vector3d dir, vector3d pos, real radius,
+    real originC);
+real plane_intersection(ray ray, vector3d pos, vector3d normal);
+real plane_primary(vector3d dir, vector3d normal, real nDotP);
+real triangle_intersection(ray ray, vector3d v0, vector3d v1, vector3d v2);
+real face_intersection(ray ray, const mesh* mesh, size_t face);
+real cylinder_intersection(ray ray, sceneObj* obj);
+
+void renderTile(tile tile, size_t threadId, void* data);
+void renderPacketRow(renderCtx* ctx, vector3d point, size_t start, size_t end,
+    size_t y, shadowCache* cache);
+
+shootObj shoot(ray ray, const scene* scene);
+void shootMesh(ray ray, const mesh* mesh, size_t index, shootObj* closest,
+    real* closestValue);
+void storePixel(const renderCtx* ctx, size_t x, size_t y, vector3d color,
+    vector3d radiance);
+void storeRadiance(const renderCtx* ctx, size_t x, size_t y,
+    vector3d radiance);
+vector3d shadeColor(ray ray, vector3d intersection, shootObj closest,
+    const scene* scene, shadowCache* cache, uint64_t* shadowMask);
+vector3d shadeSurface(ray ray, vector3d intersection, vector3d normal,
+    size_t obj, const scene* scene, shadowCache* cache, uint64_t known,
+    uint64_t* shadowMask);
+
+void renderRelightTile(renderCtx* ctx, tile tile, shadowCache* cache);
+vector3d shadeAndRecord(renderCtx* ctx, size_t index, ray ray,
+    shootObj closest, shadowCache* cache);
+
+void renderAdaptiveTile(renderCtx* ctx, tile tile, adaptiveSample* samples,
+    shadowCache* cache, renderStats* stats);
+void refineBlock(adaptiveTile* block, size_t x0, size_t y0, size_t x1,
+    size_t y1);
+adaptiveSample* traceSample(adaptiveTile* block, size_t x, size_t y);
+vector3d blendCorners(const adaptiveTile* block, size_t x0, size_t y0,
+    size_t x1, size_t y1, size_t x, size_t y, int radiance);
+int sameSample(const adaptiveSample* first, const adaptiveSample* second);
+vector3d primaryDir(const renderCtx* ctx, size_t x, size_t y, real offsetX,
+    real offsetY);
+
+void renderSupersampledTile(renderCtx* ctx, tile tile, pixelSamples* samples,
+    shadowCache* cache, renderStats* stats);
+void addSamples(const renderCtx* ctx, pixelSamples* samples, size_t x,
+    size_t y, size_t count, shadowCache* cache);
+real sampleVariance(const pixelSamples* samples);
+
+vector3d getIntersection(ray ray, real t);
+vector3d getNormal(vector3d intersection, shootObj closest, const scene* scene);
+vector3d getColor(ray ray, vector3d intersection, vector3d normal,
+    vector3d toLight, real distance, const material* material,
+    const bakedLight* light);
+int inShadow(vector3d intersection, vector3d toLight, real distance,
+    const scene* scene, size_t exclude, shadowCache* cache);
+int occludes(ray ray, real distance, const scene* scene, size_t exclude,
+    const shadowCache* cached);
+int meshOccludes(ray ray, real distance, const mesh* mesh, size_t* face);
+real getRadialAtten(real distance, const bakedLight* light);
+real getAngularAtten(vector3d intersection, const bakedLight* light);
+vector3d getDiffuse(vector3d normal, vector3d toLight,
+    const material* material, const bakedLight* light);
+vector3d getSpecular(ray ray, vector3d normal, vector3d toLight,
+    const material* material, const bakedLight* light);
+
+// The frame pixel at x, y, which has to lie in the band ctx->pixels holds
+static inline pixel* framePixel(const renderCtx* ctx, size_t x, size_t y) {
+    return &(ctx->pixels[(y - ctx->firstRow) * ctx->width + x]);
+}
+
+static inline vector3d spherePos(const sphereArray* spheres, size_t i) {
+    vector3d pos = { spheres->x[i], spheres->y[i], spheres->z[i] };
+
+    return pos;
+}
+
+static inline vector3d planePos(const planeArray* planes, size_t i) {
+    vector3d pos = { planes->x[i], planes->y[i], planes->z[i] };
+
+    return pos;
+}
+
+static inline vector3d planeNormal(const planeArray* planes, size_t i) {
+    vector3d normal = { planes->normalX[i], planes->normalY[i],
+        planes->normalZ[i] };
+
+    return normal;
+}
+
+void renderOpts_init(renderOpts* opts) {
+    opts->threads = 1;
+    opts->shadowCache = SHADOW_CACHE_THREAD;
+    opts->adaptive = 0;
+    opts->quality = DEFAULT_QUALITY;
+    opts->baseSamples = 1;
+    opts->maxSamples = 1;
+    opts->variance = DEFAULT_VARIANCE;
+    opts->gbuffer = NULL;
+    opts->relight = 0;
+    opts->hdr = NULL;
+    opts->dirty = NULL;
+    opts->firstRow = 0;
+    opts->rows = 0;
+}
+
+int renderOpts_shadowCache(const char* value, int* mode) {
+    if(strcmp(value, "off") == 0) {
+        *mode = SHADOW_CACHE_OFF;
+    }
+    else if(strcmp(value, "thread") == 0) {
+        *mode = SHADOW_CACHE_THREAD;
+    }
+    else if(strcmp(value, "tile") == 0) {
+        *mode = SHADOW_CACHE_TILE;
+    }
+    else {
+        fprintf(stderr, "Error: Unknown shadow cache mode '%s'\n", value);
+        return -1;
+    }
+
+    return 0;
+}
+
+int renderOpts_adaptive(const char* value, size_t* size) {
+    char* endptr;
+    size_t blockSize = strtoul(value, &endptr, 10);
+    if(!(*value != '\0' && *endptr == '\0') || blockSize == 1 ||
+            blockSize > DEFAULT_TILE_SIZE) {
+        fprintf(stderr, "Error: Adaptive block size must be 0 or between 2 "
+            "and %d\n", DEFAULT_TILE_SIZE);
+        return -1;
+    }
+
+    *size = blockSize;
+
+    return 0;
+}
+
+int renderOpts_quality(const char* value, real* quality) {
+    char* endptr;
+    double levels = strtod(value, &endptr);
+    if(!(*value != '\0' && *endptr == '\0') || !(levels >= 0)) {
+        fprintf(stderr, "Error: Quality must be a number of levels >= 0\n");
+        return -1;
+    }
+
+    *quality = levels;
+
+    return 0;
+}
+
+int renderOpts_samples(const char* value, size_t* samples) {
+    char* endptr;
+    size_t count = strtoul(value, &endptr, 10);
+    if(!(*value != '\0' && *endptr == '\0') || count < 1 ||
+            count > MAX_SAMPLES) {
+        fprintf(stderr, "Error: Samples per pixel must be between 1 and %d\n",
+            MAX_SAMPLES);
+        return -1;
+    }
+
+    *samples = count;
+
+    return 0;
+}
+
+int renderOpts_variance(const char* value, real* variance) {
+    char* endptr;
+    double threshold = strtod(value, &endptr);
+    if(!(*value != '\0' && *endptr == '\0') || !(threshold >= 0)) {
+        fprintf(stderr, "Error: Variance threshold must be >= 0\n");
+        return -1;
+    }
+
+    *variance = threshold;
+
+    return 0;
+}
+
+int raycast(pixel* pixels, size_t width, size_t height, const scene* scene,
+        const renderOpts* opts, renderStats* stats) {
+    renderCtx ctx = { pixels, width, height, opts->firstRow, scene, opts,
+        packet_lanes(), NULL, NULL, NULL, NULL, 0 };
+    size_t rows = opts->rows > 0 ? opts->rows : height;
+    size_t count;
+    int supersample = opts->maxSamples > 1 || opts->baseSamples > 1;
+
+    if(opts->rows > 0 && opts->dirty != NULL) {
+        fprintf(stderr, "Error: Dirty tiles cannot be rendered in bands\n");
+        return -1;
+    }
+    if(opts->firstRow + rows > height) {
+        fprintf(stderr, "Error: Rows %zu to %zu are past the end of a frame "
+            "%zu rows high\n", opts->firstRow, opts->firstRow + rows, height);
+        return -1;
+    }
+
+    if(supersample && opts->adaptive > 0) {
+        fprintf(stderr, "Error: Adaptive subdivision and anti-aliasing cannot "
+            "be combined\n");
+        return -1;
+    }
+
+    if(opts->gbuffer != NULL) {
+        // A G-buffer holds exactly one primary hit per pixel
+        if(supersample || opts->adaptive > 0) {
+            fprintf(stderr, "Error: G-buffers need one sample per pixel\n");
+            return -1;
+        }
+        if(opts->gbuffer->width != width || opts->gbuffer->height != height) {
+            fprintf(stderr, "Error: G-buffer is %zux%zu but the frame is "
+                "%zux%zu\n", opts->gbuffer->width, opts->gbuffer->height,
+                width, height);
+            return -1;
+        }
+        if(!opts->relight) {
+            gbuffer* gbuffer = opts->gbuffer;
+            gbuffer->sceneHash = scene_hash(scene);
+            gbuffer->lightCount = scene->lightCount < GBUFFER_MAX_LIGHTS ?
+                scene->lightCount : GBUFFER_MAX_LIGHTS;
+            for(size_t i = 0; i < gbuffer->lightCount; i++) {
+                gbuffer->lights[i] = scene->lights[i].pos;
+            }
+        }
+        else if(opts->gbuffer->sceneHash != scene_hash(scene)) {
+            fprintf(stderr, "Error: G-buffer was saved for a different camera "
+                "or geometry\n");
+            return -1;
+        }
+        else {
+            for(size_t i = 0; i < opts->gbuffer->lightCount &&
+                    i < scene->lightCount; i++) {
+                if(memcmp(&(opts->gbuffer->lights[i]),
+                        &(scene->lights[i].pos), sizeof(vector3d)) == 0) {
+                    ctx.knownLights |= (uint64_t)1 << i;
+                }
+            }
+        }
+    }
+
+    if(opts->hdr != NULL && (opts->hdr->width != width ||
+            opts->hdr->height != height)) {
+        fprintf(stderr, "Error: HDR buffer is %zux%zu but the frame is "
+            "%zux%zu\n", opts->hdr->width, opts->hdr->height, width, height);
+        return -1;
+    }
+
+    if(scene->objCount > PACKET_MAX_OBJS) {
+        ctx.lanes = 1;
+    }
+    for(size_t i = 0; i < scene->meshCount; i++) {
+        if(scene->meshes[i].faceCount > PACKET_MAX_OBJS) {
+            ctx.lanes = 1;
+        }
+    }
+
+    if(opts->shadowCache != SHADOW_CACHE_OFF && scene->lightCount > 0) {
+        size_t entries = opts->threads * scene->lightCount;
+        ctx.caches = malloc(sizeof(*(ctx.caches)) * entries);
+        if(ctx.caches == NULL) {
+            fprintf(stderr, "Error: Memory allocation error\n");
+            return -1;
+        }
+        for(size_t i = 0; i < entries; i++) {
+            ctx.caches[i].type = SHADOW_CACHE_EMPTY;
+        }
+    }
+
+    if(opts->adaptive > 0) {
+        ctx.samples = malloc(sizeof(*(ctx.samples)) * opts->threads *
+            DEFAULT_TILE_SIZE * DEFAULT_TILE_SIZE);
+        if(ctx.samples == NULL) {
+            fprintf(stderr, "Error: Memory allocation error\n");
+            free(ctx.caches);
+            return -1;
+        }
+    }
+
+    // Every thread counts its own samples so the totals need no locking
+    ctx.threadStats = calloc(opts->threads, sizeof(*(ctx.threadStats)));
+    if(supersample) {
+        ctx.pixelSamples = malloc(sizeof(*(ctx.pixelSamples)) * opts->threads *
+            SUPERSAMPLE_STRIDE * SUPERSAMPLE_STRIDE);
+    }
+    if(ctx.threadStats == NULL || (supersample && ctx.pixelSamples == NULL)) {
+        fprintf(stderr, "Error: Memory allocation error\n");
+        free(ctx.caches);
+        free(ctx.samples);
+        free(ctx.threadStats);
+        free(ctx.pixelSamples);
+        return -1;
+    }
 
-typedef struct shootObj {
-    double t;
-    sceneObj* obj;
-} shootObj;
-
-double sphere_intersection(ray ray, sceneObj* obj);
-double plane_intersection(ray ray, sceneObj* obj);
-double cylinder_intersection(ray ray, sceneObj* obj);
-
-shootObj shoot(ray ray, sceneObj** objs);
-pixel shade(ray ray, vector3d intersection, sceneObj* intersected, sceneObj** objs,
-    sceneLight** lights);
-
-vector3d getIntersection(ray ray, double t);
-vector3d getNormal(vector3d intersection, sceneObj* obj);
-vector3d getColor(ray ray, vector3d intersection, sceneObj* closest,
-    sceneLight* light);
-int inShadow(vector3d intersection, sceneLight* light, sceneObj** objs,
-    sceneObj* exclude);
-double getRadialAtten(vector3d intersection, sceneLight* light);
-double getAngularAtten(vector3d intersection, sceneLight* light);
-vector3d getDiffuse(vector3d intersection, sceneObj* closest, sceneLight* light);
-vector3d getSpecular(ray ray, vector3d intersection, sceneObj* closest, sceneLight* light);
-
-void raycast(pixel* pixels, size_t width, size_t height, camera camera,
-        sceneObj** objs, sceneLight** lights) {
+    tile* tiles = scheduler_tiles(width, rows, DEFAULT_TILE_SIZE, &count);
+    if(tiles == NULL) {
+        free(ctx.caches);
+        free(ctx.samples);
+        free(ctx.threadStats);
+        free(ctx.pixelSamples);
+        return -1;
+    }
+    for(size_t i = 0; i < count; i++) {
+        tiles[i].y += ctx.firstRow;
+    }
+
+    // Keep only the dirty tiles, and initialize their pixels to black
+    size_t rendered = 0;
+    size_t kept = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(opts->dirty != NULL && !opts->dirty[i]) {
+            continue;
+        }
+        for(size_t y = tiles[i].y; y < tiles[i].y + tiles[i].height; y++) {
+            memset(framePixel(&ctx, tiles[i].x, y), 0,
+                sizeof(*pixels) * tiles[i].width);
+            if(opts->hdr != NULL) {
+                memset(&(opts->hdr->pixels[y * width + tiles[i].x]), 0,
+                    sizeof(*(opts->hdr->pixels)) * tiles[i].width);
+            }
+        }
+        rendered += tiles[i].width * tiles[i].height;
+        tiles[kept++] = tiles[i];
+    }
+
+    int status = scheduler_run(tiles, kept, opts->threads, renderTile, &ctx);
+
+    if(stats != NULL) {
+        // Every other pixel takes one sample. Supersampling and adaptive
+        // tiles count what they trace, and relighting traces none.
+        stats->pixels = rendered;
+        stats->samples = supersample || opts->adaptive > 0 || opts->relight ?
+            0 : rendered;
+        stats->rays = stats->samples;
+        stats->refined = 0;
+        for(size_t i = 0; i < opts->threads; i++) {
+            stats->samples += ctx.threadStats[i].samples;
+            stats->rays += ctx.threadStats[i].rays;
+            stats->refined += ctx.threadStats[i].refined;
+        }
+    }
+
+    free(tiles);
+    free(ctx.caches);
+    free(ctx.samples);
+    free(ctx.threadStats);
+    free(ctx.pixelSamples);
+
+    return status;
+}
+
+void renderTile(tile tile, size_t threadId, void* data) {
+    renderCtx* ctx = data;
+    shadowCache* cache = NULL;
+    const camera camera = ctx->scene->camera;
     const vector3d center = { 0, 0, 1 };
-    const double PIXEL_WIDTH = camera.width / width;
-    const double PIXEL_HEIGHT = camera.height / height;
+    const real PIXEL_WIDTH = camera.width / ctx->width;
+    const real PIXEL_HEIGHT = camera.height / ctx->height;
 
     vector3d point;
     shootObj closest;
@@ -44,95 +448,730 @@ void raycast(pixel* pixels, size_t width, size_t height, camera camera,
     ray ray = { 0 };
     point.z = center.z;
 
-    // Initialize all pixels to black
-    memset(pixels, 0, sizeof(*pixels) * width * height);
+    // Only this thread touches its entries, so they need no locking
+    if(ctx->caches != NULL) {
+        cache = &(ctx->caches[threadId * ctx->scene->lightCount]);
+        if(ctx->opts->shadowCache == SHADOW_CACHE_TILE) {
+            for(size_t i = 0; i < ctx->scene->lightCount; i++) {
+                cache[i].type = SHADOW_CACHE_EMPTY;
+            }
+        }
+    }
+
+    if(ctx->opts->relight) {
+        renderRelightTile(ctx, tile, cache);
+        return;
+    }
+
+    if(ctx->samples != NULL) {
+        renderAdaptiveTile(ctx, tile, &(ctx->samples[threadId *
+            DEFAULT_TILE_SIZE * DEFAULT_TILE_SIZE]), cache,
+            &(ctx->threadStats[threadId]));
+        return;
+    }
 
-    for(size_t y = 0; y < height; y++) {
-        point.y = center.y - (camera.height / 2) + PIXEL_HEIGHT * (y + 0.5);
+    if(ctx->pixelSamples != NULL) {
+        renderSupersampledTile(ctx, tile, &(ctx->pixelSamples[threadId *
+            SUPERSAMPLE_STRIDE * SUPERSAMPLE_STRIDE]), cache,
+            &(ctx->threadStats[threadId]));
+        return;
+    }
+
+    for(size_t y = tile.y; y < tile.y + tile.height; y++) {
+        point.y = center.y - (camera.height / 2) +
+            PIXEL_HEIGHT * (y + (real)0.5);
         // Adjust for image inversion
         point.y *= -1;
-        for(size_t x = 0; x < width; x++) {
-            point.x = center.x - (camera.width / 2) + PIXEL_WIDTH * (x + 0.5);
+        if(ctx->lanes > 1) {
+            renderPacketRow(ctx, point, tile.x, tile.x + tile.width, y, cache);
+            continue;
+        }
+        for(size_t x = tile.x; x < tile.x + tile.width; x++) {
+            point.x = center.x - (camera.width / 2) +
+                PIXEL_WIDTH * (x + (real)0.5);
             ray.dir = vector3d_normalize(point);
-            closest = shoot(ray, objs);
-            if(closest.obj != NULL) {
+            closest = shoot(ray, ctx->scene);
+            if(ctx->opts->gbuffer != NULL) {
+                storeRadiance(ctx, x, y, shadeAndRecord(ctx,
+                    y * ctx->width + x, ray, closest, cache));
+            }
+            else if(closest.hit) {
                 vector3d intersection = getIntersection(ray, closest.t);
-                pixels[y * width + x] = shade(ray, intersection, closest.obj,
-                    objs, lights);
+                storeRadiance(ctx, x, y, shadeColor(ray, intersection,
+                    closest, ctx->scene, cache, NULL));
             }
         }
     }
 }
 
-shootObj shoot(ray ray, sceneObj** objs) {
-    double closestValue = INFINITY;
-    double t;
+// Same as the scalar row loop in renderTile(), but the closest hits of
+// neighbouring pixels are found a packet at a time
+void renderPacketRow(renderCtx* ctx, vector3d point, size_t start, size_t end,
+        size_t y, shadowCache* cache) {
+    const camera camera = ctx->scene->camera;
+    const vector3d center = { 0, 0, 1 };
+    const real PIXEL_WIDTH = camera.width / ctx->width;
 
-    shootObj closest = { 0 };
+    rayPacket packet = { 0 };
+    shootObj hits[PACKET_MAX];
+    ray ray = { 0 };
 
-    for(size_t i = 0; objs[i] != NULL; i++) {
-        switch(objs[i]->type) {
-            case(TYPE_SPHERE):
-                t = sphere_intersection(ray, objs[i]);
-                break;
-            case(TYPE_PLANE):
-                t = plane_intersection(ray, objs[i]);
+    for(size_t x = start; x < end; x += ctx->lanes) {
+        size_t count = end - x < ctx->lanes ? end - x : ctx->lanes;
+
+        for(size_t lane = 0; lane < ctx->lanes; lane++) {
+            // Spare lanes at the end of a row repeat the last ray
+            size_t column = x + (lane < count ? lane : count - 1);
+            point.x = center.x - (camera.width / 2) +
+                PIXEL_WIDTH * (column + (real)0.5);
+            vector3d dir = vector3d_normalize(point);
+            packet.dirX[lane] = dir.x;
+            packet.dirY[lane] = dir.y;
+            packet.dirZ[lane] = dir.z;
+        }
+
+        packet_shoot(&packet, ctx->scene, hits);
+
+        for(size_t lane = 0; lane < count; lane++) {
+            ray.dir.x = packet.dirX[lane];
+            ray.dir.y = packet.dirY[lane];
+            ray.dir.z = packet.dirZ[lane];
+            if(ctx->opts->gbuffer != NULL) {
+                storeRadiance(ctx, x + lane, y, shadeAndRecord(ctx,
+                    y * ctx->width + x + lane, ray, hits[lane], cache));
+            }
+            else if(hits[lane].hit) {
+                vector3d intersection = getIntersection(ray, hits[lane].t);
+                storeRadiance(ctx, x + lane, y, shadeColor(ray, intersection,
+                    hits[lane], ctx->scene, cache, NULL));
+            }
+        }
+    }
+}
+
+// Shades every pixel from the hit saved in opts->gbuffer, which skips all
+// primary intersection tests. Lights that have not moved since the buffer was
+// saved take their shadows from it too, so they need no shadow rays either.
+void renderRelightTile(renderCtx* ctx, tile tile, shadowCache* cache) {
+    const gbuffer* gbuffer = ctx->opts->gbuffer;
+
+    for(size_t y = tile.y; y < tile.y + tile.height; y++) {
+        for(size_t x = tile.x; x < tile.x + tile.width; x++) {
+            const gbufferPixel* hit = &(gbuffer->pixels[y * ctx->width + x]);
+            if(!hit->hit) {
+                continue;
+            }
+
+            ray ray = { { 0, 0, 0 }, primaryDir(ctx, x, y, 0.5, 0.5) };
+            vector3d intersection = getIntersection(ray, hit->t);
+            uint64_t shadowMask = hit->shadowMask;
+            storeRadiance(ctx, x, y, shadeSurface(ray, intersection,
+                hit->normal, hit->obj, ctx->scene, cache, ctx->knownLights,
+                &shadowMask));
+        }
+    }
+}
+
+// shadeColor() that also saves the hit and its shadows to
+// opts->gbuffer[index]. Misses are black.
+vector3d shadeAndRecord(renderCtx* ctx, size_t index, ray ray,
+        shootObj closest, shadowCache* cache) {
+    gbufferPixel* record = &(ctx->opts->gbuffer->pixels[index]);
+    vector3d radiance = vector3d_zero();
+
+    memset(record, 0, sizeof(*record));
+    if(closest.hit) {
+        vector3d intersection = getIntersection(ray, closest.t);
+
+        record->t = closest.t;
+        record->normal = getNormal(intersection, closest, ctx->scene);
+        record->obj = closest.obj;
+        record->hit = 1;
+        radiance = shadeSurface(ray, intersection, record->normal,
+            closest.obj, ctx->scene, cache, 0, &(record->shadowMask));
+    }
+
+    return radiance;
+}
+
+// Traces only the corners of every opts->adaptive sized block of the tile,
+// then lets refineBlock() decide where the rest has to be traced too
+void renderAdaptiveTile(renderCtx* ctx, tile tile, adaptiveSample* samples,
+        shadowCache* cache, renderStats* stats) {
+    adaptiveTile block = { ctx, tile, samples, cache, stats };
+    size_t size = ctx->opts->adaptive;
+    size_t lastX = tile.width - 1;
+    size_t lastY = tile.height - 1;
+
+    for(size_t i = 0; i < tile.width * tile.height; i++) {
+        samples[i].traced = 0;
+    }
+
+    // Corners are shared between neighbouring blocks, and the last block of
+    // a row or column stops at the tile edge
+    for(size_t y0 = 0; ; y0 += size) {
+        size_t y1 = y0 + size < lastY ? y0 + size : lastY;
+        for(size_t x0 = 0; ; x0 += size) {
+            size_t x1 = x0 + size < lastX ? x0 + size : lastX;
+
+            traceSample(&block, x0, y0);
+            traceSample(&block, x1, y0);
+            traceSample(&block, x0, y1);
+            traceSample(&block, x1, y1);
+            refineBlock(&block, x0, y0, x1, y1);
+
+            if(x1 == lastX) {
                 break;
-            default:
-                fprintf(stderr, "Error: Invalid obj type\n");
-                exit(EXIT_FAILURE);
+            }
+        }
+        if(y1 == lastY) {
+            break;
+        }
+    }
+}
+
+// Fills in the block between four traced corners. If they all see the same
+// object under the same shadows and the traced center agrees with the
+// bilinear blend of the corners to within opts->quality levels, the blend is
+// used for every untraced pixel. Otherwise the block is split in four. The
+// center is only a probe: the rest of the block is not checked and may be
+// off by more, so a quality of 0 splits down to single pixels instead.
+void refineBlock(adaptiveTile* block, size_t x0, size_t y0, size_t x1,
+        size_t y1) {
+    adaptiveSample* samples = block->samples;
+    size_t stride = block->tile.width;
+    size_t width = x1 - x0;
+    size_t height = y1 - y0;
+
+    // Every pixel is already a corner
+    if(width <= 1 && height <= 1) {
+        return;
+    }
+
+    size_t xm = x0 + width / 2;
+    size_t ym = y0 + height / 2;
+    const adaptiveSample* topLeft = &(samples[y0 * stride + x0]);
+    const adaptiveSample* topRight = &(samples[y0 * stride + x1]);
+    const adaptiveSample* bottomLeft = &(samples[y1 * stride + x0]);
+    const adaptiveSample* bottomRight = &(samples[y1 * stride + x1]);
+
+    if(block->ctx->opts->quality > 0 && sameSample(topLeft, topRight) &&
+            sameSample(topLeft, bottomLeft) &&
+            sameSample(topLeft, bottomRight)) {
+        const adaptiveSample* middle = traceSample(block, xm, ym);
+        real limit = block->ctx->opts->quality / 255;
+        vector3d error = vector3d_sub(blendCorners(block, x0, y0, x1, y1, xm,
+            ym, 0), middle->color);
+
+        if(sameSample(topLeft, middle) && real_fabs(error.x) <= limit &&
+                real_fabs(error.y) <= limit && real_fabs(error.z) <= limit) {
+            for(size_t y = y0; y <= y1; y++) {
+                for(size_t x = x0; x <= x1; x++) {
+                    if(!samples[y * stride + x].traced) {
+                        storePixel(block->ctx, block->tile.x + x,
+                            block->tile.y + y, blendCorners(block, x0, y0,
+                            x1, y1, x, y, 0), blendCorners(block, x0, y0, x1,
+                            y1, x, y, 1));
+                    }
+                }
+            }
+            return;
+        }
+    }
+
+    // Split only the sides that still have pixels between their corners
+    if(width > 1 && height > 1) {
+        traceSample(block, xm, y0);
+        traceSample(block, x0, ym);
+        traceSample(block, xm, ym);
+        traceSample(block, x1, ym);
+        traceSample(block, xm, y1);
+        refineBlock(block, x0, y0, xm, ym);
+        refineBlock(block, xm, y0, x1, ym);
+        refineBlock(block, x0, ym, xm, y1);
+        refineBlock(block, xm, ym, x1, y1);
+    }
+    else if(width > 1) {
+        traceSample(block, xm, y0);
+        traceSample(block, xm, y1);
+        refineBlock(block, x0, y0, xm, y1);
+        refineBlock(block, xm, y0, x1, y1);
+    }
+    else {
+        traceSample(block, x0, ym);
+        traceSample(block, x1, ym);
+        refineBlock(block, x0, y0, x1, ym);
+        refineBlock(block, x0, ym, x1, y1);
+    }
+}
+
+// Traces the pixel at tile-relative x, y unless that was already done, and
+// writes its exact color to the frame
+adaptiveSample* traceSample(adaptiveTile* block, size_t x, size_t y) {
+    adaptiveSample* sample = &(block->samples[y * block->tile.width + x]);
+    if(sample->traced) {
+        return sample;
+    }
+
+    renderCtx* ctx = block->ctx;
+    size_t column = block->tile.x + x;
+    size_t row = block->tile.y + y;
+    ray ray = { { 0, 0, 0 }, primaryDir(ctx, column, row, 0.5, 0.5) };
+    shootObj closest = shoot(ray, ctx->scene);
+
+    sample->radiance = vector3d_zero();
+    sample->obj = closest.obj;
+    sample->shadowMask = 0;
+    sample->hit = closest.hit;
+    sample->traced = 1;
+    block->stats->samples += 1;
+    block->stats->rays += 1;
+    if(closest.hit) {
+        vector3d intersection = getIntersection(ray, closest.t);
+        sample->radiance = shadeColor(ray, intersection, closest, ctx->scene,
+            block->cache, &(sample->shadowMask));
+    }
+    sample->color = sample->radiance;
+    pixel_clamp(&(sample->color));
+    storePixel(ctx, column, row, sample->color, sample->radiance);
+
+    return sample;
+}
+
+// Bilinear blend of the corner colors of a block at x, y, or of their
+// radiance when radiance is set
+vector3d blendCorners(const adaptiveTile* block, size_t x0, size_t y0,
+        size_t x1, size_t y1, size_t x, size_t y, int radiance) {
+    const adaptiveSample* samples = block->samples;
+    size_t stride = block->tile.width;
+    real fx = x1 > x0 ? (real)(x - x0) / (x1 - x0) : 0;
+    real fy = y1 > y0 ? (real)(y - y0) / (y1 - y0) : 0;
+    const adaptiveSample* corners[4] = {
+        &(samples[y0 * stride + x0]), &(samples[y0 * stride + x1]),
+        &(samples[y1 * stride + x0]), &(samples[y1 * stride + x1])
+    };
+    vector3d colors[4];
+
+    for(size_t i = 0; i < 4; i++) {
+        colors[i] = radiance ? corners[i]->radiance : corners[i]->color;
+    }
+
+    vector3d top = vector3d_add(vector3d_scale(colors[0], 1 - fx),
+        vector3d_scale(colors[1], fx));
+    vector3d bottom = vector3d_add(vector3d_scale(colors[2], 1 - fx),
+        vector3d_scale(colors[3], fx));
+
+    return vector3d_add(vector3d_scale(top, 1 - fy),
+        vector3d_scale(bottom, fy));
+}
+
+int sameSample(const adaptiveSample* first, const adaptiveSample* second) {
+    if(!first->hit || !second->hit) {
+        return first->hit == second->hit;
+    }
+
+    return first->obj == second->obj &&
+        first->shadowMask == second->shadowMask;
+}
+
+// The primary ray direction through offsetX, offsetY within pixel x, y. An
+// offset of 0.5, 0.5 gives the same ray renderTile() uses for that pixel.
+vector3d primaryDir(const renderCtx* ctx, size_t x, size_t y, real offsetX,
+        real offsetY) {
+    const camera camera = ctx->scene->camera;
+    const vector3d center = { 0, 0, 1 };
+    const real PIXEL_WIDTH = camera.width / ctx->width;
+    const real PIXEL_HEIGHT = camera.height / ctx->height;
+    vector3d point;
+
+    point.x = center.x - (camera.width / 2) + PIXEL_WIDTH * (x + offsetX);
+    point.y = center.y - (camera.height / 2) + PIXEL_HEIGHT * (y + offsetY);
+    // Adjust for image inversion
+    point.y *= -1;
+    point.z = center.z;
+
+    return vector3d_normalize(point);
+}
+
+// Takes opts->baseSamples per pixel over the tile and a ring of pixels
+// around it, then keeps adding samples to any pixel whose samples disagree
+// or whose luminance differs from a neighbour's by more than the variance
+// threshold allows. Refinement stops once the variance of the pixel's mean
+// falls below the threshold or opts->maxSamples is reached.
+void renderSupersampledTile(renderCtx* ctx, tile tile, pixelSamples* samples,
+        shadowCache* cache, renderStats* stats) {
+    const renderOpts* opts = ctx->opts;
+    size_t base = opts->baseSamples;
+    size_t limit = opts->maxSamples > base ? opts->maxSamples : base;
+    // Bounds of the ring, clipped to the frame
+    size_t left = tile.x > 0 ? tile.x - 1 : 0;
+    size_t top = tile.y > 0 ? tile.y - 1 : 0;
+    size_t right = tile.x + tile.width < ctx->width ? tile.x + tile.width :
+        ctx->width - 1;
+    size_t bottom = tile.y + tile.height < ctx->height ? tile.y + tile.height :
+        ctx->height - 1;
+
+    for(size_t y = top; y <= bottom; y++) {
+        for(size_t x = left; x <= right; x++) {
+            pixelSamples* pixel = &(samples[(y + 1 - tile.y) *
+                SUPERSAMPLE_STRIDE + x + 1 - tile.x]);
+            memset(pixel, 0, sizeof(*pixel));
+            addSamples(ctx, pixel, x, y, base, cache);
+            pixel->baseMean = pixel->luminance / pixel->count;
         }
-        if(t > 0 && t < closestValue) {
+    }
+    // The ring pixels are traced again by each tile that borders them
+    stats->rays += (right - left + 1) * (bottom - top + 1) * base;
+
+    for(size_t y = tile.y; y < tile.y + tile.height; y++) {
+        for(size_t x = tile.x; x < tile.x + tile.width; x++) {
+            pixelSamples* pixel = &(samples[(y + 1 - tile.y) *
+                SUPERSAMPLE_STRIDE + x + 1 - tile.x]);
+            int refine = limit > base && sampleVariance(pixel) > opts->variance;
+
+            // Contrast against the base samples of the four neighbours. The
+            // left and upper ones may be refined by now, so their saved base
+            // means are used and the result does not depend on scan order.
+            const pixelSamples* neighbours[4] = {
+                x > left ? pixel - 1 : NULL,
+                x < right ? pixel + 1 : NULL,
+                y > top ? pixel - SUPERSAMPLE_STRIDE : NULL,
+                y < bottom ? pixel + SUPERSAMPLE_STRIDE : NULL
+            };
+            for(size_t i = 0; limit > base && !refine && i < 4; i++) {
+                if(neighbours[i] != NULL) {
+                    real contrast = pixel->baseMean -
+                        neighbours[i]->baseMean;
+                    refine = contrast * contrast > opts->variance;
+                }
+            }
+
+            if(refine) {
+                stats->refined++;
+            }
+            // Base samples of the ring pixels go into the tile that owns
+            // them, so add only this pixel's
+            stats->samples += base;
+            while(refine && pixel->count < limit) {
+                size_t count = limit - pixel->count < base ?
+                    limit - pixel->count : base;
+                addSamples(ctx, pixel, x, y, count, cache);
+                stats->samples += count;
+                stats->rays += count;
+                refine = sampleVariance(pixel) / pixel->count > opts->variance;
+            }
+
+            storePixel(ctx, x, y, vector3d_scale(pixel->color,
+                (real)1 / pixel->count), vector3d_scale(pixel->radiance,
+                (real)1 / pixel->count));
+        }
+    }
+}
+
+// Traces the next count samples of pixel x, y. Sample i sits at the i-th
+// point of the R2 low-discrepancy sequence, so any number of samples covers
+// the pixel evenly and sample 0 is its center.
+void addSamples(const renderCtx* ctx, pixelSamples* samples, size_t x,
+        size_t y, size_t count, shadowCache* cache) {
+    for(size_t i = samples->count; i < samples->count + count; i++) {
+        double offsetX = 0.5 + R2_X * i;
+        double offsetY = 0.5 + R2_Y * i;
+        ray ray = { { 0, 0, 0 }, primaryDir(ctx, x, y,
+            offsetX - floor(offsetX), offsetY - floor(offsetY)) };
+        shootObj closest = shoot(ray, ctx->scene);
+        vector3d radiance = vector3d_zero();
+
+        if(closest.hit) {
+            vector3d intersection = getIntersection(ray, closest.t);
+            radiance = shadeColor(ray, intersection, closest, ctx->scene,
+                cache, NULL);
+        }
+        vector3d color = radiance;
+        pixel_clamp(&color);
+
+        // Rec. 709 luma weights
+        real luminance = (real)0.2126 * color.x + (real)0.7152 * color.y +
+            (real)0.0722 * color.z;
+        samples->color = vector3d_add(samples->color, color);
+        samples->radiance = vector3d_add(samples->radiance, radiance);
+        samples->luminance += luminance;
+        samples->luminanceSquared += luminance * luminance;
+    }
+    samples->count += count;
+}
+
+// Unbiased variance of a pixel's sample luminances
+real sampleVariance(const pixelSamples* samples) {
+    if(samples->count < 2) {
+        return 0;
+    }
+
+    real mean = samples->luminance / samples->count;
+    real variance = (samples->luminanceSquared - mean * samples->luminance) /
+        (samples->count - 1);
+
+    return variance > 0 ? variance : 0;
+}
+
+// Primary rays only: ray.origin must be the camera origin, which lets the
+// baked per-object constants stand in for part of the intersection math
+shootObj shoot(ray ray, const scene* scene) {
+    const sphereArray* spheres = &(scene->spheres);
+    const planeArray* planes = &(scene->planes);
+    real closestValue = INFINITY;
+    real t;
+
+    shootObj closest = { 0 };
+
+    // Objects are not visited in objs order, so exact ties are broken on the
+    // objs index to pick the same object a linear scan would
+    for(size_t i = 0; i < planes->count; i++) {
+        t = plane_primary(ray.dir, planeNormal(planes, i), planes->nDotP[i]);
+        if(t > 0 && (t < closestValue ||
+                (t == closestValue && planes->obj[i] < closest.obj))) {
             closestValue = t;
             closest.t = t;
-            closest.obj = objs[i];
+            closest.obj = planes->obj[i];
+            closest.type = HIT_PLANE;
+            closest.prim = i;
+            closest.face = 0;
+            closest.hit = 1;
+        }
+    }
+
+    for(size_t i = 0; i < scene->meshCount; i++) {
+        shootMesh(ray, &(scene->meshes[i]), i, &closest, &closestValue);
+    }
+
+    if(scene->bvh.count == 0) {
+        return closest;
+    }
+
+    const bvhNode* nodes = scene->bvh.nodes;
+    vector3d invDir = bvh_invDir(ray.dir);
+    size_t stack[BVH_STACK_SIZE];
+    size_t depth = 0;
+    real near, farNear;
+
+    if(!bvh_hitBox(&(nodes[0]), ray.origin, invDir, closestValue, &near)) {
+        return closest;
+    }
+    stack[depth++] = 0;
+
+    while(depth > 0) {
+        const bvhNode* node = &(nodes[stack[--depth]]);
+
+        if(node->count > 0) {
+            // Leaves cover a contiguous run of the sphere arrays
+            for(size_t i = node->first; i < node->first + node->count; i++) {
+                t = sphere_primary(ray.dir, spherePos(spheres, i),
+                    spheres->radius[i], spheres->originC[i]);
+                if(t > 0 && (t < closestValue ||
+                        (t == closestValue && spheres->obj[i] < closest.obj))) {
+                    closestValue = t;
+                    closest.t = t;
+                    closest.obj = spheres->obj[i];
+                    closest.type = HIT_SPHERE;
+                    closest.prim = i;
+                    closest.face = 0;
+                    closest.hit = 1;
+                }
+            }
+            continue;
+        }
+
+        // Visit the nearer child first so closestValue shrinks sooner
+        size_t first = node->first;
+        size_t second = node->first + 1;
+        int hitFirst = bvh_hitBox(&(nodes[first]), ray.origin, invDir,
+            closestValue, &near);
+        int hitSecond = bvh_hitBox(&(nodes[second]), ray.origin, invDir,
+            closestValue, &farNear);
+        if(hitFirst && hitSecond && farNear < near) {
+            size_t swap = first;
+            first = second;
+            second = swap;
+        }
+        if(hitSecond) {
+            stack[depth++] = second;
+        }
+        if(hitFirst) {
+            stack[depth++] = first;
         }
     }
 
     return closest;
 }
 
-pixel shade(ray ray, vector3d intersection, sceneObj* closest, sceneObj** objs,
-        sceneLight** lights) {
+// The closest hit of shoot() on the faces of one mesh, folded into closest.
+// The tree is walked the same way as the one over the spheres.
+void shootMesh(ray ray, const mesh* mesh, size_t index, shootObj* closest,
+        real* closestValue) {
+    if(mesh->bvh.count == 0) {
+        return;
+    }
+
+    const bvhNode* nodes = mesh->bvh.nodes;
+    vector3d invDir = bvh_invDir(ray.dir);
+    size_t stack[BVH_STACK_SIZE];
+    size_t depth = 0;
+    real near, farNear, t;
+
+    // The tree and the faces are in mesh coordinates
+    ray.origin = vector3d_sub(ray.origin, mesh->pos);
+    if(!bvh_hitBox(&(nodes[0]), ray.origin, invDir, *closestValue, &near)) {
+        return;
+    }
+    stack[depth++] = 0;
+
+    while(depth > 0) {
+        const bvhNode* node = &(nodes[stack[--depth]]);
+
+        if(node->count > 0) {
+            for(size_t i = node->first; i < node->first + node->count; i++) {
+                t = face_intersection(ray, mesh, i);
+                if(t > 0 && (t < *closestValue || (t == *closestValue &&
+                        (mesh->obj < closest->obj || (mesh->obj ==
+                        closest->obj && i < closest->face))))) {
+                    *closestValue = t;
+                    closest->t = t;
+                    closest->obj = mesh->obj;
+                    closest->type = HIT_MESH;
+                    closest->prim = index;
+                    closest->face = i;
+                    closest->hit = 1;
+                }
+            }
+            continue;
+        }
+
+        size_t first = node->first;
+        size_t second = node->first + 1;
+        int hitFirst = bvh_hitBox(&(nodes[first]), ray.origin, invDir,
+            *closestValue, &near);
+        int hitSecond = bvh_hitBox(&(nodes[second]), ray.origin, invDir,
+            *closestValue, &farNear);
+        if(hitFirst && hitSecond && farNear < near) {
+            size_t swap = first;
+            first = second;
+            second = swap;
+        }
+        if(hitSecond) {
+            stack[depth++] = second;
+        }
+        if(hitFirst) {
+            stack[depth++] = first;
+        }
+    }
+}
+
+// Saves the clamped color of pixel x, y to the frame, and its radiance, the
+// color before clamping, to opts->hdr if there is one
+void storePixel(const renderCtx* ctx, size_t x, size_t y, vector3d color,
+        vector3d radiance) {
+    *framePixel(ctx, x, y) = vector3d2pixel(color);
+    if(ctx->opts->hdr != NULL) {
+        hdrPixel* hdr = &(ctx->opts->hdr->pixels[y * ctx->width + x]);
+        hdr->red = radiance.x;
+        hdr->green = radiance.y;
+        hdr->blue = radiance.z;
+    }
+}
+
+// storePixel() for a pixel whose color is its radiance clamped
+void storeRadiance(const renderCtx* ctx, size_t x, size_t y,
+        vector3d radiance) {
+    vector3d color = radiance;
+
+    pixel_clamp(&color);
+    storePixel(ctx, x, y, color, radiance);
+}
+
+// The color of a hit, summed over the lights and not yet clamped to [0, 1].
+// When shadowMask is given it also reports which lights were blocked.
+vector3d shadeColor(ray ray, vector3d intersection, shootObj closest,
+        const scene* scene, shadowCache* cache, uint64_t* shadowMask) {
+    return shadeSurface(ray, intersection, getNormal(intersection, closest,
+        scene), closest.obj, scene, cache, 0, shadowMask);
+}
+
+// The lighting half of shadeColor(), for a hit on objs[obj] whose normal is
+// already known. Lights with their bit set in known skip the shadow test and
+// go by their bit of *shadowMask instead.
+vector3d shadeSurface(ray ray, vector3d intersection, vector3d normal,
+        size_t obj, const scene* scene, shadowCache* cache, uint64_t known,
+        uint64_t* shadowMask) {
+    const material* material = &(scene->materials[obj]);
     vector3d sum = { 0 };
     vector3d color;
-    for(size_t i = 0; lights[i] != NULL; i++) {
-        if(!inShadow(intersection, lights[i], objs, closest)) {
-            color = getColor(ray, intersection, closest, lights[i]);
+    for(size_t i = 0; i < scene->lightCount; i++) {
+        const bakedLight* light = &(scene->lights[i]);
+        // Shared by the shadow test and both lighting terms
+        vector3d toLight = vector3d_normalize(vector3d_sub(light->pos,
+            intersection));
+        real distance = vector3d_distance(light->pos, intersection);
+        // Lights past the 63rd share the last bit, so they never count as
+        // known
+        uint64_t bit = (uint64_t)1 << (i < 63 ? i : 63);
+        int blocked;
+
+        if(known & bit) {
+            blocked = (*shadowMask & bit) != 0;
+        }
+        else {
+            blocked = inShadow(intersection, toLight, distance, scene, obj,
+                cache != NULL ? &(cache[i]) : NULL);
+            if(blocked && shadowMask != NULL) {
+                *shadowMask |= bit;
+            }
+        }
+
+        if(!blocked) {
+            color = getColor(ray, intersection, normal, toLight, distance,
+                material, light);
             sum = vector3d_add(sum, color);
         }
     }
 
-    pixel_clamp(&sum);
-    pixel pixel = vector3d2pixel(sum);
-
-    return pixel;
+    return sum;
 }
 
-vector3d getIntersection(ray ray, double t) {
+vector3d getIntersection(ray ray, real t) {
     return vector3d_add(ray.origin, vector3d_scale(ray.dir, t));
 }
 
-vector3d getNormal(vector3d intersection, sceneObj* obj) {
-    switch(obj->type) {
-        case(TYPE_SPHERE):
-            return vector3d_normalize(vector3d_sub(intersection, obj->sphere.pos));
-        case(TYPE_PLANE):
-            return obj->plane.normal;
+vector3d getNormal(vector3d intersection, shootObj closest, const scene* scene) {
+    switch(closest.type) {
+        case(HIT_SPHERE):
+            return vector3d_normalize(vector3d_sub(intersection,
+                spherePos(&(scene->spheres), closest.prim)));
+        case(HIT_PLANE):
+            return planeNormal(&(scene->planes), closest.prim);
+        case(HIT_MESH): {
+            // Faces are lit from both sides, so the normal is turned towards
+            // the camera at the origin, where the primary ray came from
+            vector3d normal = mesh_normal(&(scene->meshes[closest.prim]),
+                closest.face);
+            if(vector3d_dot(normal, intersection) > 0) {
+                normal = vector3d_scale(normal, -1);
+            }
+            return normal;
+        }
         default:
             fprintf(stderr, "Error: Invalid obj type\n");
             exit(EXIT_FAILURE);
     }
 }
 
-vector3d getColor(ray ray, vector3d intersection, sceneObj* closest,
-        sceneLight* light) {
-    double radialAtten = getRadialAtten(intersection, light);
-    double angularAtten = getAngularAtten(intersection, light);
+vector3d getColor(ray ray, vector3d intersection, vector3d normal,
+        vector3d toLight, real distance, const material* material,
+        const bakedLight* light) {
+    real radialAtten = getRadialAtten(distance, light);
+    real angularAtten = getAngularAtten(intersection, light);
 
     vector3d sum = vector3d_add(
-        getDiffuse(intersection, closest, light),
-        getSpecular(ray, intersection, closest, light)
+        getDiffuse(normal, toLight, material, light),
+        getSpecular(ray, normal, toLight, material, light)
     );
     sum = vector3d_scale(sum, radialAtten * angularAtten);
 
@@ -143,34 +1182,157 @@ vector3d getColor(ray ray, vector3d intersection, sceneObj* closest,
     return sum;
 }
 
-int inShadow(vector3d intersection, sceneLight* light, sceneObj** objs,
-        sceneObj* exclude) {
-    vector3d dir = vector3d_normalize(vector3d_sub(light->pos, intersection));
-    double distance = vector3d_distance(light->pos, intersection);
-    ray ray = { intersection, dir };
-    double t;
-    for(size_t i = 0; objs[i] != NULL; i++) {
-        switch(objs[i]->type) {
-            case(TYPE_SPHERE):
-                t = sphere_intersection(ray, objs[i]);
-                break;
-            case(TYPE_PLANE):
-                t = plane_intersection(ray, objs[i]);
-                break;
-            default:
-                fprintf(stderr, "Error: Invalid obj type\n");
-                exit(EXIT_FAILURE);
+int inShadow(vector3d intersection, vector3d toLight, real distance,
+        const scene* scene, size_t exclude, shadowCache* cache) {
+    const sphereArray* spheres = &(scene->spheres);
+    const planeArray* planes = &(scene->planes);
+    ray ray = { intersection, toLight };
+    real t;
+
+    // Any occluder gives the same answer, so the cached one can go first
+    if(cache != NULL && cache->type != SHADOW_CACHE_EMPTY &&
+            occludes(ray, distance, scene, exclude, cache)) {
+        return 1;
+    }
+
+    for(size_t i = 0; i < planes->count; i++) {
+        t = plane_intersection(ray, planePos(planes, i), planeNormal(planes, i));
+        if(t > 0 && t < distance && planes->obj[i] != exclude) {
+            if(cache != NULL) {
+                cache->type = HIT_PLANE;
+                cache->prim = i;
+            }
+            return 1;
         }
-        if(t > 0 && t < distance && objs[i] != exclude) {
+    }
+
+    // Like every object, a mesh never shadows itself
+    for(size_t i = 0; i < scene->meshCount; i++) {
+        size_t face;
+
+        if(scene->meshes[i].obj != exclude &&
+                meshOccludes(ray, distance, &(scene->meshes[i]), &face)) {
+            if(cache != NULL) {
+                cache->type = HIT_MESH;
+                cache->prim = i;
+                cache->face = face;
+            }
             return 1;
         }
     }
+
+    if(scene->bvh.count == 0) {
+        return 0;
+    }
+
+    // Any occluder will do, so there is no need to order the traversal
+    const bvhNode* nodes = scene->bvh.nodes;
+    vector3d invDir = bvh_invDir(ray.dir);
+    size_t stack[BVH_STACK_SIZE];
+    size_t depth = 0;
+    real near;
+
+    stack[depth++] = 0;
+    while(depth > 0) {
+        const bvhNode* node = &(nodes[stack[--depth]]);
+        if(!bvh_hitBox(node, ray.origin, invDir, distance, &near)) {
+            continue;
+        }
+
+        if(node->count > 0) {
+            for(size_t i = node->first; i < node->first + node->count; i++) {
+                t = sphere_intersection(ray, spherePos(spheres, i),
+                    spheres->radius[i]);
+                if(t > 0 && t < distance && spheres->obj[i] != exclude) {
+                    if(cache != NULL) {
+                        cache->type = HIT_SPHERE;
+                        cache->prim = i;
+                    }
+                    return 1;
+                }
+            }
+        }
+        else {
+            stack[depth++] = node->first + 1;
+            stack[depth++] = node->first;
+        }
+    }
+
     return 0;
 }
 
-double getRadialAtten(vector3d intersection, sceneLight* light) {
-    double distance = vector3d_distance(light->pos, intersection);
+// The occluder test of inShadow() against the single primitive in cached
+int occludes(ray ray, real distance, const scene* scene, size_t exclude,
+        const shadowCache* cached) {
+    size_t prim = cached->prim;
+    real t;
 
+    if(cached->type == HIT_SPHERE) {
+        if(scene->spheres.obj[prim] == exclude) {
+            return 0;
+        }
+        t = sphere_intersection(ray, spherePos(&(scene->spheres), prim),
+            scene->spheres.radius[prim]);
+    }
+    else if(cached->type == HIT_PLANE) {
+        if(scene->planes.obj[prim] == exclude) {
+            return 0;
+        }
+        t = plane_intersection(ray, planePos(&(scene->planes), prim),
+            planeNormal(&(scene->planes), prim));
+    }
+    else {
+        const mesh* mesh = &(scene->meshes[prim]);
+        if(mesh->obj == exclude) {
+            return 0;
+        }
+        ray.origin = vector3d_sub(ray.origin, mesh->pos);
+        t = face_intersection(ray, mesh, cached->face);
+    }
+
+    return t > 0 && t < distance;
+}
+
+// Whether any face of mesh blocks the ray within distance, which is stored
+// in face
+int meshOccludes(ray ray, real distance, const mesh* mesh, size_t* face) {
+    if(mesh->bvh.count == 0) {
+        return 0;
+    }
+
+    const bvhNode* nodes = mesh->bvh.nodes;
+    vector3d invDir = bvh_invDir(ray.dir);
+    size_t stack[BVH_STACK_SIZE];
+    size_t depth = 0;
+    real near, t;
+
+    ray.origin = vector3d_sub(ray.origin, mesh->pos);
+    stack[depth++] = 0;
+    while(depth > 0) {
+        const bvhNode* node = &(nodes[stack[--depth]]);
+        if(!bvh_hitBox(node, ray.origin, invDir, distance, &near)) {
+            continue;
+        }
+
+        if(node->count > 0) {
+            for(size_t i = node->first; i < node->first + node->count; i++) {
+                t = face_intersection(ray, mesh, i);
+                if(t > 0 && t < distance) {
+                    *face = i;
+                    return 1;
+                }
+            }
+        }
+        else {
+            stack[depth++] = node->first + 1;
+            stack[depth++] = node->first;
+        }
+    }
+
+    return 0;
+}
+
+real getRadialAtten(real distance, const bakedLight* light) {
     if(distance == INFINITY) {
         return 1;
     }
@@ -183,31 +1345,28 @@ double getRadialAtten(vector3d intersection, sceneLight* light) {
     }
 }
 
-double getAngularAtten(vector3d intersection, sceneLight* light) {
+real getAngularAtten(vector3d intersection, const bakedLight* light) {
     // Not spot light
-    if(light->theta == 0 || light->angularAtten == 0 || (
-            light->dir.x == 0 && light->dir.y == 0 && light->dir.z == 0)) {
+    if(!light->spot) {
         return 1;
     }
 
     vector3d objVector = vector3d_normalize(vector3d_sub(intersection, light->pos));
-    double cosAlpha = vector3d_dot(objVector, light->dir);
-    double cosTheta = cos(light->theta * PI / 180.0);
-    if(cosAlpha > cosTheta) {
+    real cosAlpha = vector3d_dot(objVector, light->dir);
+    if(cosAlpha > light->cosTheta) {
         return 0;
     }
 
-    return pow(clamp(vector3d_dot(objVector, light->pos), 0, INFINITY),
+    return real_pow(clamp(vector3d_dot(objVector, light->pos), 0, INFINITY),
         light->angularAtten);
 }
 
-vector3d getDiffuse(vector3d intersection, sceneObj* closest, sceneLight* light) {
-    vector3d dir = vector3d_normalize(vector3d_sub(light->pos, intersection));
-    vector3d normal = getNormal(intersection, closest);
-    double cosAlpha = vector3d_dot(normal, dir);
+vector3d getDiffuse(vector3d normal, vector3d toLight,
+        const material* material, const bakedLight* light) {
+    real cosAlpha = vector3d_dot(normal, toLight);
 
     if(cosAlpha > 0) {
-        return vector3d_scale(vector3d_product(closest->diffuse, light->color),
+        return vector3d_scale(vector3d_product(material->diffuse, light->color),
             cosAlpha);
     }
     else {
@@ -215,21 +1374,20 @@ vector3d getDiffuse(vector3d intersection, sceneObj* closest, sceneLight* light)
     }
 }
 
-vector3d getSpecular(ray ray, vector3d intersection, sceneObj* closest, sceneLight* light) {
-    vector3d dir = vector3d_normalize(vector3d_sub(light->pos, intersection));
-    vector3d normal = getNormal(intersection, closest);
+vector3d getSpecular(ray ray, vector3d normal, vector3d toLight,
+        const material* material, const bakedLight* light) {
     vector3d v = vector3d_scale(ray.dir, -1);
-    double cosAlpha = vector3d_dot(normal, dir);
+    real cosAlpha = vector3d_dot(normal, toLight);
     vector3d r = vector3d_sub(
-        vector3d_scale(normal, vector3d_dot(vector3d_scale(normal, 2), dir)),
-        dir
+        vector3d_scale(normal, vector3d_dot(vector3d_scale(normal, 2), toLight)),
+        toLight
     );
-    double cosBeta = vector3d_dot(v, r);
+    real cosBeta = vector3d_dot(v, r);
 
     if(cosBeta > 0 && cosAlpha > 0) {
         return vector3d_scale(
-            vector3d_product(closest->specular, light->color),
-            pow(cosBeta, closest->ns)
+            vector3d_product(material->specular, light->color),
+            real_pow(cosBeta, material->ns)
         );
     }
     else {
@@ -237,14 +1395,14 @@ vector3d getSpecular(ray ray, vector3d intersection, sceneObj* closest, sceneLig
     }
 }
 
-double plane_intersection(ray ray, sceneObj* obj) {
-    double denominator = vector3d_dot(obj->plane.normal, ray.dir);
+real plane_intersection(ray ray, vector3d pos, vector3d normal) {
+    real denominator = vector3d_dot(normal, ray.dir);
     // If the denominator is 0, then ray is parallel to plane
     if(denominator == 0) {
         return -1;
     }
-    double t = - vector3d_dot(obj->plane.normal,
-        vector3d_sub(ray.origin, obj->plane.pos)) / denominator;
+    real t = - vector3d_dot(normal, vector3d_sub(ray.origin, pos)) /
+        denominator;
 
     if(t > 0) {
         return t;
@@ -253,20 +1411,42 @@ double plane_intersection(ray ray, sceneObj* obj) {
     return -1;
 }
 
-double sphere_intersection(ray ray, sceneObj* obj) {
+// plane_intersection() with the origin at { 0, 0, 0 }, where
+// -n . (Ro - p) is just the baked n . p
+real plane_primary(vector3d dir, vector3d normal, real nDotP) {
+    real denominator = vector3d_dot(normal, dir);
+    // If the denominator is 0, then ray is parallel to plane
+    if(denominator == 0) {
+        return -1;
+    }
+    real t = nDotP / denominator;
+
+    if(t > 0) {
+        return t;
+    }
+
+    return -1;
+}
+
+real sphere_intersection(ray ray, vector3d pos, real radius) {
     // t_close = Rd * (C - Ro) closest apprach along ray
     // x_close = Ro + t_close*Rd closest point from circle center
     // d = ||x_close - C|| distance from circle center
-    // a = sqrt(rad^2 - d^2)
+    // a = real_sqrt(rad^2 - d^2)
     // t = t_close - a
-    double t = vector3d_dot(ray.dir, vector3d_sub(obj->sphere.pos, ray.origin));
+    real t = vector3d_dot(ray.dir, vector3d_sub(pos, ray.origin));
+    // Both t_close - a and t_close are <= t_close, so a center behind the
+    // origin can never give a positive t
+    if(t <= 0) {
+        return -1;
+    }
     vector3d point = getIntersection(ray, t);
-    double magnitude = vector3d_magnitude(vector3d_sub(point, obj->sphere.pos));
-    if(magnitude > obj->sphere.radius) {
+    real magnitude = vector3d_magnitude(vector3d_sub(point, pos));
+    if(magnitude > radius) {
         return -1;
     }
-    else if(magnitude < obj->sphere.radius) {
-        double a = sqrt(pow(obj->sphere.radius, 2) - pow(magnitude, 2));
+    else if(magnitude < radius) {
+        real a = real_sqrt(real_pow(radius, 2) - real_pow(magnitude, 2));
 
         return t - a;
     }
@@ -275,7 +1455,64 @@ double sphere_intersection(ray ray, sceneObj* obj) {
     }
 }
 
-double cylinder_intersection(ray ray, sceneObj* obj) {
+// sphere_intersection() with the origin at { 0, 0, 0 }. Misses are rejected
+// from the baked |C|^2 - r^2 before paying for the square roots; anything
+// else takes the exact same steps as the general case.
+real sphere_primary(vector3d dir, vector3d pos, real radius,
+        real originC) {
+    real t = vector3d_dot(dir, pos);
+    if(t <= 0 || t * t < originC) {
+        return -1;
+    }
+
+    ray ray = { { 0, 0, 0 }, dir };
+    return sphere_intersection(ray, pos, radius);
+}
+
+// Moller-Trumbore. Every comparison is written to fail on NaN, as the packet
+// kernel's masks do, so both reject the same rays.
+real triangle_intersection(ray ray, vector3d v0, vector3d v1, vector3d v2) {
+    vector3d edge1 = vector3d_sub(v1, v0);
+    vector3d edge2 = vector3d_sub(v2, v0);
+    vector3d p = vector3d_cross(ray.dir, edge2);
+    real det = vector3d_dot(edge1, p);
+    // If the determinant is 0, then ray is parallel to the triangle
+    if(det == 0) {
+        return -1;
+    }
+    real inverse = 1 / det;
+
+    vector3d s = vector3d_sub(ray.origin, v0);
+    real u = vector3d_dot(s, p) * inverse;
+    if(!(u >= 0 && u <= 1)) {
+        return -1;
+    }
+
+    vector3d q = vector3d_cross(s, edge1);
+    real v = vector3d_dot(ray.dir, q) * inverse;
+    if(!(v >= 0 && u + v <= 1)) {
+        return -1;
+    }
+
+    real t = vector3d_dot(edge2, q) * inverse;
+    if(t > 0) {
+        return t;
+    }
+
+    return -1;
+}
+
+// triangle_intersection() against face of mesh, for a ray whose origin is
+// already in mesh coordinates
+real face_intersection(ray ray, const mesh* mesh, size_t face) {
+    vector3d v0, v1, v2;
+
+    mesh_face(mesh, face, &v0, &v1, &v2);
+
+    return triangle_intersection(ray, v0, v1, v2);
+}
+
+real cylinder_intersection(ray ray, sceneObj* obj) {
     // Step 1. Find the equation for the object you are innterested in
     // x^2 + y^2 = r^2
     //
@@ -310,32 +1547,32 @@ double cylinder_intersection(ray ray, sceneObj* obj) {
     // Use the quadratic equation to solve for t
     //
 
-    double a = pow(ray.dir.x, 2) + pow(ray.dir.x, 2);
-    double b = 2 * (
+    real a = real_pow(ray.dir.x, 2) + real_pow(ray.dir.x, 2);
+    real b = 2 * (
         ray.origin.x * ray.dir.x -
         ray.dir.z * obj->cylinder.pos.x +
         ray.origin.z * ray.dir.z -
         ray.dir.z * obj->cylinder.pos.z
     );
-    double c = pow(ray.origin.z, 2) -
+    real c = real_pow(ray.origin.z, 2) -
         2 * ray.origin.x * obj->cylinder.pos.x +
-        pow(obj->cylinder.pos.x, 2) + pow(ray.origin.z, 2) -
+        real_pow(obj->cylinder.pos.x, 2) + real_pow(ray.origin.z, 2) -
         2 * ray.origin.z * obj->cylinder.pos.z +
-        pow(obj->cylinder.pos.z, 2);
+        real_pow(obj->cylinder.pos.z, 2);
 
-    double determinant = pow(b, 2) - 4 * a *c;
+    real determinant = real_pow(b, 2) - 4 * a *c;
     if (determinant < 0) {
         return -1;
     }
 
-    determinant = sqrt(determinant);
+    determinant = real_sqrt(determinant);
 
-    double t0 = (-b - determinant) / (2 * a);
+    real t0 = (-b - determinant) / (2 * a);
     if(t0 > 0) {
         return t0;
     }
 
-    double t1 = (-b + determinant) / (2 * a);
+    real t1 = (-b + determinant) / (2 * a);
     if (t1 > 0) {
         return t1;
     }
@@ -3,56 +3,100 @@
 
 #include <stddef.h>
 
+#include "gbuffer.h"
+#include "hdr.h"
 #include "pnm.h"
-#include "vector3d.h"
+#include "scene.h"
 
-#define TYPE_SPHERE 0
-#define TYPE_PLANE 1
+#define HIT_SPHERE 0
+#define HIT_PLANE 1
+#define HIT_MESH 2
 
-#define DEFAULT_NS 20
-
-typedef struct sceneObj {
+typedef struct shootObj {
+    real t;
+    // Position in the parsed objs array, which indexes scene->materials
+    size_t obj;
+    // HIT_SPHERE, HIT_PLANE or HIT_MESH, and the index into that type's
+    // arrays
     int type;
-    vector3d diffuse;
-    vector3d specular;
-    double ns;
-    union {
-        struct {
-            vector3d pos;
-            double radius;
-        } sphere;
-        struct {
-            vector3d pos;
-            vector3d normal;
-        } plane;
-        struct {
-            vector3d pos;
-            double radius;
-            double height;
-        } cylinder;
-    };
-} sceneObj;
-
-typedef struct sceneLight {
-    vector3d pos;
-    vector3d dir;
-    double theta;
-    vector3d color;
-    double radialAtten[3];
-    double angularAtten;
-} sceneLight;
-
-typedef struct camera {
-    float width;
-    float height;
-} camera;
-
-typedef struct ray {
-    vector3d origin;
-    vector3d dir;
-} ray;
-
-void raycast(pixel* pixels, size_t width, size_t height, camera camera,
-        sceneObj** objs, sceneLight** lights);
+    size_t prim;
+    // For meshes, the face hit. Equally close faces go to the lowest one.
+    size_t face;
+    int hit;
+} shootObj;
+
+#define SHADOW_CACHE_OFF 0
+#define SHADOW_CACHE_THREAD 1
+#define SHADOW_CACHE_TILE 2
+
+// Per-channel tolerance, in 8-bit levels, of the center probe of adaptive
+// mode
+#define DEFAULT_QUALITY 2
+
+// Luminance variance above which anti-aliasing takes more samples
+#define DEFAULT_VARIANCE 0.001
+#define MAX_SAMPLES 1024
+
+typedef struct renderOpts {
+    size_t threads;
+    // SHADOW_CACHE_*: whether every thread first retries the object that
+    // last blocked each light, and whether that is forgotten between tiles
+    int shadowCache;
+    // Block size of adaptive subdivision, or 0 to trace every pixel
+    size_t adaptive;
+    // How far, in 8-bit levels, an interpolated block may stray from its
+    // traced center before it is subdivided. Only the center is checked, so
+    // other pixels may stray further; 0 traces every pixel.
+    real quality;
+    // Samples every pixel gets, and how many a pixel may get in all when
+    // anti-aliasing refines it. Both 1 traces just the pixel center.
+    size_t baseSamples;
+    size_t maxSamples;
+    // Luminance variance, within a pixel or between neighbours, that
+    // triggers more samples
+    real variance;
+    // Sized to the frame by the caller. Unless relighting, every pixel's
+    // primary hit is saved to it; when relighting, shading starts from the
+    // saved hits and no primary rays are traced.
+    gbuffer* gbuffer;
+    int relight;
+    // Sized to the frame by the caller, or NULL. Every pixel's color is also
+    // saved to it as it was before clamping.
+    hdrImage* hdr;
+    // One flag per tile, in scheduler_tiles() order, or NULL to render the
+    // whole frame. Tiles left clear keep their pixels and G-buffer records
+    // from the previous frame.
+    const unsigned char* dirty;
+    // With rows set, only rows [firstRow, firstRow + rows) of the frame are
+    // rendered, and pixels holds just those rows. firstRow and rows should be
+    // multiples of DEFAULT_TILE_SIZE, short of the last band, so the tiles
+    // are the ones the whole frame would have. Cannot be combined with dirty.
+    size_t firstRow;
+    size_t rows;
+} renderOpts;
+
+typedef struct renderStats {
+    // Pixels rendered, which is fewer than the frame when opts->dirty is set
+    size_t pixels;
+    // Samples averaged into the rendered pixels: one per pixel without
+    // anti-aliasing, fewer than pixels with adaptive subdivision, and none
+    // when relighting
+    size_t samples;
+    // Primary rays traced for the frame. The same as samples, except that
+    // supersampled tiles also trace the ring of pixels around them.
+    size_t rays;
+    // Pixels anti-aliasing took extra samples for
+    size_t refined;
+} renderStats;
+
+void renderOpts_init(renderOpts* opts);
+int renderOpts_shadowCache(const char* value, int* mode);
+int renderOpts_adaptive(const char* value, size_t* size);
+int renderOpts_quality(const char* value, real* quality);
+int renderOpts_samples(const char* value, size_t* samples);
+int renderOpts_variance(const char* value, real* variance);
+
+int raycast(pixel* pixels, size_t width, size_t height, const scene* scene,
+        const renderOpts* opts, renderStats* stats);
 
 #endif // CS430_RAYCAST_H
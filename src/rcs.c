@@ -0,0 +1,437 @@
+// realpath() is an XSI extension
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rcs.h"
+#include "json.h"
+
+// Fixed-size header at the start of the file. Every part after it starts on
+// a SCENE_ALIGNMENT boundary, so the mapped arrays keep their alignment.
+typedef struct rcsHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    // Sizes of the types the arrays are made of, which differ between the
+    // double and float builds
+    uint32_t realSize;
+    uint32_t sizeSize;
+    uint32_t materialSize;
+    uint32_t lightSize;
+    uint32_t nodeSize;
+    uint32_t meshSize;
+    camera camera;
+    uint64_t objCount;
+    uint64_t lightCount;
+    uint64_t sphereCount;
+    uint64_t planeCount;
+    uint64_t meshCount;
+    uint64_t nodeCount;
+    // The arrays of scene_layout(), with the mesh slots left zeroed
+    uint64_t memoryOffset;
+    uint64_t memorySize;
+    uint64_t nodesOffset;
+    // meshCount rcsMesh records
+    uint64_t meshesOffset;
+    // The absolute path of the scene file, NUL terminated, and its
+    // modification time and size when it was compiled
+    uint64_t sourceOffset;
+    uint64_t sourceLength;
+    int64_t sourceSeconds;
+    int64_t sourceNanoseconds;
+    uint64_t sourceSize;
+} rcsHeader;
+
+// A mesh to load along with the scene
+typedef struct rcsMesh {
+    vector3d pos;
+    uint64_t obj;
+    // NUL terminated and absolute, so the file loads from any working
+    // directory
+    uint64_t pathOffset;
+    uint64_t pathLength;
+} rcsMesh;
+
+uint64_t rcsAlign(uint64_t size);
+int writePadding(FILE* file, uint64_t size);
+int sourceChanged(const rcsHeader* header, const char* source);
+int checkLayout(const rcsHeader* header, size_t fileSize, size_t memorySize);
+int checkIndices(const scene* scene);
+const char* fileString(const char* map, size_t fileSize, uint64_t offset,
+    uint64_t length);
+int compileSource(scene* scene, const char* source, size_t threads);
+char** meshPaths(const scene* scene, sceneObj** objs);
+void freeMeshPaths(char** paths, size_t count);
+
+int rcs_write(const char* path, const scene* scene, sceneObj** objs,
+        const char* sourcePath) {
+    rcsHeader header;
+    struct stat info;
+    char resolved[PATH_MAX];
+
+    if(stat(sourcePath, &info) < 0) {
+        perror("Error: Cannot open scene file");
+        return -1;
+    }
+    // Absolute, so the cache can be checked from any working directory
+    const char* source = realpath(sourcePath, resolved) != NULL ? resolved :
+        sourcePath;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RCS_MAGIC, sizeof(header.magic));
+    header.version = RCS_VERSION;
+    header.endian = RCS_ENDIAN;
+    header.realSize = sizeof(real);
+    header.sizeSize = sizeof(size_t);
+    header.materialSize = sizeof(material);
+    header.lightSize = sizeof(bakedLight);
+    header.nodeSize = sizeof(bvhNode);
+    header.meshSize = sizeof(mesh);
+    header.camera = scene->camera;
+    header.objCount = scene->objCount;
+    header.lightCount = scene->lightCount;
+    header.sphereCount = scene->spheres.count;
+    header.planeCount = scene->planes.count;
+    header.meshCount = scene->meshCount;
+    header.nodeCount = scene->bvh.nodeCount;
+    header.sourceSeconds = info.st_mtim.tv_sec;
+    header.sourceNanoseconds = info.st_mtim.tv_nsec;
+    header.sourceSize = info.st_size;
+
+    struct scene layout = *scene;
+    header.memorySize = scene_layout(&layout, NULL, header.sphereCount,
+        header.planeCount, header.meshCount);
+    size_t meshStart = (char*)scene->meshes - (char*)scene->memory;
+    size_t nodesSize = sizeof(bvhNode) * header.nodeCount;
+
+    header.memoryOffset = rcsAlign(sizeof(header));
+    header.nodesOffset = header.memoryOffset + header.memorySize;
+    header.meshesOffset = header.nodesOffset + rcsAlign(nodesSize);
+    char** paths = meshPaths(scene, objs);
+    if(paths == NULL) {
+        return -1;
+    }
+    uint64_t stringOffset = header.meshesOffset +
+        sizeof(rcsMesh) * header.meshCount;
+    for(size_t i = 0; i < scene->meshCount; i++) {
+        stringOffset += strlen(paths[i]) + 1;
+    }
+    header.sourceOffset = stringOffset;
+    header.sourceLength = strlen(source) + 1;
+
+    FILE* file = fopen(path, "wb");
+    if(file == NULL) {
+        perror("Error: Cannot open compiled scene file");
+        freeMeshPaths(paths, scene->meshCount);
+        return -1;
+    }
+
+    fwrite(&header, sizeof(header), 1, file);
+    writePadding(file, header.memoryOffset - sizeof(header));
+    // Mesh slots hold pointers into this process, so they are left for
+    // rcs_load() to fill in
+    fwrite(scene->memory, 1, meshStart, file);
+    writePadding(file, header.memorySize - meshStart);
+    fwrite(scene->bvh.nodes, sizeof(bvhNode), header.nodeCount, file);
+    writePadding(file, rcsAlign(nodesSize) - nodesSize);
+
+    uint64_t pathOffset = header.meshesOffset +
+        sizeof(rcsMesh) * header.meshCount;
+    for(size_t i = 0; i < scene->meshCount; i++) {
+        const mesh* mesh = &(scene->meshes[i]);
+        rcsMesh record;
+
+        memset(&record, 0, sizeof(record));
+        record.pos = mesh->pos;
+        record.obj = mesh->obj;
+        record.pathOffset = pathOffset;
+        record.pathLength = strlen(paths[i]) + 1;
+        pathOffset += record.pathLength;
+        fwrite(&record, sizeof(record), 1, file);
+    }
+    for(size_t i = 0; i < scene->meshCount; i++) {
+        fwrite(paths[i], 1, strlen(paths[i]) + 1, file);
+    }
+    fwrite(source, 1, header.sourceLength, file);
+    freeMeshPaths(paths, scene->meshCount);
+
+    if(ferror(file)) {
+        fprintf(stderr, "Error: Cannot write compiled scene file\n");
+        fclose(file);
+        return -1;
+    }
+    if(fclose(file) != 0) {
+        perror("Error: Cannot write compiled scene file");
+        return -1;
+    }
+
+    return 0;
+}
+
+int rcs_load(scene* scene, const char* path, size_t threads) {
+    struct stat info;
+
+    memset(scene, 0, sizeof(*scene));
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        perror("Error: Cannot open compiled scene file");
+        return -1;
+    }
+    if(fstat(fd, &info) < 0 || (size_t)info.st_size < sizeof(rcsHeader)) {
+        fprintf(stderr, "Error: '%s' is not a compiled scene file\n", path);
+        close(fd);
+        return -1;
+    }
+
+    // Private and writable, so the mesh slots can be filled in without
+    // touching the file
+    size_t fileSize = info.st_size;
+    char* map = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+        0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        perror("Error: Cannot map compiled scene file");
+        return -1;
+    }
+
+    const rcsHeader* header = (const rcsHeader*)map;
+    if(memcmp(header->magic, RCS_MAGIC, sizeof(header->magic)) != 0) {
+        fprintf(stderr, "Error: '%s' is not a compiled scene file\n", path);
+        munmap(map, fileSize);
+        return -1;
+    }
+    if(header->version != RCS_VERSION) {
+        fprintf(stderr, "Error: '%s' was compiled by another version of "
+            "raycast\n", path);
+        munmap(map, fileSize);
+        return -1;
+    }
+    if(header->endian != RCS_ENDIAN) {
+        fprintf(stderr, "Error: '%s' was compiled on a machine with a "
+            "different byte order\n", path);
+        munmap(map, fileSize);
+        return -1;
+    }
+    if(header->realSize != sizeof(real) || header->sizeSize != sizeof(size_t) ||
+            header->materialSize != sizeof(material) ||
+            header->lightSize != sizeof(bakedLight) ||
+            header->nodeSize != sizeof(bvhNode) ||
+            header->meshSize != sizeof(mesh)) {
+        fprintf(stderr, "Error: '%s' was compiled by a build with a different "
+            "precision\n", path);
+        munmap(map, fileSize);
+        return -1;
+    }
+
+    scene->camera = header->camera;
+    scene->objCount = header->objCount;
+    scene->lightCount = header->lightCount;
+    size_t memorySize = scene_layout(scene, NULL, header->sphereCount,
+        header->planeCount, header->meshCount);
+    const char* source = fileString(map, fileSize, header->sourceOffset,
+        header->sourceLength);
+    if(checkLayout(header, fileSize, memorySize) < 0 || source == NULL) {
+        fprintf(stderr, "Error: Compiled scene '%s' is truncated\n", path);
+        munmap(map, fileSize);
+        return -1;
+    }
+
+    if(sourceChanged(header, source)) {
+        fprintf(stderr, "Warning: '%s' changed after '%s' was compiled, so "
+            "it is read instead\n", source, path);
+        // The path goes away with the mapping
+        char* copy = malloc(strlen(source) + 1);
+        if(copy == NULL) {
+            fprintf(stderr, "Error: Memory allocation error\n");
+            munmap(map, fileSize);
+            return -1;
+        }
+        strcpy(copy, source);
+        munmap(map, fileSize);
+        memset(scene, 0, sizeof(*scene));
+
+        int status = compileSource(scene, copy, threads);
+        free(copy);
+        return status;
+    }
+
+    scene_layout(scene, map + header->memoryOffset, header->sphereCount,
+        header->planeCount, header->meshCount);
+    scene->spheres.count = header->sphereCount;
+    scene->planes.count = header->planeCount;
+    scene->bvh.nodes = (bvhNode*)(map + header->nodesOffset);
+    scene->bvh.nodeCount = header->nodeCount;
+    scene->bvh.count = header->sphereCount;
+    scene->map = map;
+    scene->mapSize = fileSize;
+
+    if(checkIndices(scene) < 0) {
+        fprintf(stderr, "Error: Compiled scene '%s' is corrupt\n", path);
+        scene_free(scene);
+        return -1;
+    }
+
+    const rcsMesh* records = (const rcsMesh*)(map + header->meshesOffset);
+    for(size_t i = 0; i < header->meshCount; i++) {
+        const char* meshPath = fileString(map, fileSize,
+            records[i].pathOffset, records[i].pathLength);
+        if(meshPath == NULL || records[i].obj >= scene->objCount) {
+            fprintf(stderr, "Error: Compiled scene '%s' is corrupt\n", path);
+            scene_free(scene);
+            return -1;
+        }
+        if(mesh_load(&(scene->meshes[i]), meshPath, records[i].pos,
+                records[i].obj, NULL) < 0) {
+            scene_free(scene);
+            return -1;
+        }
+        scene->meshCount++;
+    }
+
+    return 0;
+}
+
+uint64_t rcsAlign(uint64_t size) {
+    return (size + SCENE_ALIGNMENT - 1) / SCENE_ALIGNMENT * SCENE_ALIGNMENT;
+}
+
+int writePadding(FILE* file, uint64_t size) {
+    static const char zeros[SCENE_ALIGNMENT] = { 0 };
+
+    while(size > 0) {
+        size_t chunk = size < sizeof(zeros) ? size : sizeof(zeros);
+        if(fwrite(zeros, 1, chunk, file) != chunk) {
+            return -1;
+        }
+        size -= chunk;
+    }
+
+    return 0;
+}
+
+// Whether the scene file is no longer the one the cache was compiled from. A
+// scene file that is gone leaves the cache as the only copy, so it is used.
+int sourceChanged(const rcsHeader* header, const char* source) {
+    struct stat info;
+
+    if(stat(source, &info) < 0) {
+        return 0;
+    }
+
+    return info.st_mtim.tv_sec != header->sourceSeconds ||
+        info.st_mtim.tv_nsec != header->sourceNanoseconds ||
+        (uint64_t)info.st_size != header->sourceSize;
+}
+
+// Whether every part the header points to is where it should be and inside
+// the file
+int checkLayout(const rcsHeader* header, size_t fileSize, size_t memorySize) {
+    uint64_t nodesEnd = header->nodesOffset +
+        sizeof(bvhNode) * header->nodeCount;
+
+    if(header->objCount > fileSize || header->lightCount > fileSize ||
+            header->nodeCount > fileSize || header->meshCount > fileSize ||
+            header->sphereCount + header->planeCount + header->meshCount !=
+            header->objCount) {
+        return -1;
+    }
+    if(header->memoryOffset != rcsAlign(sizeof(*header)) ||
+            header->memorySize != memorySize ||
+            header->nodesOffset != header->memoryOffset + memorySize ||
+            nodesEnd > fileSize || header->meshesOffset < nodesEnd ||
+            header->meshesOffset % SCENE_ALIGNMENT != 0 ||
+            header->meshesOffset > fileSize || header->meshCount >
+            (fileSize - header->meshesOffset) / sizeof(rcsMesh)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+// Whether every object index and tree link stays inside its array, so a
+// damaged file cannot send the renderer out of bounds
+int checkIndices(const scene* scene) {
+    for(size_t i = 0; i < scene->spheres.count; i++) {
+        if(scene->spheres.obj[i] >= scene->objCount) {
+            return -1;
+        }
+    }
+    for(size_t i = 0; i < scene->planes.count; i++) {
+        if(scene->planes.obj[i] >= scene->objCount) {
+            return -1;
+        }
+    }
+    for(size_t i = 0; i < scene->bvh.nodeCount; i++) {
+        const bvhNode* node = &(scene->bvh.nodes[i]);
+        if(node->count == 0 ? node->first >= scene->bvh.nodeCount - 1 ||
+                node->first <= i : node->count > scene->spheres.count ||
+                node->first > scene->spheres.count - node->count) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// The NUL terminated string of length bytes at offset, or NULL if it is not
+// all in the file
+const char* fileString(const char* map, size_t fileSize, uint64_t offset,
+        uint64_t length) {
+    if(length == 0 || offset > fileSize || length > fileSize - offset ||
+            map[offset + length - 1] != '\0') {
+        return NULL;
+    }
+
+    return map + offset;
+}
+
+// Parses and compiles the scene file the cache was made from
+int compileSource(scene* scene, const char* source, size_t threads) {
+    jsonObj jsonObj = readScene(source, threads);
+    int status = scene_compile(scene, jsonObj.camera, jsonObj.objs,
+        jsonObj.lights, NULL);
+    freeScene(&jsonObj);
+
+    return status;
+}
+
+// The absolute path of every mesh of scene, in scene->meshes order. Each
+// mesh loaded, so its file exists; should realpath() fail anyway, the path
+// is kept as the scene gave it.
+char** meshPaths(const scene* scene, sceneObj** objs) {
+    char** paths = calloc(scene->meshCount + 1, sizeof(*paths));
+    if(paths == NULL) {
+        fprintf(stderr, "Error: Memory allocation error\n");
+        return NULL;
+    }
+
+    for(size_t i = 0; i < scene->meshCount; i++) {
+        const char* path = objs[scene->meshes[i].obj]->mesh.path;
+        paths[i] = realpath(path, NULL);
+        if(paths[i] == NULL) {
+            paths[i] = strdup(path);
+        }
+        if(paths[i] == NULL) {
+            fprintf(stderr, "Error: Memory allocation error\n");
+            freeMeshPaths(paths, i);
+            return NULL;
+        }
+    }
+
+    return paths;
+}
+
+void freeMeshPaths(char** paths, size_t count) {
+    for(size_t i = 0; i < count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+}
@@ -0,0 +1,30 @@
+#ifndef CS430_RCS_H
+#define CS430_RCS_H
+
+#include <stdint.h>
+
+#include "scene.h"
+
+// Magic number at the start of every compiled scene file
+#define RCS_MAGIC "RCSCENE"
+// Bumped whenever the layout of the file or of the scene arrays changes
+#define RCS_VERSION 1
+// Written as a native uint32_t, so a file from a machine with the other
+// byte order reads it back swapped
+#define RCS_ENDIAN 0x01020304u
+
+// Writes the compiled form of the scene at sourcePath to path: the arrays
+// of the compiled scene and its tree as they are in memory, and the absolute
+// paths of the mesh files to load. objs are the parsed objects scene was
+// compiled from. Only the scene file is checked for changes when loading;
+// a mesh file that changed is loaded as it is now.
+int rcs_write(const char* path, const scene* scene, sceneObj** objs,
+    const char* sourcePath);
+// Maps a file rcs_write() wrote and points scene into it, so nothing is
+// parsed or rebuilt except the trees of meshes. If the scene file it was
+// compiled from has changed since, that is parsed (on up to threads threads)
+// and compiled instead. Files only load in builds with the same real type and
+// byte order.
+int rcs_load(scene* scene, const char* path, size_t threads);
+
+#endif // CS430_RCS_H
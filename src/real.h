@@ -0,0 +1,38 @@
+#ifndef CS430_REAL_H
+#define CS430_REAL_H
+
+#include <math.h>
+
+// Scalar type of the whole render pipeline. The default build uses double;
+// compiling with -DRAYCAST_FLOAT (out/raycast-f32) switches everything from
+// parsed scene values to the packet kernels over to float.
+#ifdef RAYCAST_FLOAT
+
+typedef float real;
+
+#define real_sqrt(x) sqrtf(x)
+#define real_pow(x, y) powf(x, y)
+#define real_fabs(x) fabsf(x)
+#define real_cos(x) cosf(x)
+#define real_fmin(x, y) fminf(x, y)
+#define real_fmax(x, y) fmaxf(x, y)
+
+// Relative slack for the conservative tests of scene.c, a few hundred ulps
+#define REAL_ROUNDING 1e-5
+
+#else
+
+typedef double real;
+
+#define real_sqrt(x) sqrt(x)
+#define real_pow(x, y) pow(x, y)
+#define real_fabs(x) fabs(x)
+#define real_cos(x) cos(x)
+#define real_fmin(x, y) fmin(x, y)
+#define real_fmax(x, y) fmax(x, y)
+
+#define REAL_ROUNDING 1e-9
+
+#endif // RAYCAST_FLOAT
+
+#endif // CS430_REAL_H
@@ -0,0 +1,326 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/mman.h>
+
+#include "scene.h"
+
+// Sphere boxes are padded by this much relative to their size so rounding in
+// the slab test can never cull a hit sphere_intersection() would report.
+#define SCENE_BOUNDS_EPSILON REAL_ROUNDING
+// Likewise for the primary ray miss test against originC, relative to |C|^2
+#define SCENE_ORIGIN_EPSILON REAL_ROUNDING
+
+#define PI 3.14159265358979323846
+
+// 64-bit FNV-1a
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+size_t alignSize(size_t size);
+void* carve(char* memory, size_t* offset, size_t size);
+vector3d normalizeNonZero(vector3d vector);
+uint64_t hashBytes(uint64_t hash, const void* data, size_t size);
+int compileScene(scene* scene, camera camera, sceneObj** objs,
+    sceneLight** lights, const mesh* loaded, char* error);
+
+int scene_compile(scene* scene, camera camera, sceneObj** objs,
+        sceneLight** lights, char* error) {
+    return compileScene(scene, camera, objs, lights, NULL, error);
+}
+
+int scene_recompile(scene* scene, camera camera, sceneObj** objs,
+        sceneLight** lights) {
+    size_t meshCount = scene->meshCount;
+    mesh* meshes = malloc(sizeof(*meshes) * (meshCount + 1));
+    if(meshes == NULL) {
+        fprintf(stderr, "Error: Memory allocation error\n");
+        return -1;
+    }
+
+    // Take the meshes out before freeing the rest, so they stay loaded
+    memcpy(meshes, scene->meshes, sizeof(*meshes) * meshCount);
+    scene->meshCount = 0;
+    scene_free(scene);
+
+    int status = compileScene(scene, camera, objs, lights, meshes, NULL);
+    if(status < 0) {
+        // A failed compile never gets as far as taking the meshes over
+        for(size_t i = 0; i < meshCount; i++) {
+            mesh_free(&(meshes[i]));
+        }
+    }
+    free(meshes);
+
+    return status;
+}
+
+// scene_compile(), loading every mesh unless loaded already holds them, in
+// objs order. The meshes in loaded are moved into scene, and cannot fail.
+int compileScene(scene* scene, camera camera, sceneObj** objs,
+        sceneLight** lights, const mesh* loaded, char* error) {
+    size_t sphereCount = 0;
+    size_t planeCount = 0;
+    size_t meshCount = 0;
+
+    memset(scene, 0, sizeof(*scene));
+    scene->camera = camera;
+
+    for(; objs[scene->objCount] != NULL; scene->objCount++) {
+        if(objs[scene->objCount]->type == TYPE_SPHERE) {
+            sphereCount++;
+        }
+        else if(objs[scene->objCount]->type == TYPE_PLANE) {
+            planeCount++;
+        }
+        else {
+            meshCount++;
+        }
+    }
+    for(; lights[scene->lightCount] != NULL; scene->lightCount++);
+
+    // Build the tree over the spheres in objs order first, since the leaf
+    // order it settles on decides the layout of the sphere arrays.
+    vector3d* mins = malloc(sizeof(*mins) * (sphereCount + 1));
+    vector3d* maxs = malloc(sizeof(*maxs) * (sphereCount + 1));
+    size_t* bounded = malloc(sizeof(*bounded) * (sphereCount + 1));
+    if(mins == NULL || maxs == NULL || bounded == NULL) {
+        fprintf(stderr, "Error: Memory allocation error\n");
+        free(mins);
+        free(maxs);
+        free(bounded);
+        return -1;
+    }
+
+    sphereCount = 0;
+    for(size_t i = 0; i < scene->objCount; i++) {
+        if(objs[i]->type == TYPE_SPHERE) {
+            vector3d pos = objs[i]->sphere.pos;
+            real radius = objs[i]->sphere.radius;
+            real pad = (radius + real_fabs(pos.x) + real_fabs(pos.y) +
+                real_fabs(pos.z)) * SCENE_BOUNDS_EPSILON;
+            vector3d extent = { radius + pad, radius + pad, radius + pad };
+
+            mins[sphereCount] = vector3d_sub(pos, extent);
+            maxs[sphereCount] = vector3d_add(pos, extent);
+            bounded[sphereCount++] = i;
+        }
+    }
+
+    int status = bvh_build(&(scene->bvh), mins, maxs, sphereCount);
+    free(mins);
+    free(maxs);
+    if(status < 0) {
+        free(bounded);
+        return -1;
+    }
+
+    size_t total = scene_layout(scene, NULL, sphereCount, planeCount,
+        meshCount);
+    scene->memory = aligned_alloc(SCENE_ALIGNMENT,
+        total > 0 ? total : SCENE_ALIGNMENT);
+    if(scene->memory == NULL) {
+        fprintf(stderr, "Error: Memory allocation error\n");
+        free(bounded);
+        scene_free(scene);
+        return -1;
+    }
+    scene_layout(scene, scene->memory, sphereCount, planeCount, meshCount);
+
+    for(size_t i = 0; i < scene->lightCount; i++) {
+        bakedLight* light = &(scene->lights[i]);
+
+        light->pos = lights[i]->pos;
+        light->dir = normalizeNonZero(lights[i]->dir);
+        light->color = lights[i]->color;
+        memcpy(light->radialAtten, lights[i]->radialAtten,
+            sizeof(light->radialAtten));
+        light->angularAtten = lights[i]->angularAtten;
+        light->cosTheta = real_cos(lights[i]->theta * PI / 180.0);
+        light->spot = !(lights[i]->theta == 0 || lights[i]->angularAtten == 0 ||
+            (light->dir.x == 0 && light->dir.y == 0 && light->dir.z == 0));
+    }
+
+    for(size_t i = 0; i < scene->objCount; i++) {
+        scene->materials[i].diffuse = objs[i]->diffuse;
+        scene->materials[i].specular = objs[i]->specular;
+        scene->materials[i].ns = objs[i]->ns;
+
+        if(objs[i]->type == TYPE_PLANE) {
+            size_t plane = scene->planes.count++;
+            vector3d normal = normalizeNonZero(objs[i]->plane.normal);
+
+            scene->planes.x[plane] = objs[i]->plane.pos.x;
+            scene->planes.y[plane] = objs[i]->plane.pos.y;
+            scene->planes.z[plane] = objs[i]->plane.pos.z;
+            scene->planes.normalX[plane] = normal.x;
+            scene->planes.normalY[plane] = normal.y;
+            scene->planes.normalZ[plane] = normal.z;
+            scene->planes.nDotP[plane] = vector3d_dot(normal,
+                objs[i]->plane.pos);
+            scene->planes.obj[plane] = i;
+        }
+    }
+
+    for(size_t i = 0; i < scene->objCount; i++) {
+        if(objs[i]->type == TYPE_MESH && loaded != NULL) {
+            // Positions may have changed, but the trees are in mesh
+            // coordinates and still hold
+            scene->meshes[scene->meshCount] = loaded[scene->meshCount];
+            scene->meshes[scene->meshCount].pos = objs[i]->mesh.pos;
+            scene->meshes[scene->meshCount].obj = i;
+            scene->meshCount++;
+        }
+        else if(objs[i]->type == TYPE_MESH) {
+            if(mesh_load(&(scene->meshes[scene->meshCount]),
+                    objs[i]->mesh.path, objs[i]->mesh.pos, i, error) < 0) {
+                free(bounded);
+                scene_free(scene);
+                return -1;
+            }
+            scene->meshCount++;
+        }
+    }
+
+    // Lay spheres out in leaf order so leaves index the arrays directly
+    for(size_t i = 0; i < sphereCount; i++) {
+        sceneObj* obj = objs[bounded[scene->bvh.indices[i]]];
+
+        scene->spheres.x[i] = obj->sphere.pos.x;
+        scene->spheres.y[i] = obj->sphere.pos.y;
+        scene->spheres.z[i] = obj->sphere.pos.z;
+        scene->spheres.radius[i] = obj->sphere.radius;
+        real centerSquared = vector3d_dot(obj->sphere.pos, obj->sphere.pos);
+        scene->spheres.originC[i] = centerSquared -
+            obj->sphere.radius * obj->sphere.radius -
+            centerSquared * SCENE_ORIGIN_EPSILON;
+        scene->spheres.obj[i] = bounded[scene->bvh.indices[i]];
+    }
+    scene->spheres.count = sphereCount;
+
+    free(bounded);
+    free(scene->bvh.indices);
+    scene->bvh.indices = NULL;
+
+    return 0;
+}
+
+size_t scene_layout(scene* scene, char* memory, size_t sphereCount,
+        size_t planeCount, size_t meshCount) {
+    size_t sphereSize = sizeof(real) * sphereCount;
+    size_t planeSize = sizeof(real) * planeCount;
+    size_t offset = 0;
+
+    scene->materials = carve(memory, &offset,
+        sizeof(material) * scene->objCount);
+    scene->lights = carve(memory, &offset,
+        sizeof(bakedLight) * scene->lightCount);
+    scene->spheres.x = carve(memory, &offset, sphereSize);
+    scene->spheres.y = carve(memory, &offset, sphereSize);
+    scene->spheres.z = carve(memory, &offset, sphereSize);
+    scene->spheres.radius = carve(memory, &offset, sphereSize);
+    scene->spheres.originC = carve(memory, &offset, sphereSize);
+    scene->spheres.obj = carve(memory, &offset, sizeof(size_t) * sphereCount);
+    scene->planes.x = carve(memory, &offset, planeSize);
+    scene->planes.y = carve(memory, &offset, planeSize);
+    scene->planes.z = carve(memory, &offset, planeSize);
+    scene->planes.normalX = carve(memory, &offset, planeSize);
+    scene->planes.normalY = carve(memory, &offset, planeSize);
+    scene->planes.normalZ = carve(memory, &offset, planeSize);
+    scene->planes.nDotP = carve(memory, &offset, planeSize);
+    scene->planes.obj = carve(memory, &offset, sizeof(size_t) * planeCount);
+    scene->meshes = carve(memory, &offset, sizeof(mesh) * meshCount);
+
+    return offset;
+}
+
+void scene_free(scene* scene) {
+    for(size_t i = 0; i < scene->meshCount; i++) {
+        mesh_free(&(scene->meshes[i]));
+    }
+    // A loaded scene's arrays and tree live in its mapped file
+    if(scene->map != NULL) {
+        munmap(scene->map, scene->mapSize);
+    }
+    else {
+        bvh_free(&(scene->bvh));
+        free(scene->memory);
+    }
+    memset(scene, 0, sizeof(*scene));
+}
+
+uint64_t scene_hash(const scene* scene) {
+    const sphereArray* spheres = &(scene->spheres);
+    const planeArray* planes = &(scene->planes);
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    hash = hashBytes(hash, &(scene->camera.width), sizeof(scene->camera.width));
+    hash = hashBytes(hash, &(scene->camera.height),
+        sizeof(scene->camera.height));
+    hash = hashBytes(hash, &(scene->objCount), sizeof(scene->objCount));
+
+    hash = hashBytes(hash, spheres->x, sizeof(real) * spheres->count);
+    hash = hashBytes(hash, spheres->y, sizeof(real) * spheres->count);
+    hash = hashBytes(hash, spheres->z, sizeof(real) * spheres->count);
+    hash = hashBytes(hash, spheres->radius, sizeof(real) * spheres->count);
+    hash = hashBytes(hash, spheres->obj, sizeof(size_t) * spheres->count);
+
+    hash = hashBytes(hash, planes->x, sizeof(real) * planes->count);
+    hash = hashBytes(hash, planes->y, sizeof(real) * planes->count);
+    hash = hashBytes(hash, planes->z, sizeof(real) * planes->count);
+    hash = hashBytes(hash, planes->normalX, sizeof(real) * planes->count);
+    hash = hashBytes(hash, planes->normalY, sizeof(real) * planes->count);
+    hash = hashBytes(hash, planes->normalZ, sizeof(real) * planes->count);
+    hash = hashBytes(hash, planes->obj, sizeof(size_t) * planes->count);
+
+    for(size_t i = 0; i < scene->meshCount; i++) {
+        const mesh* mesh = &(scene->meshes[i]);
+
+        hash = hashBytes(hash, &(mesh->pos), sizeof(mesh->pos));
+        hash = hashBytes(hash, &(mesh->obj), sizeof(mesh->obj));
+        hash = hashBytes(hash, mesh->vertices,
+            sizeof(float) * 3 * mesh->vertexCount);
+        hash = hashBytes(hash, mesh->faces,
+            sizeof(*(mesh->faces)) * 3 * mesh->faceCount);
+    }
+
+    return hash;
+}
+
+size_t alignSize(size_t size) {
+    return (size + SCENE_ALIGNMENT - 1) / SCENE_ALIGNMENT * SCENE_ALIGNMENT;
+}
+
+// The next size bytes of memory from offset, each block starting on its own
+// cache line. NULL when memory is, which only works out the offsets.
+void* carve(char* memory, size_t* offset, size_t size) {
+    void* block = memory != NULL ? memory + *offset : NULL;
+    *offset += alignSize(size);
+
+    return block;
+}
+
+// A zero vector has no direction and is left alone rather than turned into
+// NaNs
+vector3d normalizeNonZero(vector3d vector) {
+    vector3d zeroVector = { 0 };
+
+    if(vector3d_compare(vector, zeroVector) != 0) {
+        return vector3d_normalize(vector);
+    }
+
+    return vector;
+}
+
+uint64_t hashBytes(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = data;
+
+    for(size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+
+    return hash;
+}
@@ -0,0 +1,162 @@
+#ifndef CS430_SCENE_H
+#define CS430_SCENE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bvh.h"
+#include "mesh.h"
+#include "vector3d.h"
+
+#define TYPE_SPHERE 0
+#define TYPE_PLANE 1
+#define TYPE_MESH 2
+
+#define DEFAULT_NS 20
+
+#define SCENE_ALIGNMENT 64
+
+typedef struct sceneObj {
+    int type;
+    vector3d diffuse;
+    vector3d specular;
+    real ns;
+    union {
+        struct {
+            vector3d pos;
+            real radius;
+        } sphere;
+        struct {
+            vector3d pos;
+            vector3d normal;
+        } plane;
+        struct {
+            vector3d pos;
+            real radius;
+            real height;
+        } cylinder;
+        struct {
+            vector3d pos;
+            // Path of the mesh file, in the arena of the scene it came from
+            char* path;
+        } mesh;
+    };
+} sceneObj;
+
+typedef struct sceneLight {
+    vector3d pos;
+    vector3d dir;
+    real theta;
+    vector3d color;
+    real radialAtten[3];
+    real angularAtten;
+} sceneLight;
+
+typedef struct camera {
+    float width;
+    float height;
+} camera;
+
+typedef struct ray {
+    vector3d origin;
+    vector3d dir;
+} ray;
+
+typedef struct material {
+    vector3d diffuse;
+    vector3d specular;
+    real ns;
+} material;
+
+// Structure-of-arrays copies of the geometry. Each array starts on its own
+// cache line. obj maps back to the position in the parsed objs array, which
+// indexes the material table and decides ties between equally close hits.
+typedef struct sphereArray {
+    real* x;
+    real* y;
+    real* z;
+    real* radius;
+    // |C|^2 - r^2 as seen from the camera origin, less a rounding margin.
+    // A primary ray whose t_close^2 falls below it misses the sphere.
+    real* originC;
+    size_t* obj;
+    size_t count;
+} sphereArray;
+
+typedef struct planeArray {
+    real* x;
+    real* y;
+    real* z;
+    // Normalized unless the scene gave a zero normal
+    real* normalX;
+    real* normalY;
+    real* normalZ;
+    // n . p, the numerator of t for rays leaving the camera origin
+    real* nDotP;
+    size_t* obj;
+    size_t count;
+} planeArray;
+
+// A light with its per-frame constants worked out once
+typedef struct bakedLight {
+    vector3d pos;
+    // Normalized spot direction
+    vector3d dir;
+    vector3d color;
+    real radialAtten[3];
+    real angularAtten;
+    // real_cos(theta) of the spot cone
+    real cosTheta;
+    // 0 if the angular falloff does not apply to this light
+    int spot;
+} bakedLight;
+
+// The compiled form of a parsed scene that the renderer works from, with
+// everything that does not change between rays computed up front. All arrays
+// are carved out of the single allocation in memory.
+typedef struct scene {
+    camera camera;
+    bakedLight* lights;
+    size_t lightCount;
+    material* materials;
+    size_t objCount;
+    // Spheres are stored in BVH leaf order, so every leaf covers a
+    // contiguous run of sphere indices.
+    sphereArray spheres;
+    // Planes have no bounds, so they stay out of the tree and are tested
+    // linearly in objs order.
+    planeArray planes;
+    // Every mesh has its own tree over its triangles. Meshes are few, so
+    // they are tested one after another, starting at the root of each tree.
+    mesh* meshes;
+    size_t meshCount;
+    bvh bvh;
+    void* memory;
+    // Set when the arrays and the tree are in a mapped compiled scene file
+    // (see rcs.h) rather than in memory and bvh.nodes
+    void* map;
+    size_t mapSize;
+} scene;
+
+// Compiles the parsed camera, objs and lights into scene. A mesh that fails
+// to load is reported to error as in mesh_load(); other failures go to
+// stderr.
+int scene_compile(scene* scene, camera camera, sceneObj** objs,
+    sceneLight** lights, char* error);
+// Compiles scene again from objs and lights, which must hold the same
+// objects it was compiled from, though their properties may differ. The
+// meshes stay loaded instead of being mapped and built again, and only move
+// to their new positions. On failure scene is left freed.
+int scene_recompile(scene* scene, camera camera, sceneObj** objs,
+    sceneLight** lights);
+// Points the arrays of scene into memory, laid out for objCount, lightCount
+// and the given counts of each kind of object, and returns the bytes they
+// take. With memory NULL it only works out the size.
+size_t scene_layout(scene* scene, char* memory, size_t sphereCount,
+    size_t planeCount, size_t meshCount);
+void scene_free(scene* scene);
+// Fingerprint of everything a primary ray depends on: the camera and the
+// geometry, but not materials or lights
+uint64_t scene_hash(const scene* scene);
+
+#endif // CS430_SCENE_H
@@ -0,0 +1,208 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "scheduler.h"
+
+// Every deque is a window [top, bottom) of indices into the tile array.
+// Owners pop from the bottom and thieves take half from the top, so the
+// windows never overlap and nothing is ever copied.
+typedef struct tileDeque {
+    pthread_mutex_t lock;
+    size_t top;
+    size_t bottom;
+} tileDeque;
+
+typedef struct schedulerCtx {
+    tile* tiles;
+    tileDeque* deques;
+    size_t threads;
+    tileFunc func;
+    void* data;
+} schedulerCtx;
+
+typedef struct worker {
+    pthread_t thread;
+    size_t id;
+    schedulerCtx* ctx;
+} worker;
+
+int popTile(tileDeque* deque, size_t* index);
+int stealTiles(schedulerCtx* ctx, size_t thief);
+void* workerRun(void* arg);
+
+int scheduler_threads(const char* value, size_t* threads) {
+    char* endptr;
+    size_t count = strtoul(value, &endptr, 10);
+    // Same whole-string validation as the width and height arguments.
+    // strtoul() skips leading spaces and would wrap a negative count
+    // around to a huge one, so refuse a sign anywhere in the string.
+    if(!(*value != '\0' && *endptr == '\0') || strchr(value, '-') != NULL) {
+        fprintf(stderr, "Error: Invalid thread count '%s'\n", value);
+        return -1;
+    }
+
+    // 0 means one worker per online core
+    if(count == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        count = online > 0 ? (size_t)online : 1;
+    }
+
+    *threads = count;
+
+    return 0;
+}
+
+tile* scheduler_tiles(size_t width, size_t height, size_t tileSize,
+        size_t* count) {
+    size_t columns = (width + tileSize - 1) / tileSize;
+    size_t rows = (height + tileSize - 1) / tileSize;
+
+    *count = columns * rows;
+    tile* tiles = malloc(sizeof(*tiles) * (*count > 0 ? *count : 1));
+    if(tiles == NULL) {
+        fprintf(stderr, "Error: Memory allocation error\n");
+        return NULL;
+    }
+
+    size_t i = 0;
+    for(size_t y = 0; y < height; y += tileSize) {
+        for(size_t x = 0; x < width; x += tileSize) {
+            tiles[i].x = x;
+            tiles[i].y = y;
+            tiles[i].width = x + tileSize > width ? width - x : tileSize;
+            tiles[i].height = y + tileSize > height ? height - y : tileSize;
+            i++;
+        }
+    }
+
+    return tiles;
+}
+
+int scheduler_run(tile* tiles, size_t count, size_t threads, tileFunc func,
+        void* data) {
+    if(threads > count) {
+        threads = count;
+    }
+
+    if(threads <= 1) {
+        for(size_t i = 0; i < count; i++) {
+            func(tiles[i], 0, data);
+        }
+
+        return 0;
+    }
+
+    schedulerCtx ctx = { tiles, NULL, threads, func, data };
+    worker* workers = malloc(sizeof(*workers) * threads);
+    ctx.deques = malloc(sizeof(*(ctx.deques)) * threads);
+    if(workers == NULL || ctx.deques == NULL) {
+        fprintf(stderr, "Error: Memory allocation error\n");
+        free(workers);
+        free(ctx.deques);
+        return -1;
+    }
+
+    // Hand each worker a contiguous band of tiles so neighbouring tiles tend
+    // to be rendered by the same core. Expensive bands get stolen from.
+    for(size_t i = 0; i < threads; i++) {
+        pthread_mutex_init(&(ctx.deques[i].lock), NULL);
+        ctx.deques[i].top = count * i / threads;
+        ctx.deques[i].bottom = count * (i + 1) / threads;
+
+        workers[i].id = i;
+        workers[i].ctx = &ctx;
+    }
+
+    int status = 0;
+    size_t started = 1;
+    for(; started < threads; started++) {
+        if(pthread_create(&(workers[started].thread), NULL, workerRun,
+                &(workers[started])) != 0) {
+            // The remaining deques are still drained by stealing
+            fprintf(stderr, "Warning: Could only start %zu threads\n", started);
+            break;
+        }
+    }
+
+    // The calling thread works as worker 0
+    workerRun(&(workers[0]));
+
+    for(size_t i = 1; i < started; i++) {
+        if(pthread_join(workers[i].thread, NULL) != 0) {
+            fprintf(stderr, "Error: Could not join render thread\n");
+            status = -1;
+        }
+    }
+
+    for(size_t i = 0; i < threads; i++) {
+        pthread_mutex_destroy(&(ctx.deques[i].lock));
+    }
+
+    free(workers);
+    free(ctx.deques);
+
+    return status;
+}
+
+int popTile(tileDeque* deque, size_t* index) {
+    int found = 0;
+
+    pthread_mutex_lock(&(deque->lock));
+    if(deque->top < deque->bottom) {
+        *index = --(deque->bottom);
+        found = 1;
+    }
+    pthread_mutex_unlock(&(deque->lock));
+
+    return found;
+}
+
+int stealTiles(schedulerCtx* ctx, size_t thief) {
+    for(size_t i = 1; i < ctx->threads; i++) {
+        tileDeque* victim = &(ctx->deques[(thief + i) % ctx->threads]);
+        size_t top, bottom;
+
+        pthread_mutex_lock(&(victim->lock));
+        size_t available = victim->bottom - victim->top;
+        // Take half from the top, rounding up so a single tile can be stolen
+        top = victim->top;
+        bottom = top + (available + 1) / 2;
+        victim->top = bottom;
+        pthread_mutex_unlock(&(victim->lock));
+
+        if(available > 0) {
+            tileDeque* own = &(ctx->deques[thief]);
+
+            pthread_mutex_lock(&(own->lock));
+            own->top = top;
+            own->bottom = bottom;
+            pthread_mutex_unlock(&(own->lock));
+
+            return 1;
+        }
+    }
+
+    // Tiles are never added once started, so empty deques everywhere means
+    // the frame is done.
+    return 0;
+}
+
+void* workerRun(void* arg) {
+    worker* self = arg;
+    schedulerCtx* ctx = self->ctx;
+    size_t index;
+
+    do {
+        while(popTile(&(ctx->deques[self->id]), &index)) {
+            ctx->func(ctx->tiles[index], self->id, ctx->data);
+        }
+    }
+    while(stealTiles(ctx, self->id));
+
+    return NULL;
+}
@@ -0,0 +1,25 @@
+#ifndef CS430_SCHEDULER_H
+#define CS430_SCHEDULER_H
+
+#include <stddef.h>
+
+#define DEFAULT_TILE_SIZE 32
+
+typedef struct tile {
+    size_t x;
+    size_t y;
+    size_t width;
+    size_t height;
+} tile;
+
+// Called once per tile on whichever worker ends up owning it. threadId is in
+// the range [0, threads) and stays fixed for the lifetime of a worker.
+typedef void (*tileFunc)(tile tile, size_t threadId, void* data);
+
+int scheduler_threads(const char* value, size_t* threads);
+tile* scheduler_tiles(size_t width, size_t height, size_t tileSize,
+    size_t* count);
+int scheduler_run(tile* tiles, size_t count, size_t threads, tileFunc func,
+    void* data);
+
+#endif // CS430_SCHEDULER_H
@@ -0,0 +1,462 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "serve.h"
+#include "json.h"
+#include "scene.h"
+#include "write.h"
+
+#define SERVE_BACKLOG 16
+// Milliseconds to wait before accepting again when out of resources
+#define SERVE_RETRY_DELAY 100
+
+typedef struct cachedScene {
+    char id[SERVE_ID_SIZE];
+    scene scene;
+    // Request serial that last used it, to find the stalest one to evict
+    size_t lastUsed;
+    int loaded;
+} cachedScene;
+
+typedef struct serveCtx {
+    const renderOpts* opts;
+    // Guards everything below. Renders hold it throughout, so a scene cannot
+    // be replaced or evicted while it is drawn.
+    pthread_mutex_t lock;
+    cachedScene scenes[SERVE_MAX_SCENES];
+    size_t serial;
+    // Framebuffer shared by all renders, grown to the largest frame so far
+    pixel* pixels;
+    size_t pixelCount;
+} serveCtx;
+
+typedef struct connection {
+    serveCtx* ctx;
+    int fd;
+    FILE* input;
+    // Set once the stream is out of step and must not be read again
+    int closed;
+    // The encoded image of the last render, reused by the next one
+    char* image;
+    size_t imageSize;
+} connection;
+
+void* serveConnection(void* arg);
+int handleRequest(connection* conn, char* line);
+int loadScene(connection* conn, const char* id, size_t bytes);
+int renderScene(connection* conn, const char* id, size_t width,
+    size_t height);
+int dropScene(connection* conn, const char* id);
+const char* outsideMeshPath(sceneObj** objs);
+cachedScene* findScene(serveCtx* ctx, const char* id);
+int reply(connection* conn, const char* data, size_t size);
+int replyError(connection* conn, const char* message);
+int sendAll(int fd, const char* data, size_t size);
+
+int serve_run(const char* socketPath, const renderOpts* opts) {
+    serveCtx ctx;
+    struct sockaddr_un address;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.opts = opts;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(socketPath) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: Socket path '%s' is too long\n", socketPath);
+        return -1;
+    }
+    strcpy(address.sun_path, socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        perror("Error: Cannot create socket");
+        return -1;
+    }
+
+    // A socket left behind by a server that is gone would make bind() fail,
+    // but one that still answers belongs to a running server
+    struct stat info;
+    if(stat(socketPath, &info) == 0 && S_ISSOCK(info.st_mode)) {
+        if(connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0) {
+            fprintf(stderr, "Error: A server is already running on %s\n",
+                socketPath);
+            close(fd);
+            return -1;
+        }
+        unlink(socketPath);
+    }
+
+    if(bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+            listen(fd, SERVE_BACKLOG) < 0) {
+        perror("Error: Cannot listen on socket");
+        close(fd);
+        return -1;
+    }
+
+    if(pthread_mutex_init(&(ctx.lock), NULL) != 0) {
+        fprintf(stderr, "Error: Cannot create mutex\n");
+        close(fd);
+        return -1;
+    }
+
+    // A client that hangs up early must not take the server with it
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "Serving on %s\n", socketPath);
+
+    for(;;) {
+        int client = accept(fd, NULL, NULL);
+        if(client < 0) {
+            // A client that gave up while queued is no fault of the server
+            if(errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("Error: Cannot accept connection");
+            // Out of descriptors or memory lasts until connections close,
+            // so wait for that instead of spinning on accept()
+            if(errno == EMFILE || errno == ENFILE || errno == ENOMEM ||
+                    errno == ENOBUFS) {
+                struct timespec pause = { 0, SERVE_RETRY_DELAY * 1000000L };
+                nanosleep(&pause, NULL);
+                continue;
+            }
+            close(fd);
+            unlink(socketPath);
+            return -1;
+        }
+
+        connection* conn = calloc(1, sizeof(*conn));
+        pthread_t thread;
+        if(conn != NULL) {
+            conn->ctx = &ctx;
+            conn->fd = client;
+        }
+        if(conn == NULL || pthread_create(&thread, NULL, serveConnection,
+                conn) != 0) {
+            fprintf(stderr, "Error: Cannot start connection thread\n");
+            free(conn);
+            close(client);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
+
+void* serveConnection(void* arg) {
+    connection* conn = arg;
+    char line[SERVE_LINE_SIZE];
+
+    conn->input = fdopen(conn->fd, "r");
+    if(conn->input == NULL) {
+        close(conn->fd);
+        free(conn);
+        return NULL;
+    }
+
+    while(fgets(line, sizeof(line), conn->input) != NULL) {
+        // Without the whole line there is no telling where the next request
+        // starts
+        if(strchr(line, '\n') == NULL) {
+            replyError(conn, "Request line too long");
+            break;
+        }
+        if(handleRequest(conn, line) < 0) {
+            break;
+        }
+    }
+
+    fclose(conn->input);
+    free(conn->image);
+    free(conn);
+
+    return NULL;
+}
+
+// Answers one request. Returns -1 only when the connection cannot go on.
+int handleRequest(connection* conn, char* line) {
+    char command[16];
+    char id[SERVE_ID_SIZE];
+    size_t width, height, bytes;
+    int fields;
+
+    if(sscanf(line, "%15s", command) != 1) {
+        return replyError(conn, "Empty request");
+    }
+
+    if(strcmp(command, "LOAD") == 0) {
+        if(sscanf(line, "LOAD %63s %zu", id, &bytes) != 2) {
+            return replyError(conn, "Usage: LOAD id bytes");
+        }
+        if(loadScene(conn, id, bytes) < 0) {
+            return conn->closed ? -1 : 0;
+        }
+        return reply(conn, NULL, 0);
+    }
+    else if(strcmp(command, "RENDER") == 0) {
+        fields = sscanf(line, "RENDER %63s %zu %zu %zu", id, &width, &height,
+            &bytes);
+        if(fields < 3) {
+            return replyError(conn, "Usage: RENDER id width height [bytes]");
+        }
+        if(fields == 4 && loadScene(conn, id, bytes) < 0) {
+            return conn->closed ? -1 : 0;
+        }
+        return renderScene(conn, id, width, height);
+    }
+    else if(strcmp(command, "DROP") == 0) {
+        if(sscanf(line, "DROP %63s", id) != 1) {
+            return replyError(conn, "Usage: DROP id");
+        }
+        return dropScene(conn, id);
+    }
+
+    return replyError(conn, "Unknown request");
+}
+
+// Reads a scene of bytes bytes from the connection and caches it as id.
+// Errors are answered here; conn->closed is set if the connection broke.
+int loadScene(connection* conn, const char* id, size_t bytes) {
+    serveCtx* ctx = conn->ctx;
+
+    if(bytes == 0) {
+        replyError(conn, "Empty scene");
+        return -1;
+    }
+    // A payload that is not read leaves the stream out of step, so the
+    // connection cannot be kept
+    if(bytes > SERVE_MAX_SCENE_BYTES) {
+        replyError(conn, "Scene larger than 256 MiB");
+        conn->closed = 1;
+        return -1;
+    }
+
+    char* payload = malloc(bytes);
+    if(payload == NULL || fread(payload, 1, bytes, conn->input) != bytes) {
+        free(payload);
+        if(payload == NULL) {
+            replyError(conn, "Memory allocation error");
+        }
+        conn->closed = 1;
+        return -1;
+    }
+
+    // Parse and compile before taking the lock, so other connections can
+    // keep rendering meanwhile
+    jsonParser parser;
+    jsonObj jsonObj;
+    scene scene;
+    json_init(&parser, payload, bytes);
+    int status = parseScene(&parser, &jsonObj, ctx->opts->threads);
+    free(payload);
+    if(status < 0) {
+        replyError(conn, parser.error);
+        return -1;
+    }
+
+    // Clients only get to load meshes from under the server's working
+    // directory, not any file the server can read
+    char error[MESH_ERROR_SIZE] = "";
+    const char* outside = outsideMeshPath(jsonObj.objs);
+    if(outside != NULL) {
+        snprintf(error, sizeof(error), "Mesh path '%s' must be relative and "
+            "stay inside the server's directory", outside);
+        freeScene(&jsonObj);
+        replyError(conn, error);
+        return -1;
+    }
+    status = scene_compile(&scene, jsonObj.camera, jsonObj.objs,
+        jsonObj.lights, error);
+    freeScene(&jsonObj);
+    if(status < 0) {
+        replyError(conn, error[0] != '\0' ? error : "Cannot compile scene");
+        return -1;
+    }
+
+    pthread_mutex_lock(&(ctx->lock));
+    cachedScene* slot = findScene(ctx, id);
+    if(slot == NULL) {
+        // An empty slot, or else the one used least recently
+        slot = &(ctx->scenes[0]);
+        for(size_t i = 0; i < SERVE_MAX_SCENES && slot->loaded; i++) {
+            if(!ctx->scenes[i].loaded ||
+                    ctx->scenes[i].lastUsed < slot->lastUsed) {
+                slot = &(ctx->scenes[i]);
+            }
+        }
+    }
+    if(slot->loaded) {
+        scene_free(&(slot->scene));
+    }
+    strcpy(slot->id, id);
+    slot->scene = scene;
+    slot->lastUsed = ++ctx->serial;
+    slot->loaded = 1;
+    pthread_mutex_unlock(&(ctx->lock));
+
+    return 0;
+}
+
+int renderScene(connection* conn, const char* id, size_t width,
+        size_t height) {
+    serveCtx* ctx = conn->ctx;
+    pnmHeader header = { 6, width, height, 255 };
+    size_t count = width * height;
+    size_t imageSize = SERVE_HEADER_SIZE + count * 3;
+
+    if(width < 1 || height < 1 || width > SERVE_MAX_SIZE ||
+            height > SERVE_MAX_SIZE) {
+        return replyError(conn, "Width and height must be between 1 and "
+            "16384");
+    }
+
+    if(conn->imageSize < imageSize) {
+        char* image = realloc(conn->image, imageSize);
+        if(image == NULL) {
+            return replyError(conn, "Memory allocation error");
+        }
+        conn->image = image;
+        conn->imageSize = imageSize;
+    }
+
+    pthread_mutex_lock(&(ctx->lock));
+    cachedScene* cached = findScene(ctx, id);
+    if(cached == NULL) {
+        pthread_mutex_unlock(&(ctx->lock));
+        return replyError(conn, "Unknown scene");
+    }
+    cached->lastUsed = ++ctx->serial;
+
+    if(ctx->pixelCount < count) {
+        pixel* pixels = realloc(ctx->pixels, sizeof(*pixels) * count);
+        if(pixels == NULL) {
+            pthread_mutex_unlock(&(ctx->lock));
+            return replyError(conn, "Memory allocation error");
+        }
+        ctx->pixels = pixels;
+        ctx->pixelCount = count;
+    }
+
+    FILE* imageFd = NULL;
+    int status = raycast(ctx->pixels, width, height, &(cached->scene),
+        ctx->opts, NULL);
+    if(status == 0) {
+        imageFd = fmemopen(conn->image, conn->imageSize, "w");
+        status = imageFd == NULL || writeHeader(header, imageFd) < 0 ||
+            writeBody(header, ctx->pixels, imageFd,
+            ctx->opts->threads) < 0 ? -1 : 0;
+    }
+    pthread_mutex_unlock(&(ctx->lock));
+
+    long size = -1;
+    if(imageFd != NULL) {
+        fflush(imageFd);
+        size = ftell(imageFd);
+        fclose(imageFd);
+    }
+    if(status < 0 || size < 0) {
+        return replyError(conn, "Render failed");
+    }
+
+    return reply(conn, conn->image, size);
+}
+
+int dropScene(connection* conn, const char* id) {
+    serveCtx* ctx = conn->ctx;
+
+    pthread_mutex_lock(&(ctx->lock));
+    cachedScene* cached = findScene(ctx, id);
+    if(cached != NULL) {
+        scene_free(&(cached->scene));
+        memset(cached, 0, sizeof(*cached));
+    }
+    pthread_mutex_unlock(&(ctx->lock));
+
+    if(cached == NULL) {
+        return replyError(conn, "Unknown scene");
+    }
+
+    return reply(conn, NULL, 0);
+}
+
+// Must be called with ctx->lock held
+cachedScene* findScene(serveCtx* ctx, const char* id) {
+    for(size_t i = 0; i < SERVE_MAX_SCENES; i++) {
+        if(ctx->scenes[i].loaded && strcmp(ctx->scenes[i].id, id) == 0) {
+            return &(ctx->scenes[i]);
+        }
+    }
+
+    return NULL;
+}
+
+int reply(connection* conn, const char* data, size_t size) {
+    char line[32];
+    int length = snprintf(line, sizeof(line), "OK %zu\n", size);
+
+    if(sendAll(conn->fd, line, length) < 0 ||
+            sendAll(conn->fd, data, size) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+// The first mesh path of objs that is absolute or climbs out with a ".."
+// component, or NULL if there is none
+const char* outsideMeshPath(sceneObj** objs) {
+    for(size_t i = 0; objs[i] != NULL; i++) {
+        const char* path = objs[i]->mesh.path;
+        if(objs[i]->type != TYPE_MESH) {
+            continue;
+        }
+        if(path[0] == '/') {
+            return path;
+        }
+
+        for(const char* part = path; *part != '\0';) {
+            size_t length = strcspn(part, "/");
+            if(length == 2 && part[0] == '.' && part[1] == '.') {
+                return path;
+            }
+            part += length;
+            part += *part == '/';
+        }
+    }
+
+    return NULL;
+}
+
+// Sends message as an error, which does not end the connection by itself
+int replyError(connection* conn, const char* message) {
+    char line[SERVE_LINE_SIZE + JSON_ERROR_SIZE];
+    int length = snprintf(line, sizeof(line), "ERROR %s\n", message);
+
+    return sendAll(conn->fd, line, length);
+}
+
+int sendAll(int fd, const char* data, size_t size) {
+    while(size > 0) {
+        ssize_t sent = write(fd, data, size);
+        if(sent < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += sent;
+        size -= sent;
+    }
+
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef CS430_SERVE_H
+#define CS430_SERVE_H
+
+#include <stddef.h>
+
+#include "raycast.h"
+
+// Scenes kept parsed and compiled at once. Loading another evicts the one
+// used least recently.
+#define SERVE_MAX_SCENES 64
+// Longest scene ID, plus the terminator
+#define SERVE_ID_SIZE 64
+// Longest request line, including the newline
+#define SERVE_LINE_SIZE 256
+// Largest frame width or height, and scene payload, a request may ask for
+#define SERVE_MAX_SIZE 16384
+#define SERVE_MAX_SCENE_BYTES ((size_t)1 << 28)
+// Room reserved for the P6 header in front of the pixels
+#define SERVE_HEADER_SIZE 256
+
+// Serves render requests on a Unix domain socket at socketPath until the
+// process is stopped, or returns -1 if the socket stops accepting. Every
+// connection may send any number of requests, each a line of text,
+// optionally followed by a JSON scene of the given size:
+//
+//   LOAD id bytes                  parse and cache a scene under id
+//   RENDER id width height         render the cached scene id
+//   RENDER id width height bytes   load the scene, then render it
+//   DROP id                        forget the scene id
+//
+// Each is answered with "OK bytes\n" followed by that many bytes (a P6 image
+// for RENDER, nothing otherwise), or with "ERROR message\n". Errors in a
+// request, including malformed scenes, leave the connection usable. Renders
+// use opts, one at a time with opts->threads workers.
+//
+// Mesh paths in a scene are relative to the server's working directory, and
+// absolute paths or ones with a ".." component are refused. Symbolic links
+// under that directory are followed, so it should hold only files clients
+// may read.
+int serve_run(const char* socketPath, const renderOpts* opts);
+
+#endif // CS430_SERVE_H
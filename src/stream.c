@@ -0,0 +1,235 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "stream.h"
+#include "qoi.h"
+#include "scheduler.h"
+#include "write.h"
+
+typedef struct streamCtx {
+    FILE* output;
+    pnmHeader header;
+    // Carries QOI state from band to band, for WRITE_MODE_QOI
+    qoiEncoder encoder;
+    size_t bandRows;
+    size_t bandCount;
+    // Threads a P3 band is formatted on
+    size_t threads;
+    // STREAM_BANDS bands of bandRows rows. Band i of the frame is rendered
+    // into slot i % STREAM_BANDS.
+    pixel* bands;
+    // Guards everything below
+    pthread_mutex_t lock;
+    // Signalled when a band is rendered, and when one is written
+    pthread_cond_t rendered;
+    pthread_cond_t written;
+    size_t renderedCount;
+    size_t writtenCount;
+    // Set by either side to stop the other
+    int failed;
+} streamCtx;
+
+void* writeBands(void* arg);
+pixel* bandSlot(const streamCtx* ctx, size_t band);
+size_t bandHeight(const streamCtx* ctx, size_t band);
+
+int stream_bandRows(const char* value, size_t* rows) {
+    char* endptr;
+    size_t count = strtoul(value, &endptr, 10);
+    if(!(*value != '\0' && *endptr == '\0') || count < 1) {
+        fprintf(stderr, "Error: Band height must be at least 1 row\n");
+        return -1;
+    }
+
+    // Whole rows of tiles keep every tile the same as in a full frame, which
+    // adaptive subdivision and anti-aliasing depend on
+    *rows = (count + DEFAULT_TILE_SIZE - 1) / DEFAULT_TILE_SIZE *
+        DEFAULT_TILE_SIZE;
+
+    return 0;
+}
+
+int stream_render(const char* outputPath, pnmHeader header, size_t bandRows,
+        const scene* scene, const renderOpts* opts, renderStats* stats) {
+    streamCtx ctx = { 0 };
+    size_t width = header.width;
+    size_t height = header.height;
+    pthread_t writer;
+    int status = 0;
+
+    if(opts->gbuffer != NULL || opts->dirty != NULL) {
+        fprintf(stderr, "Error: G-buffers and dirty tiles cannot be "
+            "streamed\n");
+        return -1;
+    }
+
+    ctx.header = header;
+    ctx.threads = opts->threads;
+    ctx.bandRows = bandRows < height ? bandRows : height;
+    ctx.bandCount = ctx.bandRows > 0 ?
+        (height + ctx.bandRows - 1) / ctx.bandRows : 0;
+
+    if(stats != NULL) {
+        stats->pixels = 0;
+        stats->samples = 0;
+        stats->rays = 0;
+        stats->refined = 0;
+    }
+
+    size_t slotSize = width * ctx.bandRows;
+    ctx.bands = malloc(sizeof(*(ctx.bands)) * STREAM_BANDS *
+        (slotSize > 0 ? slotSize : 1));
+    if(ctx.bands == NULL) {
+        fprintf(stderr, "Error: Memory allocation error\n");
+        return -1;
+    }
+
+    if((ctx.output = fopen(outputPath, "w")) == NULL) {
+        perror("Error: Cannot open output file\n");
+        free(ctx.bands);
+        return -1;
+    }
+    if((header.mode == WRITE_MODE_QOI ? qoi_begin(&(ctx.encoder), ctx.output,
+            width, height) : writeHeader(ctx.header, ctx.output)) < 0) {
+        fclose(ctx.output);
+        free(ctx.bands);
+        return -1;
+    }
+
+    pthread_mutex_init(&(ctx.lock), NULL);
+    pthread_cond_init(&(ctx.rendered), NULL);
+    pthread_cond_init(&(ctx.written), NULL);
+    if(pthread_create(&writer, NULL, writeBands, &ctx) != 0) {
+        fprintf(stderr, "Error: Cannot start the writer thread\n");
+        fclose(ctx.output);
+        free(ctx.bands);
+        return -1;
+    }
+
+    for(size_t band = 0; band < ctx.bandCount; band++) {
+        // Wait for the writer to free the slot this band goes in
+        pthread_mutex_lock(&(ctx.lock));
+        while(band - ctx.writtenCount >= STREAM_BANDS && !ctx.failed) {
+            pthread_cond_wait(&(ctx.written), &(ctx.lock));
+        }
+        int failed = ctx.failed;
+        pthread_mutex_unlock(&(ctx.lock));
+        if(failed) {
+            break;
+        }
+
+        renderOpts bandOpts = *opts;
+        renderStats bandStats;
+        bandOpts.firstRow = band * ctx.bandRows;
+        bandOpts.rows = bandHeight(&ctx, band);
+        status = raycast(bandSlot(&ctx, band), width, height, scene,
+            &bandOpts, &bandStats);
+
+        pthread_mutex_lock(&(ctx.lock));
+        if(status < 0) {
+            ctx.failed = 1;
+        }
+        else {
+            ctx.renderedCount++;
+        }
+        pthread_cond_signal(&(ctx.rendered));
+        pthread_mutex_unlock(&(ctx.lock));
+        if(status < 0) {
+            break;
+        }
+
+        if(stats != NULL) {
+            stats->pixels += bandStats.pixels;
+            stats->samples += bandStats.samples;
+            stats->rays += bandStats.rays;
+            stats->refined += bandStats.refined;
+        }
+    }
+
+    pthread_join(writer, NULL);
+    pthread_cond_destroy(&(ctx.written));
+    pthread_cond_destroy(&(ctx.rendered));
+    pthread_mutex_destroy(&(ctx.lock));
+    free(ctx.bands);
+
+    if(header.mode == WRITE_MODE_QOI && (ctx.failed ||
+            qoi_end(&(ctx.encoder)) < 0)) {
+        free(ctx.encoder.buffer);
+        ctx.failed = 1;
+    }
+    if(ctx.failed) {
+        fclose(ctx.output);
+        return -1;
+    }
+    if(fclose(ctx.output) != 0) {
+        perror("Error: Cannot write output file\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Writer thread: saves every band as soon as it is rendered, in order
+void* writeBands(void* arg) {
+    streamCtx* ctx = arg;
+
+    for(size_t band = 0; band < ctx->bandCount; band++) {
+        pthread_mutex_lock(&(ctx->lock));
+        while(ctx->renderedCount == band && !ctx->failed) {
+            pthread_cond_wait(&(ctx->rendered), &(ctx->lock));
+        }
+        int failed = ctx->failed;
+        pthread_mutex_unlock(&(ctx->lock));
+        if(failed) {
+            break;
+        }
+
+        // The body of each band is the rows it holds, so writeBody() can
+        // write them as if they were an image of their own
+        pnmHeader header = ctx->header;
+        header.height = bandHeight(ctx, band);
+        if(header.mode == WRITE_MODE_QOI) {
+            failed = qoi_encode(&(ctx->encoder), bandSlot(ctx, band),
+                header.width * header.height) < 0;
+        }
+        else {
+            failed = writeBody(header, bandSlot(ctx, band), ctx->output,
+                ctx->threads) < 0;
+        }
+        if(!failed && ferror(ctx->output)) {
+            perror("Error: Cannot write output file\n");
+            failed = 1;
+        }
+
+        pthread_mutex_lock(&(ctx->lock));
+        if(failed) {
+            ctx->failed = 1;
+        }
+        else {
+            ctx->writtenCount++;
+        }
+        pthread_cond_signal(&(ctx->written));
+        pthread_mutex_unlock(&(ctx->lock));
+        if(failed) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+pixel* bandSlot(const streamCtx* ctx, size_t band) {
+    return &(ctx->bands[band % STREAM_BANDS * ctx->header.width *
+        ctx->bandRows]);
+}
+
+// Rows in band, which is fewer than bandRows for the last one
+size_t bandHeight(const streamCtx* ctx, size_t band) {
+    size_t first = band * ctx->bandRows;
+
+    return ctx->header.height - first < ctx->bandRows ?
+        ctx->header.height - first : ctx->bandRows;
+}
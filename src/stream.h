@@ -0,0 +1,30 @@
+#ifndef CS430_STREAM_H
+#define CS430_STREAM_H
+
+#include <stddef.h>
+
+#include "pnm.h"
+#include "raycast.h"
+#include "scene.h"
+
+// Band buffers shared by the renderer and the writer. One is written while
+// the next is rendered, and the third lets a slow band on either side even out.
+#define STREAM_BANDS 3
+
+// Band height used when QOI output is streamed without -b
+#define STREAM_DEFAULT_ROWS 128
+
+// Reads the -b band height. Bands are rounded up to whole rows of tiles.
+int stream_bandRows(const char* value, size_t* rows);
+
+// Renders the frame header describes in bands of bandRows rows and writes it
+// to outputPath as it goes, so only STREAM_BANDS bands are ever held in
+// memory. A writer thread saves each finished band while the next ones
+// render. The image is the same one raycast() and writeImage() would give,
+// and QOI is compressed band by band as it is written.
+// opts->gbuffer and opts->dirty must not be set; stats, if not NULL, covers
+// the whole frame.
+int stream_render(const char* outputPath, pnmHeader header, size_t bandRows,
+    const scene* scene, const renderOpts* opts, renderStats* stats);
+
+#endif // CS430_STREAM_H
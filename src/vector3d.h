@@ -3,10 +3,12 @@
 
 #include <math.h>
 
+#include "real.h"
+
 typedef struct vector3d {
-    double x;
-    double y;
-    double z;
+    real x;
+    real y;
+    real z;
 } vector3d;
 
 static inline vector3d vector3d_add(vector3d first, vector3d second) {
@@ -19,12 +21,12 @@ static inline vector3d vector3d_sub(vector3d first, vector3d second) {
     return result;
 }
 
-static inline vector3d vector3d_scale(vector3d vector, double scaler) {
+static inline vector3d vector3d_scale(vector3d vector, real scaler) {
     vector3d result = { vector.x * scaler, vector.y * scaler, vector.z * scaler };
     return result;
 }
 
-static inline double vector3d_dot(vector3d first, vector3d second) {
+static inline real vector3d_dot(vector3d first, vector3d second) {
     return first.x * second.x + first.y * second.y + first.z * second.z;
 }
 
@@ -47,8 +49,9 @@ static inline vector3d vector3d_cross(vector3d first, vector3d second) {
     return result;
 }
 
-static inline double vector3d_magnitude(vector3d vector) {
-    return sqrt(vector.x * vector.x + vector.y * vector.y + vector.z * vector.z);
+static inline real vector3d_magnitude(vector3d vector) {
+    return real_sqrt(vector.x * vector.x + vector.y * vector.y +
+        vector.z * vector.z);
 }
 
 static inline vector3d vector3d_zero() {
@@ -58,8 +61,8 @@ static inline vector3d vector3d_zero() {
 }
 
 static inline int vector3d_compare(vector3d first, vector3d second) {
-    double firstMag = vector3d_magnitude(first);
-    double secondMag = vector3d_magnitude(second);
+    real firstMag = vector3d_magnitude(first);
+    real secondMag = vector3d_magnitude(second);
     if(firstMag < secondMag) {
         return -1;
     }
@@ -72,7 +75,7 @@ static inline int vector3d_compare(vector3d first, vector3d second) {
 }
 
 static inline vector3d vector3d_normalize(vector3d vector) {
-    double length = vector3d_magnitude(vector);
+    real length = vector3d_magnitude(vector);
     vector3d normal = {
         vector.x / length,
         vector.y / length,
@@ -82,9 +85,10 @@ static inline vector3d vector3d_normalize(vector3d vector) {
     return normal;
 }
 
-static inline double vector3d_distance(vector3d first, vector3d second) {
-    return sqrt(pow(first.x - second.x, 2) + pow(first.y - second.y, 2) +
-        pow(first.z - second.z, 2));
+static inline real vector3d_distance(vector3d first, vector3d second) {
+    return real_sqrt(real_pow(first.x - second.x, 2) +
+        real_pow(first.y - second.y, 2) +
+        real_pow(first.z - second.z, 2));
 }
 
 #endif // CS430_VECTOR3D_H
@@ -0,0 +1,286 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "watch.h"
+#include "scheduler.h"
+#include "write.h"
+
+int sameState(const struct stat* first, const struct stat* second);
+void waitForChange(const char* path, struct stat* last);
+int pixelChanged(const jsonObj* before, const jsonObj* after,
+    const gbuffer* gbuffer, const size_t* changes, size_t changeCount,
+    size_t x, size_t y);
+int sphereNear(vector3d start, vector3d dir, real length,
+    const sceneObj* obj);
+int sameObj(const sceneObj* first, const sceneObj* second);
+
+size_t watch_dirty(const jsonObj* before, const jsonObj* after,
+        const gbuffer* gbuffer, unsigned char* dirty) {
+    size_t columns = (gbuffer->width + DEFAULT_TILE_SIZE - 1) /
+        DEFAULT_TILE_SIZE;
+    size_t rows = (gbuffer->height + DEFAULT_TILE_SIZE - 1) /
+        DEFAULT_TILE_SIZE;
+    size_t tileCount = columns * rows;
+    size_t objCount = 0, afterObjCount = 0;
+    size_t lightCount = 0, afterLightCount = 0;
+    int full = before->camera.width != after->camera.width ||
+        before->camera.height != after->camera.height;
+
+    for(; before->objs != NULL && before->objs[objCount] != NULL; objCount++);
+    for(; after->objs != NULL && after->objs[afterObjCount] != NULL;
+        afterObjCount++);
+    for(; before->lights != NULL && before->lights[lightCount] != NULL;
+        lightCount++);
+    for(; after->lights != NULL && after->lights[afterLightCount] != NULL;
+        afterLightCount++);
+    full = full || objCount != afterObjCount || lightCount != afterLightCount;
+
+    // Both structs are zeroed before parsing fills them in, so they compare
+    // byte for byte
+    for(size_t i = 0; !full && i < lightCount; i++) {
+        full = memcmp(before->lights[i], after->lights[i],
+            sizeof(sceneLight)) != 0;
+    }
+
+    size_t* changes = malloc(sizeof(*changes) * (objCount + 1));
+    size_t changeCount = 0;
+    full = full || changes == NULL;
+    for(size_t i = 0; !full && i < objCount; i++) {
+        if(!sameObj(before->objs[i], after->objs[i])) {
+            // A plane or mesh may reach any pixel, so there is nothing to
+            // narrow
+            full = before->objs[i]->type != TYPE_SPHERE ||
+                after->objs[i]->type != TYPE_SPHERE;
+            changes[changeCount++] = i;
+        }
+    }
+
+    if(full) {
+        free(changes);
+        memset(dirty, 1, tileCount);
+        return tileCount;
+    }
+
+    size_t count = 0;
+    memset(dirty, 0, tileCount);
+    for(size_t y = 0; changeCount > 0 && y < gbuffer->height; y++) {
+        for(size_t x = 0; x < gbuffer->width; x++) {
+            size_t tile = y / DEFAULT_TILE_SIZE * columns + x / DEFAULT_TILE_SIZE;
+
+            if(!dirty[tile] && pixelChanged(before, after, gbuffer, changes,
+                    changeCount, x, y)) {
+                dirty[tile] = 1;
+                count++;
+            }
+        }
+    }
+
+    free(changes);
+
+    return count;
+}
+
+int watch_run(const char* jsonPath, const char* outputPath, jsonObj* jsonObj,
+        scene* scene, pixel* pixels, size_t width, size_t height,
+        renderOpts* opts) {
+    size_t tileCount = ((width + DEFAULT_TILE_SIZE - 1) / DEFAULT_TILE_SIZE) *
+        ((height + DEFAULT_TILE_SIZE - 1) / DEFAULT_TILE_SIZE);
+    pnmHeader header = { 6, width, height, 255 };
+    struct stat last;
+
+    unsigned char* dirty = malloc(tileCount > 0 ? tileCount : 1);
+    if(dirty == NULL) {
+        fprintf(stderr, "Error: Memory allocation error\n");
+        return -1;
+    }
+
+    if(stat(jsonPath, &last) < 0) {
+        perror("Error: Cannot watch input\n");
+        free(dirty);
+        return -1;
+    }
+    fprintf(stderr, "Watching %s for changes\n", jsonPath);
+
+    for(;;) {
+        waitForChange(jsonPath, &last);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        // A file that does not parse keeps the last frame until it is fixed.
+        // The file is read rather than mapped, as an editor may truncate it
+        // while it is parsed.
+        struct jsonObj next;
+        jsonParser parser;
+        if(json_read(&parser, jsonPath) < 0) {
+            perror("Error: Opening input\n");
+            continue;
+        }
+        int status = parseScene(&parser, &next, opts->threads);
+        json_close(&parser);
+        if(status < 0) {
+            fprintf(stderr, "Error: %s\n", parser.error);
+            continue;
+        }
+        if(resolveMeshPaths(&next, jsonPath) < 0) {
+            fprintf(stderr, "Error: Memory allocation error\n");
+            freeScene(&next);
+            continue;
+        }
+
+        size_t count = tileCount;
+        opts->dirty = NULL;
+        if(opts->gbuffer != NULL) {
+            count = watch_dirty(jsonObj, &next, opts->gbuffer, dirty);
+            opts->dirty = dirty;
+        }
+
+        freeScene(jsonObj);
+        *jsonObj = next;
+        scene_free(scene);
+        if(scene_compile(scene, jsonObj->camera, jsonObj->objs,
+                jsonObj->lights, NULL) < 0) {
+            free(dirty);
+            return -1;
+        }
+
+        if(count > 0) {
+            if(raycast(pixels, width, height, scene, opts, NULL) < 0 ||
+                    writeImage(outputPath, header, pixels,
+                    opts->threads) < 0) {
+                free(dirty);
+                return -1;
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        fprintf(stderr, "Rendered %zu of %zu tiles in %.3fs\n", count,
+            tileCount, (end.tv_sec - start.tv_sec) +
+            (end.tv_nsec - start.tv_nsec) / 1e9);
+    }
+}
+
+int sameState(const struct stat* first, const struct stat* second) {
+    return first->st_mtim.tv_sec == second->st_mtim.tv_sec &&
+        first->st_mtim.tv_nsec == second->st_mtim.tv_nsec &&
+        first->st_size == second->st_size && first->st_ino == second->st_ino;
+}
+
+// Polls until path differs from last, then until it has stopped changing for
+// one interval, so a file still being saved is not parsed halfway
+void waitForChange(const char* path, struct stat* last) {
+    struct timespec interval = { WATCH_INTERVAL / 1000,
+        WATCH_INTERVAL % 1000 * 1000000L };
+    struct stat current, settled;
+
+    do {
+        nanosleep(&interval, NULL);
+    } while(stat(path, &current) < 0 || sameState(&current, last));
+
+    for(;;) {
+        nanosleep(&interval, NULL);
+        if(stat(path, &settled) < 0) {
+            continue;
+        }
+        if(sameState(&settled, &current)) {
+            break;
+        }
+        current = settled;
+    }
+
+    *last = settled;
+}
+
+// Whether the pixel at x, y can differ between the two scenes, given that
+// only the spheres listed in changes differ and gbuffer holds its old hit
+int pixelChanged(const jsonObj* before, const jsonObj* after,
+        const gbuffer* gbuffer, const size_t* changes, size_t changeCount,
+        size_t x, size_t y) {
+    const gbufferPixel* saved = &(gbuffer->pixels[y * gbuffer->width + x]);
+    const camera camera = before->camera;
+    vector3d origin = { 0, 0, 0 };
+    // The primary ray direction of renderTile()
+    vector3d point = {
+        -(camera.width / 2) + camera.width / gbuffer->width * (x + (real)0.5),
+        -(-(camera.height / 2) + camera.height / gbuffer->height *
+            (y + (real)0.5)),
+        1 };
+    vector3d dir = vector3d_normalize(point);
+    vector3d intersection = vector3d_scale(dir, saved->t);
+
+    for(size_t i = 0; i < changeCount; i++) {
+        const sceneObj* old = before->objs[changes[i]];
+        const sceneObj* new = after->objs[changes[i]];
+
+        if(saved->hit && saved->obj == changes[i]) {
+            return 1;
+        }
+        // A material change only shows where the object is hit
+        if(memcmp(&(old->sphere), &(new->sphere), sizeof(old->sphere)) == 0) {
+            continue;
+        }
+        // The moved sphere may now be in front of the saved hit...
+        if(sphereNear(origin, dir, saved->hit ? saved->t : INFINITY, new)) {
+            return 1;
+        }
+        if(!saved->hit) {
+            continue;
+        }
+        // ...or start or stop blocking a light from it
+        for(size_t j = 0; after->lights[j] != NULL; j++) {
+            vector3d toLight = vector3d_normalize(vector3d_sub(
+                after->lights[j]->pos, intersection));
+            real distance = vector3d_distance(after->lights[j]->pos,
+                intersection);
+
+            if(sphereNear(intersection, toLight, distance, old) ||
+                    sphereNear(intersection, toLight, distance, new)) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Whether the segment from start along the unit vector dir for length comes
+// within the padded radius of the sphere obj
+int sphereNear(vector3d start, vector3d dir, real length,
+        const sceneObj* obj) {
+    vector3d pos = obj->sphere.pos;
+    real radius = obj->sphere.radius;
+    real pad = (radius + real_fabs(pos.x) + real_fabs(pos.y) +
+        real_fabs(pos.z) + real_fabs(start.x) + real_fabs(start.y) +
+        real_fabs(start.z)) * WATCH_MARGIN;
+    real along = vector3d_dot(vector3d_sub(pos, start), dir);
+
+    along = along < 0 ? 0 : along > length ? length : along;
+
+    return vector3d_distance(vector3d_add(start, vector3d_scale(dir, along)),
+        pos) <= radius + pad;
+}
+
+// Whether two parsed objects are the same. Both are zeroed before parsing
+// fills them in, so they compare byte for byte, except for the file path a
+// mesh points to.
+int sameObj(const sceneObj* first, const sceneObj* second) {
+    sceneObj firstCopy, secondCopy;
+
+    memcpy(&firstCopy, first, sizeof(firstCopy));
+    memcpy(&secondCopy, second, sizeof(secondCopy));
+    if(first->type == TYPE_MESH && second->type == TYPE_MESH) {
+        if(strcmp(first->mesh.path, second->mesh.path) != 0) {
+            return 0;
+        }
+        firstCopy.mesh.path = NULL;
+        secondCopy.mesh.path = NULL;
+    }
+
+    return memcmp(&firstCopy, &secondCopy, sizeof(firstCopy)) == 0;
+}
@@ -0,0 +1,33 @@
+#ifndef CS430_WATCH_H
+#define CS430_WATCH_H
+
+#include <stddef.h>
+
+#include "json.h"
+#include "pnm.h"
+#include "raycast.h"
+#include "scene.h"
+
+// How often the scene file is checked for changes, in milliseconds
+#define WATCH_INTERVAL 100
+
+// Bounds tests pad spheres by this much relative to their size and position,
+// so rounding can never leave a pixel clean that the new scene changes
+#define WATCH_MARGIN 1e-3
+
+// Flags in dirty, one per tile in scheduler_tiles() order, the tiles whose
+// pixels may differ between the two parsed scenes, and returns how many.
+// gbuffer must hold the hits of the frame rendered from before. Any change to
+// the camera, the lights, a plane or the number of objects marks every tile.
+size_t watch_dirty(const jsonObj* before, const jsonObj* after,
+    const gbuffer* gbuffer, unsigned char* dirty);
+
+// Re-renders the frame to outputPath every time the file at jsonPath
+// changes, until the program is stopped. jsonObj and scene are the parsed and
+// compiled scene that pixels was last rendered from; with opts->gbuffer set,
+// only the tiles watch_dirty() flags are rendered again.
+int watch_run(const char* jsonPath, const char* outputPath, jsonObj* jsonObj,
+    scene* scene, pixel* pixels, size_t width, size_t height,
+    renderOpts* opts);
+
+#endif // CS430_WATCH_H
@@ -1,6 +1,51 @@
 #define __USE_MINGW_ANSI_STDIO 1
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "write.h"
+#include "qoi.h"
+#include "scheduler.h"
+
+// P6 bodies are the pixel array byte for byte
+_Static_assert(sizeof(pixel) == 3, "pixel must be packed RGB");
+
+// P3 pixels are three decimal channels split by single spaces, with three
+// spaces between pixels and a newline after every fifth one and every row
+#define P3_PIXELS_PER_LINE 5
+// Longest pixel with the spaces after it
+#define P3_PIXEL_MAX 14
+_Static_assert(P3_PIXELS_PER_LINE * P3_PIXEL_MAX - 3 <= CS430_MAX_LINE,
+    "P3 lines must fit CS430_MAX_LINE");
+// Bytes of text each thread formats at a time
+#define P3_CHUNK_SIZE ((size_t)1 << 20)
+
+// Decimal text of a channel value, padded to 3 characters
+typedef struct decimal {
+    char digits[3];
+    size_t length;
+} decimal;
+
+typedef struct p3Encoder {
+    const pixel* pixels;
+    decimal table[256];
+    size_t chunkRows;
+    size_t firstRow;
+    // One chunk of text per slot, and how much of it is used
+    char* text;
+    size_t* lengths;
+} p3Encoder;
+
+int writeP3Body(pnmHeader header, const pixel* pixels, FILE* outputFd,
+    size_t threads);
+void formatP3Chunk(tile chunk, size_t threadId, void* data);
+char* appendDecimal(char* cursor, decimal value);
 
 int writeHeader(pnmHeader header, FILE* outputFd) {
     if(header.mode < 1 || header.mode > 7) {
@@ -37,7 +82,8 @@ int writeHeader(pnmHeader header, FILE* outputFd) {
     return 0;
 }
 
-int writeBody(pnmHeader header, pixel* pixels, FILE* outputFd) {
+int writeBody(pnmHeader header, pixel* pixels, FILE* outputFd,
+        size_t threads) {
     if(header.mode < 1 || header.mode > 7) {
         fprintf(stderr, "Error: Mode P%d not valid\n", header.mode);
         return -1;
@@ -57,43 +103,235 @@ int writeBody(pnmHeader header, pixel* pixels, FILE* outputFd) {
 
     // If P4 - P7, set write mode as binary.
     if(header.mode == 6) {
-        // Loop through the image buffer like a grid, individually writing red,
-        // green, and blue explicitly to avoid endianness errors (wrong byte order)
-        for(size_t y = 0; y < header.height; y++) {
-            for(size_t x = 0; x < header.width; x++) {
-                fwrite(&(pixels[y * header.width + x].red), 1, 1, outputFd);
-                fwrite(&(pixels[y * header.width + x].green), 1, 1, outputFd);
-                fwrite(&(pixels[y * header.width + x].blue), 1, 1, outputFd);
-            }
-        }
+        // Channels are single bytes in red, green, blue order, so the whole
+        // buffer goes out in one call with no byte order to worry about
+        fwrite(pixels, sizeof(*pixels), header.width * header.height,
+            outputFd);
     }
     else if(header.mode == 3) {
-        for(size_t y = 0; y < header.height; y++) {
-            for(size_t x = 0; x < header.width; x++) {
-                // Write the channels as unsigned decimal values and space them
-                // with single spaces
-                fprintf(outputFd, "%u", pixels[y * header.width + x].red);
-                fprintf(outputFd, " %u", pixels[y * header.width + x].green);
-                fprintf(outputFd, " %u", pixels[y * header.width + x].blue);
-
-                // For the end of every 5 pixels, end the line with a newline
-                // to avoid lines >70 characters (based on the ppm documentation)
-                if(x % 5 == 4) {
-                    fprintf(outputFd, "\n");
-                }
-                // Otherwise, space inebtween each pixel 3 spaces
-                else {
-                    fprintf(outputFd, "   ");
-                }
+        return writeP3Body(header, pixels, outputFd, threads);
+    }
+    else {
+        fprintf(stderr, "Error: Mode P%d not supported\n", header.mode);
+        return -1;
+    }
+
+    return 0;
+}
+
+int writeImage(const char* path, pnmHeader header, pixel* pixels,
+        size_t threads) {
+    FILE* outputFd;
+
+    if(header.mode == WRITE_MODE_QOI) {
+        return qoi_writeImage(path, header.width, header.height, pixels);
+    }
+    if((outputFd = fopen(path, "w")) == NULL) {
+        perror("Error: Cannot open output file\n");
+        return -1;
+    }
+
+    if(writeHeader(header, outputFd) < 0 ||
+            writeBody(header, pixels, outputFd, threads) < 0) {
+        fclose(outputFd);
+        return -1;
+    }
+
+    if(fclose(outputFd) != 0) {
+        perror("Error: Cannot write output file\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Rows are formatted into memory a chunk at a time, one chunk per thread (up
+// to threads), and written out in order. Rows never share a line, so chunks
+// are independent.
+int writeP3Body(pnmHeader header, const pixel* pixels, FILE* outputFd,
+        size_t threads) {
+    p3Encoder encoder;
+    size_t rowSize = P3_PIXEL_MAX * header.width + 1;
+
+    memset(&encoder, 0, sizeof(encoder));
+    encoder.pixels = pixels;
+
+    // Left aligned, so only the first length characters matter
+    for(size_t i = 0; i < 256; i++) {
+        size_t value = i;
+
+        encoder.table[i].length = i >= 100 ? 3 : i >= 10 ? 2 : 1;
+        for(size_t j = encoder.table[i].length; j > 0; j--) {
+            encoder.table[i].digits[j - 1] = '0' + value % 10;
+            value /= 10;
+        }
+    }
+
+    encoder.chunkRows = P3_CHUNK_SIZE / rowSize > 0 ? P3_CHUNK_SIZE / rowSize :
+        1;
+    size_t chunkCount = (header.height + encoder.chunkRows - 1) /
+        encoder.chunkRows;
+    if(threads > chunkCount) {
+        threads = chunkCount;
+    }
+    if(threads == 0) {
+        return 0;
+    }
+
+    tile* chunks = malloc(sizeof(*chunks) * threads);
+    encoder.text = malloc(rowSize * encoder.chunkRows * threads);
+    encoder.lengths = malloc(sizeof(*(encoder.lengths)) * threads);
+    if(chunks == NULL || encoder.text == NULL || encoder.lengths == NULL) {
+        fprintf(stderr, "Error: Memory allocation error\n");
+        free(chunks);
+        free(encoder.text);
+        free(encoder.lengths);
+        return -1;
+    }
+
+    int status = 0;
+    for(size_t row = 0; row < header.height && status == 0;
+            row += encoder.chunkRows * threads) {
+        size_t count = 0;
+
+        encoder.firstRow = row;
+        for(size_t y = row; y < header.height && count < threads;
+                y += encoder.chunkRows) {
+            chunks[count].x = 0;
+            chunks[count].y = y;
+            chunks[count].width = header.width;
+            chunks[count].height = header.height - y < encoder.chunkRows ?
+                header.height - y : encoder.chunkRows;
+            count++;
+        }
+
+        status = scheduler_run(chunks, count, threads, formatP3Chunk, &encoder);
+        for(size_t i = 0; i < count && status == 0; i++) {
+            if(fwrite(&(encoder.text[i * rowSize * encoder.chunkRows]), 1,
+                    encoder.lengths[i], outputFd) != encoder.lengths[i]) {
+                perror("Error: Cannot write output file\n");
+                status = -1;
             }
+        }
+    }
+
+    free(chunks);
+    free(encoder.text);
+    free(encoder.lengths);
+
+    return status;
+}
 
-            fprintf(outputFd, "\n");
+void formatP3Chunk(tile chunk, size_t threadId, void* data) {
+    p3Encoder* encoder = data;
+    size_t rowSize = P3_PIXEL_MAX * chunk.width + 1;
+    size_t slot = (chunk.y - encoder->firstRow) / encoder->chunkRows;
+    char* start = &(encoder->text[slot * rowSize * encoder->chunkRows]);
+    char* cursor = start;
+
+    (void)threadId;
+
+    for(size_t y = chunk.y; y < chunk.y + chunk.height; y++) {
+        const pixel* row = &(encoder->pixels[y * chunk.width]);
+
+        for(size_t x = 0; x < chunk.width; x++) {
+            cursor = appendDecimal(cursor, encoder->table[row[x].red]);
+            *(cursor++) = ' ';
+            cursor = appendDecimal(cursor, encoder->table[row[x].green]);
+            *(cursor++) = ' ';
+            cursor = appendDecimal(cursor, encoder->table[row[x].blue]);
+
+            if(x % P3_PIXELS_PER_LINE == P3_PIXELS_PER_LINE - 1) {
+                *(cursor++) = '\n';
+            }
+            else {
+                memcpy(cursor, "   ", 3);
+                cursor += 3;
+            }
         }
+
+        *(cursor++) = '\n';
     }
-    else {
-        fprintf(stderr, "Error: Mode P%d not supported\n", header.mode);
+
+    encoder->lengths[slot] = cursor - start;
+}
+
+// Copies all 3 characters of value, which is cheaper than copying just the
+// used ones, and steps past the used ones. The chunk is sized for 3-digit
+// channels, so the spare characters always fit and are overwritten next.
+char* appendDecimal(char* cursor, decimal value) {
+    memcpy(cursor, value.digits, 3);
+
+    return cursor + value.length;
+}
+
+int mapImage(mappedImage* image, const char* path, pnmHeader header) {
+    struct stat info;
+
+    memset(image, 0, sizeof(*image));
+
+    if(header.mode != 6) {
+        fprintf(stderr, "Error: Only P6 images can be mapped\n");
+        return -1;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if(fd < 0) {
+        perror("Error: Cannot open output file\n");
+        return -1;
+    }
+    if(fstat(fd, &info) < 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return 0;
+    }
+
+    // The header goes through writeHeader() so it matches writeImage()'s
+    FILE* outputFd = fdopen(fd, "w");
+    if(outputFd == NULL) {
+        perror("Error: Cannot open output file\n");
+        close(fd);
+        return -1;
+    }
+    if(writeHeader(header, outputFd) < 0) {
+        fclose(outputFd);
+        return -1;
+    }
+    if(fflush(outputFd) != 0) {
+        perror("Error: Cannot write output file\n");
+        fclose(outputFd);
+        return -1;
+    }
+
+    long headerSize = ftell(outputFd);
+    image->mapSize = headerSize + sizeof(pixel) * header.width * header.height;
+    // Reserving the blocks up front makes a full disk an error here, rather
+    // than a SIGBUS when a pixel is stored
+    if(ftruncate(fd, image->mapSize) < 0 ||
+            (errno = posix_fallocate(fd, 0, image->mapSize)) != 0) {
+        perror("Error: Cannot write output file\n");
+        fclose(outputFd);
+        return -1;
+    }
+
+    image->map = mmap(NULL, image->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+        fd, 0);
+    fclose(outputFd);
+    if(image->map == MAP_FAILED) {
+        // Some file systems cannot map files; writeImage() still works there
+        memset(image, 0, sizeof(*image));
+        return 0;
+    }
+    image->pixels = (pixel*)((char*)image->map + headerSize);
+
+    return 0;
+}
+
+int unmapImage(mappedImage* image) {
+    if(image->map != NULL && munmap(image->map, image->mapSize) < 0) {
+        perror("Error: Cannot write output file\n");
         return -1;
     }
+    memset(image, 0, sizeof(*image));
 
     return 0;
 }
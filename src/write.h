@@ -5,7 +5,30 @@
 
 #include "pnm.h"
 
+// Not a PNM mode: writeImage() writes images with it as QOI instead
+#define WRITE_MODE_QOI 0
+
 int writeHeader(pnmHeader header, FILE* outputFd);
-int writeBody(pnmHeader header, pixel* pixels, FILE* outputFd);
+// P3 bodies are formatted on up to threads threads
+int writeBody(pnmHeader header, pixel* pixels, FILE* outputFd,
+    size_t threads);
+// Writes a whole image to path with writeHeader() and writeBody(), or as
+// QOI for WRITE_MODE_QOI
+int writeImage(const char* path, pnmHeader header, pixel* pixels,
+    size_t threads);
+
+typedef struct mappedImage {
+    // The body of the mapped file, or NULL if it could not be mapped
+    pixel* pixels;
+    void* map;
+    size_t mapSize;
+} mappedImage;
+
+// Creates the P6 image file at path, with header and room for its body, and
+// maps it so pixels written to image->pixels land straight in the file.
+// Files that cannot be mapped, like pipes and terminals, leave image->pixels
+// NULL; writeImage() can still write those.
+int mapImage(mappedImage* image, const char* path, pnmHeader header);
+int unmapImage(mappedImage* image);
 
 #endif // CS430_PNM_WRITE_H
@@ -0,0 +1,537 @@
+#!/bin/sh
+# Checks raycast against the fixtures in this directory and prints one line
+# per failure and a summary. `make check` runs it from the repository root.
+#
+#   success.*.json     scenes that must render
+#   fail.*.json        scenes that must fail with the message in fail.*.err
+#   keyframes/         the same for -k keyframe files, on examples/example.json
+#   spheres.json       300 spheres, two planes and four lights
+#   degenerate.json    a camera inside a sphere, a zero radius, a plane normal
+#                      to normalize and lights without attenuation
+#   lights.json        point and spot lights with every kind of attenuation
+#   generate.5-2-3.json  --generate 5,2,3 --seed 7
+#   tetra.mesh         a tetrahedron for success.mesh.json, little-endian
+#   relight.json       lights.json with light and material edits to relight
+#   renders.cksum      cksum of P6 renders from before any option existed:
+#                      scene, width, height, then the cksum output
+#   options.cksum      cksum output, scene, width, height and options of
+#                      renders with options that change the image, saved by
+#                      the change that added the option
+#
+# Every option that must not change the image is checked against
+# renders.cksum, and the single-precision build (the second argument,
+# or the first with -f32 appended) against the double one. The render
+# server is checked with serve-client (the third argument, or next to the
+# first), built from serve_client.c.
+
+RAYCAST=${1:-out/raycast}
+RAYCAST_F32=${2:-$RAYCAST-f32}
+SERVE_CLIENT=${3:-${RAYCAST%/*}/serve-client}
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+passed=0
+failed=0
+
+pass() {
+    passed=$((passed + 1))
+}
+
+fail() {
+    failed=$((failed + 1))
+    echo "FAIL: $*"
+}
+
+# Renders with the given arguments, less the output file, and compares the
+# image to the expected cksum output
+render_check() {
+    render_expected=$1
+    shift
+    if "$RAYCAST" "$@" "$TMP/render.ppm" 2>"$TMP/render.err" &&
+        [ "$(cksum < "$TMP/render.ppm")" = "$render_expected" ]; then
+        pass
+    else
+        fail "render ${RAYCAST_PACKET:+RAYCAST_PACKET=$RAYCAST_PACKET }$*"
+    fi
+}
+
+# Prints how many bytes differ between two files of the same size and the
+# largest difference between two of them
+compare_bytes() {
+    cmp -l "$1" "$2" | awk '
+        function octal(text) {
+            text = sprintf("%03d", text)
+            return (substr(text, 1, 1) * 8 + substr(text, 2, 1)) * 8 + \
+                substr(text, 3, 1)
+        }
+        {
+            difference = octal($2) - octal($3)
+            if(difference < 0) {
+                difference = -difference
+            }
+            if(difference > largest) {
+                largest = difference
+            }
+            count++
+        }
+        END { print count + 0, largest + 0 }'
+}
+
+# Scenes that must render, and ones that must fail with a given error
+for scene in tests/success.*.json; do
+    if "$RAYCAST" 8 8 "$scene" "$TMP/out.ppm" 2>"$TMP/err" &&
+        ! grep -q '^Error' "$TMP/err"; then
+        pass
+    else
+        fail "$scene"
+    fi
+done
+for dir in tests tests/keyframes; do
+    for scene in "$dir"/fail.*.json; do
+        if [ "$dir" = tests ]; then
+            "$RAYCAST" 8 8 "$scene" "$TMP/out.ppm" 2>"$TMP/err"
+        else
+            "$RAYCAST" -k "$scene" 8 8 examples/example.json "$TMP/out.ppm" \
+                2>"$TMP/err"
+        fi
+        if [ $? -eq 1 ] && cmp -s "$TMP/err" "${scene%.json}.err"; then
+            pass
+        else
+            fail "$scene"
+        fi
+    done
+done
+for keys in tests/keyframes/success.*.json; do
+    if "$RAYCAST" -k "$keys" 8 8 examples/example.json "$TMP/out.ppm" \
+        2>"$TMP/err" && ! grep -q '^Error' "$TMP/err"; then
+        pass
+    else
+        fail "$keys"
+    fi
+done
+
+# Renders match the ones from before
+while read -r scene width height sum size; do
+    expected="$sum $size"
+    render_check "$expected" "$width" "$height" "$scene"
+    render_check "$expected" -t 4 "$width" "$height" "$scene"
+    render_check "$expected" -t 0 "$width" "$height" "$scene"
+    # A mapped output file is sized to the image, even over a larger one
+    head -c 300000 /dev/zero > "$TMP/render.ppm"
+    render_check "$expected" "$width" "$height" "$scene"
+    # A pipe cannot be mapped, so the image is written after the render
+    if [ "$("$RAYCAST" "$width" "$height" "$scene" /dev/stdout | cksum)" = \
+        "$expected" ]; then
+        pass
+    else
+        fail "render $width $height $scene to a pipe"
+    fi
+    render_check "$expected" -t 4 -b 32 "$width" "$height" "$scene"
+    render_check "$expected" -b 1 "$width" "$height" "$scene"
+    # P3 holds the same pixels, and is the same file with any threads
+    "$RAYCAST" -p 3 "$width" "$height" "$scene" "$TMP/ascii.ppm"
+    tail -c $((width * height * 3)) "$TMP/render.ppm" | od -An -v -tu1 |
+        tr -s ' \n' '\n\n' | sed '/^$/d' > "$TMP/binary.values"
+    sed 1,4d "$TMP/ascii.ppm" | tr -s ' \n' '\n\n' | sed '/^$/d' \
+        > "$TMP/ascii.values"
+    if cmp -s "$TMP/binary.values" "$TMP/ascii.values"; then
+        pass
+    else
+        fail "render -p 3 $width $height $scene"
+    fi
+    ascii=$(cksum < "$TMP/ascii.ppm")
+    render_check "$ascii" -p 3 -t 4 "$width" "$height" "$scene"
+    render_check "$ascii" -p 3 -t 4 -b 32 "$width" "$height" "$scene"
+
+    # Saving the HDR colors leaves the image alone, and so does exporting
+    # them with the default curve, or rendering with that curve's gamma, as
+    # no channel of these scenes is near enough a level boundary to round
+    # differently as a float
+    render_check "$expected" --hdr "$TMP/render.pfm" "$width" "$height" \
+        "$scene"
+    render_check "$expected" --export "$TMP/render.pfm"
+    render_check "$expected" --gamma 1 "$width" "$height" "$scene"
+    # Exporting with a tone curve gives what rendering with it does
+    "$RAYCAST" --tonemap aces --gamma 2.2 --depth 16 "$width" "$height" \
+        "$scene" "$TMP/tonemap.ppm"
+    render_check "$(cksum < "$TMP/tonemap.ppm")" --tonemap aces --gamma 2.2 \
+        --depth 16 --export "$TMP/render.pfm"
+
+    # QOI is the same file whether it is compressed in bands as they render
+    # or whole after the render (forced by --hdr), with any threads
+    "$RAYCAST" -p qoi "$width" "$height" "$scene" "$TMP/image.qoi"
+    qoi=$(cksum < "$TMP/image.qoi")
+    render_check "$qoi" -p qoi -t 4 "$width" "$height" "$scene"
+    render_check "$qoi" -p qoi --hdr "$TMP/render.pfm" "$width" "$height" \
+        "$scene"
+    render_check "$qoi" -p qoi --export "$TMP/render.pfm"
+
+    render_check "$expected" -s off "$width" "$height" "$scene"
+    render_check "$expected" -t 4 -s tile "$width" "$height" "$scene"
+    # One sample at the pixel center, and never more when the variance
+    # threshold cannot be reached
+    render_check "$expected" -n 1 -m 16 -v 1000 "$width" "$height" "$scene"
+    # Adaptive mode with no tolerance traces every pixel
+    render_check "$expected" -a 8 -q 0 "$width" "$height" "$scene"
+    # Saving a G-buffer leaves the image alone, and relighting from it with
+    # nothing changed gives it back
+    render_check "$expected" -g "$TMP/gbuffer" "$width" "$height" "$scene"
+    render_check "$expected" -t 4 -r "$TMP/gbuffer" "$width" "$height" \
+        "$scene"
+    # A one frame animation is the still image
+    render_check "$expected" -f 1 "$width" "$height" "$scene"
+    for packet in off avx2 avx512; do
+        RAYCAST_PACKET=$packet render_check "$expected" -t 4 "$width" \
+            "$height" "$scene"
+    done
+
+    # A compiled scene renders the same, and so does its source once changed
+    # (with a warning, from the JSON) or gone
+    cp "$scene" "$TMP/scene.json"
+    "$RAYCAST" --compile "$TMP/scene.json" "$TMP/scene.rcs"
+    render_check "$expected" -t 4 "$width" "$height" "$TMP/scene.rcs"
+    echo ' ' >> "$TMP/scene.json"
+    render_check "$expected" "$width" "$height" "$TMP/scene.rcs"
+    if grep -q '^Warning: .* changed after' "$TMP/render.err"; then
+        pass
+    else
+        fail "no warning for a stale compiled $scene"
+    fi
+    rm "$TMP/scene.json"
+    render_check "$expected" "$width" "$height" "$TMP/scene.rcs"
+
+    # The single-precision build is within 1 of it on every channel, with
+    # fewer than 0.1% of bytes differing at all
+    "$RAYCAST" "$width" "$height" "$scene" "$TMP/double.ppm"
+    "$RAYCAST_F32" "$width" "$height" "$scene" "$TMP/single.ppm"
+    compare_bytes "$TMP/double.ppm" "$TMP/single.ppm" > "$TMP/compare"
+    read -r count largest < "$TMP/compare"
+    if [ "$largest" -le 1 ] && [ $((count * 1000)) -lt "$size" ]; then
+        pass
+    else
+        fail "$RAYCAST_F32 $width $height $scene: $count bytes differ," \
+            "by up to $largest"
+    fi
+done < tests/renders.cksum
+
+# Meshes give the same image on the scalar and packet paths, with or without
+# the shadow cache
+"$RAYCAST" 160 120 tests/success.mesh.json "$TMP/mesh.ppm"
+expected=$(cksum < "$TMP/mesh.ppm")
+render_check "$expected" -t 4 -s off 160 120 tests/success.mesh.json
+for packet in off avx2 avx512; do
+    RAYCAST_PACKET=$packet render_check "$expected" 160 120 \
+        tests/success.mesh.json
+done
+
+# Mesh paths are relative to the scene file, not to where raycast runs
+here=$PWD
+case $RAYCAST in
+    /*) raycast=$RAYCAST ;;
+    *) raycast=$here/$RAYCAST ;;
+esac
+if (cd "$TMP" && "$raycast" 160 120 "$here/tests/success.mesh.json" \
+    mesh-cwd.ppm) && [ "$(cksum < "$TMP/mesh-cwd.ppm")" = "$expected" ]; then
+    pass
+else
+    fail "render tests/success.mesh.json from another directory"
+fi
+
+# Compiled scenes keep their meshes, and are refused by the other precision
+# or when cut short
+"$RAYCAST" --compile tests/success.mesh.json "$TMP/mesh.rcs"
+render_check "$expected" 160 120 "$TMP/mesh.rcs"
+if (cd "$TMP" && "$raycast" 160 120 mesh.rcs mesh-cwd.ppm) &&
+    [ "$(cksum < "$TMP/mesh-cwd.ppm")" = "$expected" ]; then
+    pass
+else
+    fail "render the compiled tests/success.mesh.json from another directory"
+fi
+for broken in "$RAYCAST_F32" truncated; do
+    if [ "$broken" = truncated ]; then
+        head -c 200 "$TMP/mesh.rcs" > "$TMP/broken.rcs"
+        broken=$RAYCAST
+    else
+        cp "$TMP/mesh.rcs" "$TMP/broken.rcs"
+    fi
+    if "$broken" 8 8 "$TMP/broken.rcs" "$TMP/out.ppm" 2>"$TMP/err"; then
+        fail "$broken rendered a compiled scene it cannot load"
+    elif grep -q '^Error: ' "$TMP/err"; then
+        pass
+    else
+        fail "$broken gave no error for a compiled scene it cannot load"
+    fi
+done
+
+# Relighting with new light colors, attenuation, spot cones and materials,
+# and one light moved, gives the same image as a full render
+"$RAYCAST" -g "$TMP/gbuffer" 317 211 tests/lights.json "$TMP/out.ppm"
+"$RAYCAST" 317 211 tests/relight.json "$TMP/relight.ppm"
+render_check "$(cksum < "$TMP/relight.ppm")" -r "$TMP/gbuffer" 317 211 \
+    tests/relight.json
+if "$RAYCAST" -r "$TMP/gbuffer" 317 211 tests/spheres.json "$TMP/out.ppm" \
+    2>/dev/null; then
+    fail "relighting tests/spheres.json from the G-buffer of another scene"
+else
+    pass
+fi
+
+# Watch mode renders every saved change as a full render of it would, when
+# only a sphere moved (just the dirty tiles) and when a light changed
+watch_check() {
+    sed "$1" tests/lights.json > "$TMP/watch.next"
+    mv "$TMP/watch.next" "$TMP/watch.json"
+    tries=0
+    while [ "$(grep -c '^Rendered' "$TMP/watch.err")" -lt "$2" ] &&
+        [ $tries -lt 100 ]; do
+        sleep 0.1
+        tries=$((tries + 1))
+    done
+    "$RAYCAST" 160 120 "$TMP/watch.json" "$TMP/full.ppm"
+    if cmp -s "$TMP/watch.ppm" "$TMP/full.ppm"; then
+        pass
+    else
+        fail "watch mode after $1"
+    fi
+}
+cp tests/lights.json "$TMP/watch.json"
+# Created up front, as the watcher may not have opened it by the first grep
+: > "$TMP/watch.err"
+timeout 30 "$RAYCAST" -w -t 4 160 120 "$TMP/watch.json" "$TMP/watch.ppm" \
+    2>"$TMP/watch.err" &
+watcher=$!
+tries=0
+while ! grep -q '^Watching' "$TMP/watch.err" && [ $tries -lt 100 ]; do
+    sleep 0.1
+    tries=$((tries + 1))
+done
+watch_check 's/\[0, -0.1, 6\]/[0.3, 0.2, 5.5]/' 1
+watch_check 's/\[0, -0.1, 6\]/[0.3, 0.2, 5.5]/; s/\[0, 4, 2\]/[1, 4, 1]/' 2
+kill $watcher
+wait $watcher 2>/dev/null
+
+# The render server answers each request as the command line would render
+# or fail, and keeps running after bad scenes and requests
+timeout 30 "$RAYCAST" -t 4 --serve "$TMP/socket" 2>"$TMP/serve.err" &
+server=$!
+{
+    printf 'LOAD lights %s\n' "$(wc -c < tests/lights.json)"
+    cat tests/lights.json
+    printf 'RENDER lights 160 120\n'
+    printf 'RENDER bad 8 8 %s\n' "$(wc -c < tests/fail.type.json)"
+    cat tests/fail.type.json
+    printf 'RENDER bad 8 8\nDROP lights\nRENDER lights 8 8\nBOGUS\n'
+} | "$SERVE_CLIENT" "$TMP/socket" > "$TMP/replies"
+"$RAYCAST" 160 120 tests/lights.json "$TMP/full.ppm"
+{
+    printf 'OK 0\nOK %s\n' "$(wc -c < "$TMP/full.ppm")"
+    cat "$TMP/full.ppm"
+    printf 'ERROR %s\n' "$(sed 's/^Error: //' tests/fail.type.err)"
+    printf 'ERROR Unknown scene\nOK 0\nERROR Unknown scene\n'
+    printf 'ERROR Unknown request\n'
+} > "$TMP/expected"
+if cmp -s "$TMP/replies" "$TMP/expected"; then
+    pass
+else
+    fail "render server replies"
+fi
+# A second connection, loading the scene along with the render
+{
+    printf 'RENDER spheres 317 211 %s\n' "$(wc -c < tests/spheres.json)"
+    cat tests/spheres.json
+} | "$SERVE_CLIENT" "$TMP/socket" > "$TMP/replies"
+"$RAYCAST" 317 211 tests/spheres.json "$TMP/full.ppm"
+{
+    printf 'OK %s\n' "$(wc -c < "$TMP/full.ppm")"
+    cat "$TMP/full.ppm"
+} > "$TMP/expected"
+if cmp -s "$TMP/replies" "$TMP/expected"; then
+    pass
+else
+    fail "render server load and render in one request"
+fi
+# Served mesh paths are relative to the server's directory and must stay in
+# it, and a mesh that fails to load says why
+load_mesh() {
+    sed "s|\"tetra.mesh\"|\"$1\"|" tests/success.mesh.json > "$TMP/mesh.json"
+    printf 'LOAD mesh %s\n' "$(wc -c < "$TMP/mesh.json")"
+    cat "$TMP/mesh.json"
+}
+{
+    load_mesh tests/tetra.mesh
+    load_mesh /etc/passwd
+    load_mesh tests/../../etc/passwd
+    load_mesh tests/missing.mesh
+} | "$SERVE_CLIENT" "$TMP/socket" > "$TMP/replies"
+{
+    printf 'OK 0\n'
+    for path in /etc/passwd tests/../../etc/passwd; do
+        printf "ERROR Mesh path '%s' must be relative and stay inside the" \
+            "$path"
+        printf " server's directory\n"
+    done
+    printf "ERROR Cannot open mesh 'tests/missing.mesh': No such file or"
+    printf ' directory\n'
+} > "$TMP/expected"
+if cmp -s "$TMP/replies" "$TMP/expected"; then
+    pass
+else
+    fail "render server mesh paths"
+fi
+kill $server
+wait $server 2>/dev/null
+
+# A scene big enough to parse in parallel gives the same image and the same
+# errors with any threads
+awk 'BEGIN {
+    print "["
+    print "{\"type\": \"camera\", \"width\": 2, \"height\": 2},"
+    for(i = 0; i < 10000; i++) {
+        printf "{\"type\": \"sphere\", \"diffuse_color\": [%.3f, %.3f, %.3f], ",
+            i % 7 / 7, i % 11 / 11, i % 13 / 13
+        printf "\"position\": [%.4f, %.4f, %.4f], \"radius\": %.4f},\n",
+            i * 37 % 1000 / 25 - 20, i * 53 % 1000 / 25 - 20,
+            20 + i * 71 % 1000 / 20, 0.05 + i % 17 / 40
+    }
+    printf "{\"type\": \"light\", \"color\": [1, 1, 1], "
+    printf "\"position\": [0, 10, 0], \"radial-a0\": 1, "
+    print "\"radial-a1\": 0, \"radial-a2\": 0}"
+    print "]"
+}' > "$TMP/big.json"
+if [ "$(wc -c < "$TMP/big.json")" -ge 1048576 ]; then
+    pass
+else
+    fail "generated scene too small to parse in parallel"
+fi
+"$RAYCAST" -t 1 64 48 "$TMP/big.json" "$TMP/big.ppm"
+render_check "$(cksum < "$TMP/big.ppm")" -t 4 64 48 "$TMP/big.json"
+sed '9000s/"radius"/"color": [1, 1, 1], "radius"/' "$TMP/big.json" \
+    > "$TMP/unknown.json"
+sed '9000s/"radius": [^}]*/&, "radius": 1/' "$TMP/big.json" \
+    > "$TMP/duplicate.json"
+sed '9000s/, "radius": [^}]*//' "$TMP/big.json" > "$TMP/missing.json"
+sed '9000s/}/]/' "$TMP/big.json" > "$TMP/syntax.json"
+for error in "unknown:Line 9000: Key 'color' not supported under 'sphere'" \
+    "duplicate:Line 9000: 'radius' already defined" \
+    "missing:Line 9000: 'sphere' missing 'radius' property" \
+    "syntax:Line 9000: Expected '}'"; do
+    name=${error%%:*}
+    "$RAYCAST" -t 1 8 8 "$TMP/$name.json" "$TMP/out.ppm" 2>"$TMP/serial.err"
+    "$RAYCAST" -t 4 8 8 "$TMP/$name.json" "$TMP/out.ppm" \
+        2>"$TMP/parallel.err"
+    if [ "$(cat "$TMP/serial.err")" = "Error: ${error#*:}" ] &&
+        cmp -s "$TMP/serial.err" "$TMP/parallel.err"; then
+        pass
+    else
+        fail "parallel parse of a $name error"
+    fi
+done
+
+# Negative thread counts are refused, not wrapped around
+for threads in -1 ' -1'; do
+    if "$RAYCAST" -t "$threads" 8 8 examples/example.json "$TMP/out.ppm" \
+        2>"$TMP/err"; then
+        fail "-t '$threads' rendered"
+    elif grep -q "^Error: Invalid thread count" "$TMP/err"; then
+        pass
+    else
+        fail "-t '$threads' gave no error"
+    fi
+done
+
+# The generator gives the same scene for the same seed, on stdout too, and
+# another one for another seed
+"$RAYCAST" --generate 5,2,3 --seed 7 "$TMP/generate.json"
+"$RAYCAST" --generate 5,2,3 --seed 7 - > "$TMP/generate.out"
+if cmp -s "$TMP/generate.json" tests/generate.5-2-3.json &&
+    cmp -s "$TMP/generate.out" tests/generate.5-2-3.json; then
+    pass
+else
+    fail "--generate 5,2,3 --seed 7 differs from tests/generate.5-2-3.json"
+fi
+"$RAYCAST" --generate 5,2,3 --seed 8 "$TMP/generate.json"
+if cmp -s "$TMP/generate.json" tests/generate.5-2-3.json; then
+    fail "--generate ignores --seed"
+else
+    pass
+fi
+
+# A bigger generated scene does have a channel that rounds to the other
+# level as a float, so the default export and --gamma 1 are a level off
+# there, and only there
+"$RAYCAST" --generate 2000,3,4 --seed 7 "$TMP/generate.json"
+"$RAYCAST" --hdr "$TMP/generate.pfm" 640 480 "$TMP/generate.json" \
+    "$TMP/generate.ppm"
+"$RAYCAST" --export "$TMP/generate.pfm" "$TMP/export.ppm"
+"$RAYCAST" --gamma 1 640 480 "$TMP/generate.json" "$TMP/gamma.ppm"
+for toned in export gamma; do
+    compare_bytes "$TMP/generate.ppm" "$TMP/$toned.ppm" > "$TMP/compare"
+    read -r count largest < "$TMP/compare"
+    if [ "$count" -le 1 ] && [ "$largest" -le 1 ]; then
+        pass
+    else
+        fail "--$toned of a generated scene: $count bytes differ," \
+            "by up to $largest"
+    fi
+done
+
+# --stats prints one JSON line with the counts of the render, and leaves the
+# image alone
+"$RAYCAST" --stats -t 4 160 120 tests/generate.5-2-3.json "$TMP/stats.ppm" \
+    > "$TMP/stats"
+render_check "$(cksum < "$TMP/stats.ppm")" 160 120 tests/generate.5-2-3.json
+if [ "$(wc -l < "$TMP/stats")" -eq 1 ] &&
+    grep -q '^{"scene":"tests/generate.5-2-3.json","width":160,' \
+        "$TMP/stats" &&
+    grep -q '"height":120,"threads":4,"objects":7,"lights":3,' "$TMP/stats" &&
+    grep -q '"primary_rays":19200,"rays_per_second":[0-9]*}$' "$TMP/stats"
+then
+    pass
+else
+    fail "--stats printed $(cat "$TMP/stats")"
+fi
+# Supersampled tiles also count the ring of pixels they trace around them:
+# 168 by 126 rays for 160 by 120 pixels in 32 by 32 tiles, with none
+# refined. The pixels themselves still take one sample each.
+for threads in 1 4; do
+    if "$RAYCAST" --stats -n 1 -m 4 -v 1000 -t $threads 160 120 \
+        examples/example.json "$TMP/stats.ppm" 2>"$TMP/err" |
+        grep -q '"primary_rays":21168,' &&
+        grep -q '^Anti-aliasing: 1.00 samples per pixel' "$TMP/err"; then
+        pass
+    else
+        fail "--stats -n 1 -m 4 -t $threads miscounted the ring rays"
+    fi
+done
+# Adaptive renders count the rays they trace, the same with any threads,
+# and relighting traces none
+for threads in 1 4; do
+    "$RAYCAST" --stats -a 8 -t $threads 160 120 tests/generate.5-2-3.json \
+        "$TMP/stats.ppm" | sed 's/.*"primary_rays":\([0-9]*\),.*/\1/' \
+        > "$TMP/rays.$threads"
+done
+read -r rays < "$TMP/rays.1"
+if [ "$rays" -gt 0 ] && [ "$rays" -lt 19200 ] &&
+    cmp -s "$TMP/rays.1" "$TMP/rays.4"; then
+    pass
+else
+    fail "--stats -a 8 counted $rays primary rays"
+fi
+"$RAYCAST" -g "$TMP/gbuffer" 160 120 tests/generate.5-2-3.json \
+    "$TMP/stats.ppm"
+if "$RAYCAST" --stats -r "$TMP/gbuffer" 160 120 tests/generate.5-2-3.json \
+    "$TMP/stats.ppm" | grep -q '"primary_rays":0,'; then
+    pass
+else
+    fail "--stats -r counted primary rays"
+fi
+
+# Renders with options that change the image match the saved ones, with any
+# number of threads
+while read -r sum size scene width height options; do
+    render_check "$sum $size" $options "$width" "$height" "$scene"
+    render_check "$sum $size" -t 4 $options "$width" "$height" "$scene"
+done < tests/options.cksum
+
+echo "$passed passed, $failed failed"
+[ $failed -eq 0 ]
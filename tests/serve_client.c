@@ -0,0 +1,109 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Test client for --serve. Sends its stdin to the server on the socket at
+// the given path, then copies every reply to stdout until the server closes
+// the connection. tests/run.sh builds requests with printf and checks the
+// replies byte for byte.
+
+// Tries to connect this many times, 100ms apart, while the server starts
+#define CLIENT_ATTEMPTS 100
+
+int connectServer(const char* path);
+int sendAll(int fd, const char* data, size_t size);
+
+int main(int argc, char** argv) {
+    if(argc != 2) {
+        fprintf(stderr, "usage: serve-client /path/to/socket\n");
+        return EXIT_FAILURE;
+    }
+
+    int fd = connectServer(argv[1]);
+    if(fd < 0) {
+        return EXIT_FAILURE;
+    }
+
+    char buffer[65536];
+    size_t length;
+    while((length = fread(buffer, 1, sizeof(buffer), stdin)) > 0) {
+        if(sendAll(fd, buffer, length) < 0) {
+            perror("Error: Cannot send request");
+            close(fd);
+            return EXIT_FAILURE;
+        }
+    }
+    // The server answers every request it has read, then sees the end
+    shutdown(fd, SHUT_WR);
+
+    ssize_t received;
+    while((received = read(fd, buffer, sizeof(buffer))) != 0) {
+        if(received < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            perror("Error: Cannot read reply");
+            close(fd);
+            return EXIT_FAILURE;
+        }
+        if(fwrite(buffer, 1, received, stdout) != (size_t)received) {
+            perror("Error: Cannot write reply");
+            close(fd);
+            return EXIT_FAILURE;
+        }
+    }
+
+    close(fd);
+    return fflush(stdout) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int connectServer(const char* path) {
+    struct sockaddr_un address;
+    struct timespec interval = { 0, 100000000L };
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: Socket path '%s' is too long\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    for(int attempt = 0; attempt < CLIENT_ATTEMPTS; attempt++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd < 0) {
+            perror("Error: Cannot create socket");
+            return -1;
+        }
+        if(connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0) {
+            return fd;
+        }
+        close(fd);
+        nanosleep(&interval, NULL);
+    }
+
+    fprintf(stderr, "Error: Cannot connect to '%s'\n", path);
+    return -1;
+}
+
+int sendAll(int fd, const char* data, size_t size) {
+    while(size > 0) {
+        ssize_t sent = write(fd, data, size);
+        if(sent < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return 0;
+}